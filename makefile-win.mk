@@ -10,6 +10,15 @@ src/parser.h \
 src/replay.h \
 src/analyzer.h \
 src/analysis.h \
+src/aggregate.h \
+src/catalog.h \
+src/archive.h \
+src/benchmark.h \
+src/cmcoder.h \
+src/seekable.h \
+src/peek.h \
+src/lzmadict.h \
+src/lzmatune.h \
 src/compressor.h \
 src/enums.h \
 src/schema.h \
@@ -21,6 +30,15 @@ build-win/parser.o \
 build-win/replay.o \
 build-win/analyzer.o \
 build-win/analysis.o \
+build-win/aggregate.o \
+build-win/catalog.o \
+build-win/archive.o \
+build-win/benchmark.o \
+build-win/cmcoder.o \
+build-win/seekable.o \
+build-win/peek.o \
+build-win/lzmadict.o \
+build-win/lzmatune.o \
 build-win/compressor.o \
 build-win/main.o
 
@@ -29,6 +47,15 @@ build-win/parser.d \
 build-win/replay.d \
 build-win/analyzer.d \
 build-win/analysis.d \
+build-win/aggregate.d \
+build-win/catalog.d \
+build-win/archive.d \
+build-win/benchmark.d \
+build-win/cmcoder.d \
+build-win/seekable.d \
+build-win/peek.d \
+build-win/lzmadict.d \
+build-win/lzmatune.d \
 build-win/compressor.d \
 build-win/main.d
 
@@ -61,7 +88,7 @@ targets: directories slippc
 slippc: $(OBJS)
 	@echo 'Building target: $@'
 	@echo 'Invoking: GCC C++ Linker'
-	x86_64-w64-mingw32-g++ -static -static-libgcc -static-libstdc++ -L/usr/x86_64-w64-mingw32/lib/ -std=c++17 -o "./slippc.exe" $(OBJS) $(LIBS)
+	x86_64-w64-mingw32-g++ -static -static-libgcc -static-libstdc++ -L/usr/x86_64-w64-mingw32/lib/ -std=c++17 -pthread -o "./slippc.exe" $(OBJS) $(LIBS)
 	@echo 'Finished building target: $@'
 	@echo ' '
 
@@ -69,7 +96,7 @@ build-win/%.o: ./src/%.cpp $(HEADERS)
 	@echo 'Building file: $<'
 	@echo 'Invoking: GCC C++ Compiler'
 	$(LINK.c) $< -c -o $@
-	x86_64-w64-mingw32-g++ $(DEFINES) $(GUI) $(INCLUDES) -static -static-libgcc -static-libstdc++ $(INCLUDES) $(OLEVEL) -g3 -Wall -c -fmessage-length=0 -std=c++17 $(UNUSED) -o "$@" "$<"
+	x86_64-w64-mingw32-g++ $(DEFINES) $(GUI) $(INCLUDES) -static -static-libgcc -static-libstdc++ $(INCLUDES) $(OLEVEL) -g3 -Wall -c -fmessage-length=0 -std=c++17 -pthread $(UNUSED) -o "$@" "$<"
 	@echo 'Finished building: $<'
 	@echo ' '
 
@@ -0,0 +1,250 @@
+#include "aggregate.h"
+
+//JSON Output shortcuts
+#define JDBL(i,k,n) SPACE[ILEV*(i)] << "\"" << (k) << "\" : " << double(n)
+#define JUIN(i,k,n) SPACE[ILEV*(i)] << "\"" << (k) << "\" : " << uint64_t(n)
+#define JSTR(i,k,s) SPACE[ILEV*(i)] << "\"" << (k) << "\" : \"" << (s) << "\""
+
+namespace slip {
+
+//Readable name of an external character ID, which may be out of range on modded replays
+static std::string charName(unsigned char_id) {
+  return (char_id < CharExt::__LAST) ? CharExt::name[char_id] : "unknown";
+}
+
+void AggregateStats::add(const Analysis &a, unsigned p) {
+  const AnalysisPlayer &ap  = a.ap[p];
+  const AnalysisPlayer &opp = a.ap[1-p];
+  ++games;
+  if (a.winner_port >= 0) {
+    if (unsigned(a.winner_port) == ap.port) {
+      ++wins;
+    } else {
+      ++losses;
+    }
+  }
+  frames       += a.game_length;
+  stocks_taken += opp.start_stocks - std::min(opp.start_stocks,opp.end_stocks);
+  stocks_lost  += ap.start_stocks  - std::min(ap.start_stocks,ap.end_stocks);
+
+  unsigned i = 0;
+  #define _AGGREGATE_ADD(n,f,a) stats[i++] += ap.f;
+  AGGREGATE_STATS(_AGGREGATE_ADD)
+  #undef _AGGREGATE_ADD
+
+  for(unsigned d = 0; d < Move::__LAST; ++d) {
+    move_counts[d] += ap.move_counts[d];
+  }
+  for(unsigned d = 0; d < Dynamic::__LAST; ++d) {
+    dyn_counts[d] += ap.dyn_counts[d];
+    dyn_damage[d] += ap.dyn_damage[d];
+  }
+}
+
+void AggregateStats::merge(const AggregateStats &o) {
+  games        += o.games;
+  wins         += o.wins;
+  losses       += o.losses;
+  frames       += o.frames;
+  stocks_taken += o.stocks_taken;
+  stocks_lost  += o.stocks_lost;
+  for(unsigned i = 0; i < N_AGGREGATE_STATS; ++i) {
+    stats[i] += o.stats[i];
+  }
+  for(unsigned d = 0; d < Move::__LAST; ++d) {
+    move_counts[d] += o.move_counts[d];
+  }
+  for(unsigned d = 0; d < Dynamic::__LAST; ++d) {
+    dyn_counts[d] += o.dyn_counts[d];
+    dyn_damage[d] += o.dyn_damage[d];
+  }
+}
+
+std::string AggregateStats::asJson(unsigned ilev, bool more) const {
+  static const std::string stat_names[N_AGGREGATE_STATS] = {
+    #define _AGGREGATE_NAME(n,f,a) n,
+    AGGREGATE_STATS(_AGGREGATE_NAME)
+    #undef _AGGREGATE_NAME
+  };
+  static const bool stat_additive[N_AGGREGATE_STATS] = {
+    #define _AGGREGATE_ADDITIVE(n,f,a) a,
+    AGGREGATE_STATS(_AGGREGATE_ADDITIVE)
+    #undef _AGGREGATE_ADDITIVE
+  };
+  double per = (games > 0) ? 1.0/games : 0;
+
+  std::stringstream ss;
+  ss << std::setprecision(10);
+  ss << JUIN(ilev,"games",        games)        << ",\n";
+  ss << JUIN(ilev,"wins",         wins)         << ",\n";
+  ss << JUIN(ilev,"losses",       losses)       << ",\n";
+  ss << JDBL(ilev,"win_rate",     (wins+losses) > 0 ? double(wins)/(wins+losses) : 0) << ",\n";
+  ss << JUIN(ilev,"frames",       frames)       << ",\n";
+  ss << JUIN(ilev,"stocks_taken", stocks_taken) << ",\n";
+  ss << JUIN(ilev,"stocks_lost",  stocks_lost)  << ",\n";
+
+  ss << SPACE[ILEV*ilev] << "\"totals\" : {\n";
+  bool first = true;
+  for(unsigned i = 0; i < N_AGGREGATE_STATS; ++i) {
+    if (!stat_additive[i]) {
+      continue;
+    }
+    ss << (first ? "" : ",\n") << JDBL(ilev+1,stat_names[i],stats[i]);
+    first = false;
+  }
+  ss << "\n";
+  ss << SPACE[ILEV*ilev] << "},\n";
+
+  ss << SPACE[ILEV*ilev] << "\"per_game\" : {\n";
+  for(unsigned i = 0; i < N_AGGREGATE_STATS; ++i) {
+    ss << JDBL(ilev+1,stat_names[i],stats[i]*per) << ((i+1 == N_AGGREGATE_STATS) ? "\n" : ",\n");
+  }
+  ss << SPACE[ILEV*ilev] << "},\n";
+
+  ss << SPACE[ILEV*ilev] << "\"interaction_frames\" : {\n";
+  for(unsigned d = Dynamic::__LAST-1; d > 0; --d) {
+    ss << JUIN(ilev+1,Dynamic::name[d], dyn_counts[d]) << ((d == 1) ? "\n" : ",\n");
+  }
+  ss << SPACE[ILEV*ilev] << "},\n";
+
+  ss << SPACE[ILEV*ilev] << "\"interaction_damage\" : {\n";
+  for(unsigned d = Dynamic::__LAST-1; d > 0; --d) {
+    ss << JDBL(ilev+1,Dynamic::name[d], dyn_damage[d]) << ((d == 1) ? "\n" : ",\n");
+  }
+  ss << SPACE[ILEV*ilev] << "},\n";
+
+  ss << SPACE[ILEV*ilev] << "\"moves_landed\" : {\n";
+  uint64_t _total_moves = 0;
+  for(unsigned d = 0; d < Move::BUBBLE; ++d) {
+    if (move_counts[d] > 0) {
+      ss << JUIN(ilev+1,Move::name[d], move_counts[d]) << ",\n";
+      _total_moves += move_counts[d];
+    }
+  }
+  ss << JUIN(ilev+1,"_total", _total_moves) << "\n";
+  ss << SPACE[ILEV*ilev] << "}" << (more ? ",\n" : "\n");
+
+  return ss.str();
+}
+
+void AggregateEntry::add(const Analysis &a, unsigned p) {
+  all.add(a,p);
+  vs[a.ap[1-p].char_id].add(a,p);
+  ++chars[a.ap[p].char_id];
+}
+
+void AggregateEntry::merge(const AggregateEntry &o) {
+  if (name.empty()) {
+    name = o.name;
+  }
+  all.merge(o.all);
+  for (const auto &kv : o.vs) {
+    vs[kv.first].merge(kv.second);
+  }
+  for (const auto &kv : o.chars) {
+    chars[kv.first] += kv.second;
+  }
+}
+
+std::string AggregateEntry::asJson(unsigned ilev) const {
+  std::stringstream ss;
+  ss << all.asJson(ilev,true);
+
+  ss << SPACE[ILEV*ilev] << "\"characters\" : {\n";
+  unsigned n = 0;
+  for (const auto &kv : chars) {
+    std::string key = charName(kv.first);
+    if (kv.first >= CharExt::__LAST) {  //Keep keys unique across several unknown characters
+      key += "_" + std::to_string(kv.first);
+    }
+    ss << JUIN(ilev+1,key,kv.second) << ((++n == chars.size()) ? "\n" : ",\n");
+  }
+  ss << SPACE[ILEV*ilev] << "},\n";
+
+  ss << SPACE[ILEV*ilev] << "\"matchups\" : [\n";
+  n = 0;
+  for (const auto &kv : vs) {
+    ss << SPACE[ILEV*(ilev+1)] << "{\n";
+    ss << JUIN(ilev+2,"opponent_char_id",   kv.first)                << ",\n";
+    ss << JSTR(ilev+2,"opponent_char_name", charName(kv.first))       << ",\n";
+    ss << kv.second.asJson(ilev+2);
+    ss << SPACE[ILEV*(ilev+1)] << "}" << ((++n == vs.size()) ? "\n" : ",\n");
+  }
+  ss << SPACE[ILEV*ilev] << "]\n";
+  return ss.str();
+}
+
+void Aggregate::add(const Analysis &a) {
+  if (!a.success) {
+    ++_skipped;
+    return;
+  }
+  ++_games;
+  for(unsigned p = 0; p < 2; ++p) {
+    // only games played on Slippi Online have connect codes to group by
+    if (!a.ap[p].tag_code.empty()) {
+      AggregateEntry &e = _players[a.ap[p].tag_code];
+      e.name = a.ap[p].tag_code;
+      e.add(a,p);
+    }
+    if (a.ap[p].char_id < CharExt::__LAST) {
+      AggregateEntry &e = _chars[a.ap[p].char_id];
+      e.name = a.ap[p].char_name;
+      e.add(a,p);
+    }
+  }
+}
+
+void Aggregate::merge(const Aggregate &o) {
+  _games   += o._games;
+  _skipped += o._skipped;
+  for (const auto &kv : o._players) {
+    _players[kv.first].merge(kv.second);
+  }
+  for (const auto &kv : o._chars) {
+    _chars[kv.first].merge(kv.second);
+  }
+}
+
+std::string Aggregate::asJson() const {
+  std::stringstream ss;
+  ss << "{" << std::endl;
+
+  ss << JSTR(0,"analyzer_version", SLIPPC_VERSION) << ",\n";
+  ss << JUIN(0,"games",            _games)         << ",\n";
+  ss << JUIN(0,"skipped",          _skipped)       << ",\n";
+
+  ss << "\"players\" : [\n";
+  unsigned n = 0;
+  for (const auto &kv : _players) {
+    ss << SPACE[ILEV] << "{\n";
+    ss << JSTR(2,"tag_code", escape_json(kv.second.name)) << ",\n";
+    ss << kv.second.asJson(2);
+    ss << SPACE[ILEV] << "}" << ((++n == _players.size()) ? "\n" : ",\n");
+  }
+  ss << "],\n";
+
+  ss << "\"characters\" : [\n";
+  n = 0;
+  for (const auto &kv : _chars) {
+    ss << SPACE[ILEV] << "{\n";
+    ss << JUIN(2,"char_id",   kv.first)       << ",\n";
+    ss << JSTR(2,"char_name", kv.second.name) << ",\n";
+    ss << kv.second.asJson(2);
+    ss << SPACE[ILEV] << "}" << ((++n == _chars.size()) ? "\n" : ",\n");
+  }
+  ss << "]\n";
+
+  ss << "}\n";
+  return ss.str();
+}
+
+void Aggregate::save(const char* outfilename) const {
+  std::ofstream fout;
+  fout.open(outfilename);
+  std::string j = asJson();
+  fout << j << std::endl;
+  fout.close();
+}
+
+}
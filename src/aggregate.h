@@ -0,0 +1,143 @@
+#ifndef AGGREGATE_H_
+#define AGGREGATE_H_
+
+#include <map>
+#include <string>
+
+#include "enums.h"
+#include "util.h"
+#include "analysis.h"
+
+//List of per-game AnalysisPlayer stats that are summed across games (JSON name, AnalysisPlayer field, additive)
+//  Non-additive stats (per-game means, ratios, rates, and minimums) only make sense averaged across games,
+//  so they are omitted from "totals" and only appear in "per_game"
+#define AGGREGATE_STATS(X) \
+  X("airdodges",              airdodges,              1) \
+  X("spotdodges",             spotdodges,             1) \
+  X("rolls",                  rolls,                  1) \
+  X("dashdances",             dashdances,             1) \
+  X("l_cancels_hit",          l_cancels_hit,          1) \
+  X("l_cancels_missed",       l_cancels_missed,       1) \
+  X("techs",                  techs,                  1) \
+  X("walltechs",              walltechs,              1) \
+  X("walljumps",              walljumps,              1) \
+  X("walltechjumps",          walltechjumps,          1) \
+  X("missed_techs",           missed_techs,           1) \
+  X("ledge_grabs",            ledge_grabs,            1) \
+  X("air_frames",             air_frames,             1) \
+  X("wavedashes",             wavedashes,             1) \
+  X("wavelands",              wavelands,              1) \
+  X("neutral_wins",           neutral_wins,           1) \
+  X("pokes",                  pokes,                  1) \
+  X("counters",               counters,               1) \
+  X("powershields",           powershields,           1) \
+  X("shield_breaks",          shield_breaks,          1) \
+  X("grabs",                  grabs,                  1) \
+  X("grab_escapes",           grab_escapes,           1) \
+  X("taunts",                 taunts,                 1) \
+  X("meteor_cancels",         meteor_cancels,         1) \
+  X("damage_dealt",           damage_dealt,           1) \
+  X("hits_blocked",           hits_blocked,           1) \
+  X("shield_stabs",           shield_stabs,           1) \
+  X("edge_cancel_aerials",    edge_cancel_aerials,    1) \
+  X("edge_cancel_specials",   edge_cancel_specials,   1) \
+  X("teeter_cancel_aerials",  teeter_cancel_aerials,  1) \
+  X("teeter_cancel_specials", teeter_cancel_specials, 1) \
+  X("phantom_hits",           phantom_hits,           1) \
+  X("no_impact_lands",        no_impact_lands,        1) \
+  X("shield_drops",           shield_drops,           1) \
+  X("pivots",                 pivots,                 1) \
+  X("reverse_edgeguards",     reverse_edgeguards,     1) \
+  X("self_destructs",         self_destructs,         1) \
+  X("stage_spikes",           stage_spikes,           1) \
+  X("short_hops",             short_hops,             1) \
+  X("full_hops",              full_hops,              1) \
+  X("shield_time",            shield_time,            1) \
+  X("shield_damage",          shield_damage,          1) \
+  X("shield_lowest",          shield_lowest,          0) \
+  X("total_openings",         total_openings,         1) \
+  X("mean_kill_openings",     mean_kill_openings,     0) \
+  X("mean_kill_percent",      mean_kill_percent,      0) \
+  X("mean_opening_percent",   mean_opening_percent,   0) \
+  X("galint_ledgedashes",     galint_ledgedashes,     1) \
+  X("mean_galint",            mean_galint,            0) \
+  X("button_count",           button_count,           1) \
+  X("cstick_count",           cstick_count,           1) \
+  X("astick_count",           astick_count,           1) \
+  X("trigger_count",          trigger_count,          1) \
+  X("actions_per_min",        apm,                    0) \
+  X("state_changes",          state_changes,          1) \
+  X("states_per_min",         aspm,                   0) \
+  X("shieldstun_times",       shieldstun_times,       1) \
+  X("shieldstun_act_frames",  shieldstun_act_frames,  1) \
+  X("hitstun_times",          hitstun_times,          1) \
+  X("hitstun_act_frames",     hitstun_act_frames,     1) \
+  X("wait_times",             wait_times,             1) \
+  X("wait_act_frames",        wait_act_frames,        1) \
+  X("used_norm_moves",        used_norm_moves,        1) \
+  X("used_spec_moves",        used_spec_moves,        1) \
+  X("used_misc_moves",        used_misc_moves,        1) \
+  X("used_grabs",             used_grabs,             1) \
+  X("used_pummels",           used_pummels,           1) \
+  X("used_throws",            used_throws,            1) \
+  X("total_moves_used",       total_moves_used,       1) \
+  X("total_moves_landed",     total_moves_landed,     1) \
+  X("move_accuracy",          move_accuracy,          0) \
+  X("actionability",          actionability,          0) \
+  X("neutral_wins_per_min",   neutral_wins_per_min,   0) \
+  X("mean_death_percent",     mean_death_percent,     0)
+
+#define _AGGREGATE_COUNT(n,f,a) +1
+const unsigned N_AGGREGATE_STATS = 0 AGGREGATE_STATS(_AGGREGATE_COUNT);
+
+namespace slip {
+
+//Struct for accumulating one player's stats over a set of games
+struct AggregateStats {
+  unsigned games                          = 0;    //Number of games accumulated
+  unsigned wins                           = 0;    //Number of games won
+  unsigned losses                         = 0;    //Number of games lost (games with no winner count as neither)
+  uint64_t frames                         = 0;    //Total length of all games in frames
+  unsigned stocks_taken                   = 0;    //Total number of opponent stocks taken
+  unsigned stocks_lost                    = 0;    //Total number of own stocks lost
+  double   stats[N_AGGREGATE_STATS]       = {0};  //Sums of each stat in AGGREGATE_STATS
+  uint64_t move_counts[Move::__LAST]      = {0};  //Histogram of moves landed
+  uint64_t dyn_counts[Dynamic::__LAST]    = {0};  //Frame counts for player interaction dynamics
+  double   dyn_damage[Dynamic::__LAST]    = {0};  //Damage done during each player interaction dynamic
+
+  void add(const Analysis &a, unsigned p);        //Add player p's stats from a single game
+  void merge(const AggregateStats &o);            //Add another set of accumulated stats to this one
+  std::string asJson(unsigned ilev, bool more = false) const;  //Convert the totals and per-game means to JSON fields
+};
+
+//Struct for holding stats for a player / character overall and split up by opposing character
+struct AggregateEntry {
+  std::string                        name = "";   //Display name (connect code / character name)
+  AggregateStats                     all;         //Stats across all games
+  std::map<unsigned,AggregateStats>  vs;          //Stats split by opposing character (external ID)
+  std::map<unsigned,unsigned>        chars;       //Number of games played as each character (external ID)
+
+  void add(const Analysis &a, unsigned p);
+  void merge(const AggregateEntry &o);
+  std::string asJson(unsigned ilev) const;
+};
+
+//Class for reducing analyses of many replays to per-player and per-character aggregates
+//  Each worker thread should fill its own Aggregate and merge() them together at the end
+class Aggregate {
+private:
+  unsigned                             _games   = 0;  //Number of analyses accumulated
+  unsigned                             _skipped = 0;  //Number of analyses that failed and were skipped
+  std::map<std::string,AggregateEntry> _players;      //Aggregates keyed by Slippi Online connect code
+  std::map<unsigned,AggregateEntry>    _chars;        //Aggregates keyed by external character ID
+public:
+  void add(const Analysis &a);                   //Accumulate a single game's analysis
+  void merge(const Aggregate &o);                //Accumulate another (partial) aggregate
+  unsigned games() const { return _games; }
+  std::string asJson() const;                    //Convert the aggregate to a JSON
+  void save(const char* outfilename) const;      //Write the aggregate out to a JSON file
+};
+
+}
+
+#endif /* AGGREGATE_H_ */
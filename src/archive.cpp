@@ -0,0 +1,305 @@
+#include "archive.h"
+#include "compressor.h"
+
+namespace slip {
+
+//Replay encoded by a worker thread before its block is written
+struct PendingEntry {
+  bool         ok = false;
+  ArchiveEntry e;
+};
+
+//Check that an entry name is a relative path that stays inside the directory it is extracted to
+static bool validEntryName(const char* name) {
+  if (name[0] == '\0' || name[0] == '/' || name[0] == '\\') {
+    return false;
+  }
+  std::filesystem::path p(name);
+  if (p.has_root_path() || !p.has_filename()) {
+    return false;
+  }
+  for (const std::filesystem::path &part : p) {
+    if (part == "..") {
+      return false;
+    }
+  }
+  return true;
+}
+
+Archive::Archive(int debug) {
+  _debug = debug;
+}
+
+bool Archive::create(const char* fname, const std::vector<std::string> &files,
+  const std::vector<std::string> &names, unsigned block_size, unsigned jobs, const LzmaOptions &lzma) {
+  if (fileExists(fname)) {
+    FAIL("File " << fname << " exists, refusing to overwrite");
+    return false;
+  }
+  for (const std::string &n : names) {
+    if (!validEntryName(n.c_str())) {
+      FAIL("Invalid archive entry name '" << n << "'");
+      return false;
+    }
+  }
+  if (block_size == 0) {
+    block_size = 1;
+  }
+
+  // write to a temporary file first so an interrupted run never leaves a truncated archive behind
+  std::string tmpname = std::string(fname) + ".tmp";
+  std::ofstream f(tmpname, std::ios::binary | std::ios::out | std::ios::trunc);
+  if (f.fail()) {
+    FAIL("Could not open " << tmpname << " for writing");
+    return false;
+  }
+  ArchiveHeader h;
+  f.write(reinterpret_cast<const char*>(&h),sizeof(ArchiveHeader));
+
+  unsigned nblocks = (files.size() + block_size - 1) / block_size;
+  std::vector<ArchiveBlock> blocks(nblocks);
+  std::vector<PendingEntry> pending(files.size());
+  std::mutex write_mutex;
+  // one Compressor per worker, reused for every replay that worker encodes
+  std::vector<std::unique_ptr<Compressor>> cmps(numWorkers(nblocks,jobs));
+  parallelFor(nblocks, jobs, [&](unsigned b, unsigned worker) {
+    if (!cmps[worker]) {
+      cmps[worker].reset(new Compressor(_debug));
+    }
+    std::string raw, enc;
+    unsigned last = std::min(unsigned(files.size()),(b+1)*block_size);
+    for (unsigned i = b*block_size; i < last; ++i) {
+      DOUT1("Archiving " << files[i]);
+      PendingEntry &pe = pending[i];
+      if (!encodeReplayFile(files[i],_debug,enc,pe.e.md5,nullptr,cmps[worker].get())) {
+        continue;
+      }
+      pe.ok       = true;
+      pe.e.offset = raw.size();
+      pe.e.size   = enc.size();
+      raw.append(enc);
+    }
+    if (raw.empty()) {
+      return;
+    }
+    // size the dictionary to the whole block (up to a cap) so later replays can match earlier ones
+    LzmaOptions opt = lzma;
+    opt.dict_size   = std::min(uint64_t(ARCHIVE_MAX_DICT),uint64_t(raw.size()));
+    std::string comp = compressWithLzma(raw.c_str(),raw.size(),opt);
+    // blocks are appended in whatever order they finish; the index records where each one landed
+    std::lock_guard<std::mutex> lock(write_mutex);
+    blocks[b].offset    = f.tellp();
+    blocks[b].comp_size = comp.size();
+    blocks[b].raw_size  = raw.size();
+    f.write(comp.c_str(),comp.size());
+  });
+
+  // build the index, dropping blocks whose replays all failed to encode
+  _fname = fname;
+  _blocks.clear();
+  _entries.clear();
+  _strings.clear();
+  std::vector<uint32_t> block_ids(nblocks);
+  for (unsigned b = 0; b < nblocks; ++b) {
+    block_ids[b] = _blocks.size();
+    if (blocks[b].raw_size > 0) {
+      _blocks.push_back(blocks[b]);
+    }
+  }
+  for (unsigned i = 0; i < files.size(); ++i) {
+    if (!pending[i].ok) {
+      continue;
+    }
+    ArchiveEntry e = pending[i].e;
+    e.block = block_ids[i / block_size];
+    e.name  = _strings.size();
+    _strings.append(names[i]);
+    _strings.push_back('\0');
+    _entries.push_back(e);
+  }
+
+  ArchiveFooter ft;
+  ft.index_offset = f.tellp();
+  ft.num_blocks   = _blocks.size();
+  ft.num_entries  = _entries.size();
+  ft.strings_size = _strings.size();
+  f.write(reinterpret_cast<const char*>(_blocks.data()),_blocks.size()*sizeof(ArchiveBlock));
+  f.write(reinterpret_cast<const char*>(_entries.data()),_entries.size()*sizeof(ArchiveEntry));
+  f.write(_strings.c_str(),_strings.size());
+  f.write(reinterpret_cast<const char*>(&ft),sizeof(ArchiveFooter));
+  _file_size = f.tellp();
+  f.close();
+  if (f.fail()) {
+    FAIL("Could not write archive to " << tmpname);
+    remove(tmpname.c_str());
+    return false;
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmpname,fname,ec);
+  if (ec) {
+    FAIL("Could not create archive " << fname << ": " << ec.message());
+    return false;
+  }
+  if (_entries.size() < files.size()) {
+    WARN("Skipped " << (files.size() - _entries.size()) << " replays that could not be encoded");
+  }
+  return true;
+}
+
+bool Archive::open(const char* fname) {
+  std::ifstream f(fname, std::ios::binary | std::ios::in);
+  if (f.fail()) {
+    FAIL("File " << fname << " could not be opened or does not exist");
+    return false;
+  }
+  f.seekg(0, f.end);
+  _file_size = f.tellg();
+  f.seekg(0, f.beg);
+
+  ArchiveHeader h;
+  ArchiveFooter ft;
+  if (_file_size >= sizeof(ArchiveHeader) + sizeof(ArchiveFooter)) {
+    f.read(reinterpret_cast<char*>(&h),sizeof(ArchiveHeader));
+    f.seekg(_file_size - sizeof(ArchiveFooter), f.beg);
+    f.read(reinterpret_cast<char*>(&ft),sizeof(ArchiveFooter));
+  }
+  uint64_t index_size = uint64_t(ft.num_blocks)*sizeof(ArchiveBlock)
+    + uint64_t(ft.num_entries)*sizeof(ArchiveEntry) + ft.strings_size;
+  if (f.fail() || h.magic != ARCHIVE_MAGIC || ft.magic != ARCHIVE_INDEX_MAGIC
+    || ft.index_offset < sizeof(ArchiveHeader)
+    || ft.index_offset + index_size + sizeof(ArchiveFooter) != _file_size) {
+    FAIL("File " << fname << " is not a valid replay archive");
+    return false;
+  }
+  if (h.version != ARCHIVE_VERSION) {
+    FAIL("Archive " << fname << " uses unsupported version " << h.version);
+    return false;
+  }
+
+  _blocks.resize(ft.num_blocks);
+  _entries.resize(ft.num_entries);
+  _strings.resize(ft.strings_size);
+  f.seekg(ft.index_offset, f.beg);
+  f.read(reinterpret_cast<char*>(_blocks.data()),_blocks.size()*sizeof(ArchiveBlock));
+  f.read(reinterpret_cast<char*>(_entries.data()),_entries.size()*sizeof(ArchiveEntry));
+  f.read(&_strings[0],_strings.size());
+  if (f.fail() || (_strings.size() > 0 && _strings.back() != '\0')) {
+    FAIL("Could not read index of archive " << fname);
+    return false;
+  }
+  for (const ArchiveBlock &b : _blocks) {
+    if (b.offset + b.comp_size > ft.index_offset) {
+      FAIL("Archive " << fname << " has a block outside of the file");
+      return false;
+    }
+  }
+  for (const ArchiveEntry &e : _entries) {
+    if (e.block >= _blocks.size() || uint64_t(e.offset) + e.size > _blocks[e.block].raw_size
+      || e.name >= _strings.size()) {
+      FAIL("Archive " << fname << " has a corrupt index entry");
+      return false;
+    }
+    if (!validEntryName(_strings.c_str() + e.name)) {
+      FAIL("Archive " << fname << " has an entry with unsafe name '" << (_strings.c_str() + e.name) << "'");
+      return false;
+    }
+  }
+  _fname = fname;
+  DOUT1("  Loaded index of " << _entries.size() << " replays in " << _blocks.size() << " blocks from " << fname);
+  return true;
+}
+
+bool Archive::_readBlock(unsigned b, std::string &raw) const {
+  const ArchiveBlock &blk = _blocks[b];
+  std::ifstream f(_fname, std::ios::binary | std::ios::in);
+  std::string comp(blk.comp_size,'\0');
+  f.seekg(blk.offset, f.beg);
+  f.read(&comp[0],comp.size());
+  if (f.fail() || !same4(&comp[0],LZMA_HEADER)) {
+    FAIL("Could not read block " << b << " of archive " << _fname);
+    return false;
+  }
+  DOUT1("  Decompressing block " << b);
+  raw = decompressWithLzma(comp.c_str(),comp.size());
+  if (raw.size() != blk.raw_size) {
+    FAIL("Block " << b << " of archive " << _fname << " decompressed to the wrong size");
+    return false;
+  }
+  return true;
+}
+
+bool Archive::_extractEntry(std::string &raw, unsigned i, const std::string &outfile) const {
+  const ArchiveEntry &e = _entries[i];
+  if (fileExists(outfile)) {
+    FAIL("File " << outfile << " exists, refusing to overwrite");
+    return false;
+  }
+  Compressor d(_debug);
+  std::string dec(&raw[e.offset],e.size);
+  if (!d.decodeBuff(dec)) {
+    FAIL("Could not decode " << name(i));
+    return false;
+  }
+
+  unsigned char digest[PICOHASH_MD5_DIGEST_LENGTH];
+  picohash_ctx_t ctx;
+  picohash_init_md5(&ctx);
+  picohash_update(&ctx, dec.c_str(), dec.size());
+  picohash_final(&ctx, digest);
+  if (memcmp(digest,e.md5,PICOHASH_MD5_DIGEST_LENGTH) != 0) {
+    FAIL("Checksum mismatch extracting " << name(i));
+    return false;
+  }
+
+  std::ofstream ofile(outfile, std::ios::binary | std::ios::out);
+  ofile.write(dec.c_str(),dec.size());
+  ofile.close();
+  if (ofile.fail()) {
+    FAIL("Could not write " << outfile);
+    return false;
+  }
+  DOUT1("  Extracted " << name(i) << " to " << outfile);
+  return true;
+}
+
+bool Archive::extract(unsigned i, const std::string &outfile) const {
+  std::string raw;
+  return _readBlock(_entries[i].block,raw) && _extractEntry(raw,i,outfile);
+}
+
+unsigned Archive::extractAll(const std::string &outdir, unsigned jobs) const {
+  std::vector<std::vector<unsigned>> by_block(_blocks.size());
+  for (unsigned i = 0; i < _entries.size(); ++i) {
+    by_block[_entries[i].block].push_back(i);
+    std::filesystem::path parent = std::filesystem::path(outdir) / std::filesystem::path(name(i)).parent_path();
+    std::error_code ec;
+    std::filesystem::create_directories(parent,ec);
+  }
+
+  std::atomic<unsigned> errors(0);
+  parallelFor(_blocks.size(), jobs, [&](unsigned b, unsigned) {
+    std::string raw;
+    if (!_readBlock(b,raw)) {
+      errors += by_block[b].size();
+      return;
+    }
+    for (unsigned i : by_block[b]) {
+      std::string outfile = (std::filesystem::path(outdir) / name(i)).string();
+      if (!_extractEntry(raw,i,outfile)) {
+        ++errors;
+      }
+    }
+  });
+  return errors;
+}
+
+int Archive::find(const char* name) const {
+  for (unsigned i = 0; i < _entries.size(); ++i) {
+    if (strcmp(this->name(i),name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+}
@@ -0,0 +1,124 @@
+#ifndef ARCHIVE_H_
+#define ARCHIVE_H_
+
+#include <string>
+#include <vector>
+
+#include "util.h"
+
+// Archive file layout (all integers little-endian, as written by the host):
+//   ArchiveHeader
+//   block data (each block is an independent .xz stream of back-to-back encoded replays)
+//   ArchiveBlock[num_blocks]
+//   ArchiveEntry[num_entries]
+//   string table (null-terminated entry names, referenced by byte offset)
+//   ArchiveFooter
+// The index and footer live at the end so blocks can be written as soon as they are compressed,
+//   and listing an archive only requires reading the footer and the index
+const uint64_t ARCHIVE_MAGIC       = BYTE8(0x53,0x4c,0x50,0x41,0x52,0x43,0x00,0x00); // SLPARC..
+const uint64_t ARCHIVE_INDEX_MAGIC = BYTE8(0x53,0x4c,0x50,0x49,0x44,0x58,0x00,0x00); // SLPIDX..
+const uint32_t ARCHIVE_VERSION     = 1;   //Bump whenever the archive layout changes
+const unsigned ARCHIVE_BLOCK_SIZE  = 16;  //Default number of replays per solid block
+const uint32_t ARCHIVE_PRESET      = 6 | LZMA_PRESET_EXTREME;  //LZMA preset used for compressing blocks
+const uint32_t ARCHIVE_MAX_DICT    = 32 << 20;  //Largest LZMA dictionary used for a block (~370MB to encode)
+
+namespace slip {
+
+//Default compression settings for archive blocks
+inline LzmaOptions archiveLzmaOptions() {
+  LzmaOptions o;
+  o.preset = ARCHIVE_PRESET;
+  return o;
+}
+
+struct ArchiveHeader {
+  uint64_t magic    = ARCHIVE_MAGIC;
+  uint32_t version  = ARCHIVE_VERSION;
+  uint32_t reserved = 0;
+};
+
+//Location of a single solid block
+struct ArchiveBlock {
+  uint64_t offset    = 0;  //Byte offset of the block's .xz stream from the start of the file
+  uint64_t comp_size = 0;  //Size of the block's .xz stream
+  uint64_t raw_size  = 0;  //Size of the block after decompression
+};
+
+//Location of a single replay within a block
+struct ArchiveEntry {
+  uint32_t block     = 0;   //Index of the block containing the replay
+  uint32_t offset    = 0;   //Byte offset of the encoded replay within the decompressed block
+  uint32_t size      = 0;   //Size of the encoded (and original) replay
+  uint32_t name      = 0;   //String table offset of the replay's name
+  uint8_t  md5[16]   = {0}; //MD5 of the original .slp
+};
+
+struct ArchiveFooter {
+  uint64_t index_offset = 0;  //Byte offset of the block table from the start of the file
+  uint32_t num_blocks   = 0;  //Number of entries in the block table
+  uint32_t num_entries  = 0;  //Number of entries in the replay table
+  uint64_t strings_size = 0;  //Size of the string table in bytes
+  uint64_t magic        = ARCHIVE_INDEX_MAGIC;
+};
+static_assert(sizeof(ArchiveHeader) == 16, "ArchiveHeader layout changed");
+static_assert(sizeof(ArchiveBlock)  == 24, "ArchiveBlock layout changed");
+static_assert(sizeof(ArchiveEntry)  == 32, "ArchiveEntry layout changed");
+static_assert(sizeof(ArchiveFooter) == 32, "ArchiveFooter layout changed");
+
+//Class for packing many replays into a single solid archive and extracting them again
+//  Replays are encoded by the compressor and grouped into blocks of several replays each;
+//  every block is compressed as one .xz stream so similar games share a dictionary, while
+//  extracting a single replay only requires decompressing its own block
+class Archive {
+private:
+  int                        _debug;
+  std::string                _fname;      //Name of the archive on disk
+  uint64_t                   _file_size = 0;
+  std::vector<ArchiveBlock>  _blocks;     //All blocks in the archive
+  std::vector<ArchiveEntry>  _entries;    //All replays in the archive, in insertion order
+  std::string                _strings;    //String table referenced by entries
+
+  bool _readBlock(unsigned b, std::string &raw) const;  //Read and decompress a single block
+  bool _extractEntry(std::string &raw, unsigned i, const std::string &outfile) const;
+public:
+  Archive(int debug);
+
+  //Pack files into a new archive, storing each under the corresponding name
+  //  Blocks are encoded and compressed by up to jobs threads in parallel, each compressed with
+  //  lzma's preset and threads (the dictionary is always sized to the block)
+  //  Returns false if the archive could not be written (replays that fail to encode are skipped)
+  bool create(const char* fname, const std::vector<std::string> &files,
+    const std::vector<std::string> &names, unsigned block_size, unsigned jobs,
+    const LzmaOptions &lzma = archiveLzmaOptions());
+  bool open(const char* fname);  //Read an archive's index without decompressing any blocks
+
+  //Extract replay i to outfile, decompressing only the block that contains it
+  bool extract(unsigned i, const std::string &outfile) const;
+  //Extract all replays into outdir (decompressing each block once); returns the number of failures
+  unsigned extractAll(const std::string &outdir, unsigned jobs) const;
+
+  int find(const char* name) const;  //Get the index of the entry with the given name (-1 if not found)
+
+  inline unsigned size() const {
+    return _entries.size();
+  }
+  inline unsigned blocks() const {
+    return _blocks.size();
+  }
+  inline uint64_t fileSize() const {
+    return _file_size;
+  }
+  inline const ArchiveEntry& entry(unsigned i) const {
+    return _entries[i];
+  }
+  inline const ArchiveBlock& block(unsigned b) const {
+    return _blocks[b];
+  }
+  inline const char* name(unsigned i) const {
+    return _strings.c_str() + _entries[i].name;
+  }
+};
+
+}
+
+#endif /* ARCHIVE_H_ */
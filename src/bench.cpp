@@ -0,0 +1,337 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+
+#include "util.h"
+#include "benchmark.h"
+#include "compressor.h"
+
+#ifdef __linux__
+  #include <sys/resource.h>
+#endif
+
+#define JDBL(i,k,n) SPACE[ILEV*(i)] << "\"" << (k) << "\" : " << double(n)
+#define JUIN(i,k,n) SPACE[ILEV*(i)] << "\"" << (k) << "\" : " << uint64_t(n)
+#define JSTR(i,k,s) SPACE[ILEV*(i)] << "\"" << (k) << "\" : \"" << (s) << "\""
+
+// replays benchmarked when no -i is given (relative to the repository root, like slippc-tests)
+static const std::vector<std::string> BENCHDIRS = {"test-replays/standard","test-replays/zlp-compat-1"};
+
+static int _debug = 0;
+
+namespace slip {
+
+//Stages each replay goes through, in order
+enum BenchStage { ENCODE, SHUFFLE, LZMA, UNLZMA, UNSHUFFLE, DECODE, VALIDATE, N_STAGES };
+static const char* STAGE_NAMES[N_STAGES] = {"encode","shuffle","lzma","unlzma","unshuffle","decode","validate"};
+
+//Timings and sizes for one replay, or summed over a group of replays
+struct BenchResult {
+  unsigned replays         = 0;  //Number of replays benchmarked
+  uint64_t raw_size        = 0;  //Total size of the original replays
+  uint64_t comp_size       = 0;  //Total size after encoding and LZMA compression
+  double   secs[N_STAGES]  = {0}; //Total seconds spent in each stage
+  uint64_t peak_rss        = 0;  //Largest peak resident set size seen while benchmarking a replay (KB)
+
+  void add(const BenchResult &o) {
+    replays   += o.replays;
+    raw_size  += o.raw_size;
+    comp_size += o.comp_size;
+    for (unsigned i = 0; i < N_STAGES; ++i) {
+      secs[i] += o.secs[i];
+    }
+    peak_rss = std::max(peak_rss,o.peak_rss);
+  }
+
+  double total() const {
+    double t = 0;
+    for (unsigned i = 0; i < N_STAGES; ++i) {
+      t += secs[i];
+    }
+    return t;
+  }
+};
+
+// https://stackoverflow.com/questions/865668/how-to-parse-command-line-arguments-in-c
+char* getCmdOption(char ** begin, char ** end, const std::string & option) {
+  char ** itr = std::find(begin, end, option);
+  if (itr != end && ++itr != end) {
+    return *itr;
+  }
+  return 0;
+}
+
+bool cmdOptionExists(char** begin, char** end, const std::string& option) {
+  return std::find(begin, end, option) != end;
+}
+
+void printUsage() {
+  std::cout
+    << "Usage: slippc-bench [-i <dir>]... [-o <jsonfile>] [--label <label>] [--level L] [-r] [-d <debuglevel>]:" << std::endl
+    << "  -i        Benchmark the replays in <dir> (repeatable; default: test-replays/standard and test-replays/zlp-compat-1)" << std::endl
+    << "  -o        Write the results in .json format to <jsonfile> (default: stdout)" << std::endl
+    << "  --label   Record <label> (e.g., a commit hash) in the results" << std::endl
+    << "  --level   Compress with LZMA preset L (0-9, optionally followed by e; default: 6)" << std::endl
+    << "  -r        Recurse into subdirectories" << std::endl
+    << "  -d        Run at debug level <debuglevel>" << std::endl
+    << "  -h        Show this help message" << std::endl
+    ;
+}
+
+static inline double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static inline double mbps(uint64_t bytes, double seconds) {
+  return (seconds > 0) ? (bytes / 1048576.0) / seconds : 0;
+}
+
+//Reset the peak resident set size so the next readPeakRSS() only covers what follows
+//  (Linux only; elsewhere the peak covers the whole run)
+static void resetPeakRSS() {
+#ifdef __linux__
+  std::ofstream f("/proc/self/clear_refs");
+  f << "5";
+#endif
+}
+
+//Get the peak resident set size in KB since the last resetPeakRSS() (0 if unknown)
+static uint64_t readPeakRSS() {
+#ifdef __linux__
+  std::ifstream f("/proc/self/status");
+  std::string line;
+  while (std::getline(f,line)) {
+    if (line.compare(0,6,"VmHWM:") == 0) {
+      return std::stoull(line.substr(6));
+    }
+  }
+  struct rusage usage;
+  getrusage(RUSAGE_SELF,&usage);
+  return usage.ru_maxrss;
+#else
+  return 0;
+#endif
+}
+
+//Get a sorted list of all replays in a directory, including the xz-compressed .slp files in test-replays/standard
+static std::vector<std::string> listBenchFiles(const std::string &dir, bool recursive) {
+  std::vector<std::string> files;
+  auto consider = [&files](const std::filesystem::directory_entry &entry) {
+    std::string name = entry.path().filename().string();
+    bool xz = name.size() > 7 && name.compare(name.size()-7,7,".slp.xz") == 0;
+    if (entry.is_regular_file() && (xz || isReplayFile(name))) {
+      files.push_back(entry.path().string());
+    }
+  };
+  std::error_code ec;
+  if (recursive) {
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(dir,ec)) {
+      consider(entry);
+    }
+  } else {
+    for (const auto &entry : std::filesystem::directory_iterator(dir,ec)) {
+      consider(entry);
+    }
+  }
+  std::sort(files.begin(),files.end());
+  return files;
+}
+
+static std::string versionName(uint32_t v) {
+  return std::to_string(v >> 16) + "." + std::to_string((v >> 8) & 0xff) + "." + std::to_string(v & 0xff);
+}
+
+//Run the original replay in raw through every stage, as slippc -x does
+static bool benchReplay(const std::string &raw, const LzmaOptions &lzma, BenchResult &r) {
+  r.replays  = 1;
+  r.raw_size = raw.size();
+
+  std::string orig(raw);
+  char* rbuf = &orig[0];
+  Compressor *c = new Compressor(_debug);
+  auto start = std::chrono::steady_clock::now();
+  bool ok = c->loadFromBuff(&rbuf,orig.size());
+  r.secs[ENCODE]  = secondsSince(start) - c->shuffleSeconds();
+  r.secs[SHUFFLE] = c->shuffleSeconds();
+  if (!ok) {
+    delete c;
+    return false;
+  }
+  char* ebuf;
+  unsigned esize = c->saveToBuff(&ebuf);
+  std::string enc(ebuf,esize);
+  delete[] ebuf;
+
+  start = std::chrono::steady_clock::now();
+  std::string comp = compressWithLzma(enc.c_str(),enc.size(),lzma);
+  r.secs[LZMA]  = secondsSince(start);
+  r.comp_size   = comp.size();
+
+  start = std::chrono::steady_clock::now();
+  std::string dec = decompressWithLzma(comp.c_str(),comp.size());
+  r.secs[UNLZMA] = secondsSince(start);
+
+  Compressor d(_debug);
+  start = std::chrono::steady_clock::now();
+  ok = d.decodeBuff(dec) && dec == raw;
+  r.secs[DECODE]    = secondsSince(start) - d.shuffleSeconds();
+  r.secs[UNSHUFFLE] = d.shuffleSeconds();
+
+  start = std::chrono::steady_clock::now();
+  ok = c->validate() && ok;
+  r.secs[VALIDATE] = secondsSince(start);
+  delete c;
+  return ok;
+}
+
+static std::string resultAsJson(const BenchResult &r, unsigned ilev) {
+  std::stringstream ss;
+  ss << std::setprecision(6);
+  ss << JUIN(ilev,"replays",   r.replays)   << ",\n";
+  ss << JUIN(ilev,"raw_size",  r.raw_size)  << ",\n";
+  ss << JUIN(ilev,"comp_size", r.comp_size) << ",\n";
+  ss << JDBL(ilev,"ratio",     r.raw_size ? double(r.comp_size)/r.raw_size : 0) << ",\n";
+  ss << JUIN(ilev,"peak_rss_kb", r.peak_rss) << ",\n";
+  ss << JDBL(ilev,"total_secs", r.total()) << ",\n";
+  ss << JDBL(ilev,"total_mbps", mbps(r.raw_size,r.total())) << ",\n";
+  ss << SPACE[ILEV*ilev] << "\"stages\" : {\n";
+  for (unsigned i = 0; i < N_STAGES; ++i) {
+    ss << SPACE[ILEV*(ilev+1)] << "\"" << STAGE_NAMES[i] << "\" : { \"secs\" : " << r.secs[i]
+      << ", \"mbps\" : " << mbps(r.raw_size,r.secs[i]) << " }" << ((i+1 == N_STAGES) ? "\n" : ",\n");
+  }
+  ss << SPACE[ILEV*ilev] << "}\n";
+  return ss.str();
+}
+
+int runbench(int argc, char** argv) {
+  if (cmdOptionExists(argv, argv+argc, "-h")) {
+    printUsage();
+    return 0;
+  }
+  char* dlevel = getCmdOption(argv, argv+argc, "-d");
+  char* outfile = getCmdOption(argv, argv+argc, "-o");
+  char* label  = getCmdOption(argv, argv+argc, "--label");
+  char* level  = getCmdOption(argv, argv+argc, "--level");
+  bool  recursive = cmdOptionExists(argv, argv+argc, "-r");
+  if (dlevel) {
+    if (dlevel[0] >= '0' && dlevel[0] <= '9') {
+      _debug = dlevel[0]-'0';
+    } else {
+      std::cerr << "Warning: invalid debug level" << std::endl;
+    }
+  }
+  LzmaOptions lzma;
+  if (level && !parseLzmaLevel(level,lzma.preset)) {
+    std::cerr << "Warning: invalid compression level (expected 0-9, optionally followed by e)" << std::endl;
+  }
+  std::vector<std::string> dirs;
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (strcmp(argv[i],"-i") == 0) {
+      dirs.push_back(argv[++i]);
+    }
+  }
+  if (dirs.empty()) {
+    dirs = BENCHDIRS;
+  }
+
+  std::vector<std::string> files;
+  for (const std::string &dir : dirs) {
+    std::vector<std::string> found = listBenchFiles(dir,recursive);
+    if (found.empty()) {
+      WARN("No replays found in " << dir);
+    }
+    files.insert(files.end(),found.begin(),found.end());
+  }
+
+  // replays are benchmarked one at a time so neither the timings nor the peak RSS are shared with other jobs
+  std::vector<std::string> failed;
+  std::vector<BenchResult> results(files.size());
+  std::vector<uint32_t>    versions(files.size(),0);
+  std::vector<uint8_t>     done(files.size(),0);
+  std::map<uint32_t,BenchResult> by_version;
+  BenchResult total;
+  for (unsigned i = 0; i < files.size(); ++i) {
+    DOUT1("Benchmarking " << files[i]);
+    std::string enc, raw;
+    if (!encodeReplayFile(files[i],_debug,enc,nullptr,&raw)) {  //Load .zlp files as their original replays
+      failed.push_back(files[i]);
+      continue;
+    }
+    std::string().swap(enc);
+    resetPeakRSS();
+    if (!benchReplay(raw,lzma,results[i])) {
+      FAIL("  Replay did not round trip: " << files[i]);
+      failed.push_back(files[i]);
+      continue;
+    }
+    results[i].peak_rss = readPeakRSS();
+    done[i]             = 1;
+    versions[i]         = replayVersion(raw);
+    by_version[versions[i]].add(results[i]);
+    total.add(results[i]);
+  }
+
+  std::stringstream ss;
+  ss << "{\n";
+  ss << JSTR(0,"label",            escape_json(label ? label : "")) << ",\n";
+  ss << JSTR(0,"slippc_version",   SLIPPC_VERSION) << ",\n";
+  ss << JUIN(0,"compressor_version", COMPRETZ_VERSION) << ",\n";
+  ss << JSTR(0,"lzma_preset",      lzmaLevelName(lzma.preset)) << ",\n";
+  ss << "\"failed\" : [";
+  for (unsigned i = 0; i < failed.size(); ++i) {
+    ss << ((i == 0) ? "" : ", ") << "\"" << escape_json(failed[i]) << "\"";
+  }
+  ss << "],\n";
+  ss << "\"total\" : {\n" << resultAsJson(total,1) << "},\n";
+  ss << "\"versions\" : {\n";
+  unsigned n = 0;
+  for (const auto &kv : by_version) {
+    ss << SPACE[ILEV] << "\"" << versionName(kv.first) << "\" : {\n" << resultAsJson(kv.second,2)
+      << SPACE[ILEV] << "}" << ((++n == by_version.size()) ? "\n" : ",\n");
+  }
+  ss << "},\n";
+  ss << "\"files\" : [\n";
+  n = 0;
+  for (unsigned i = 0; i < files.size(); ++i) {
+    if (!done[i]) {
+      continue;
+    }
+    ss << SPACE[ILEV] << "{\n";
+    ss << JSTR(2,"file",           escape_json(files[i])) << ",\n";
+    ss << JSTR(2,"slippi_version", versionName(versions[i])) << ",\n";
+    ss << resultAsJson(results[i],2);
+    ss << SPACE[ILEV] << "}" << ((++n == total.replays) ? "\n" : ",\n");
+  }
+  ss << "]\n";
+  ss << "}\n";
+
+  if (outfile) {
+    std::ofstream f(outfile, std::ios::out | std::ios::trunc);
+    f << ss.str();
+    f.close();
+    if (f.fail()) {
+      FAIL("Failed to write " << outfile);
+      return 2;
+    }
+  } else {
+    std::cout << ss.str();
+  }
+
+  // a quick human-readable summary alongside the JSON
+  std::cerr << std::fixed << std::setprecision(2) << "Benchmarked " << total.replays << " replays ("
+    << total.raw_size / 1048576.0 << " MB, " << failed.size() << " failed) at " << mbps(total.raw_size,total.total())
+    << " MB/s end to end, ratio " << 100.0*total.comp_size/std::max(uint64_t(1),total.raw_size) << "%, peak RSS "
+    << total.peak_rss / 1024.0 << " MB" << std::endl;
+  for (unsigned i = 0; i < N_STAGES; ++i) {
+    std::cerr << "  " << std::left << std::setw(10) << STAGE_NAMES[i] << std::right << std::setw(9)
+      << total.secs[i] << " s" << std::setw(10) << mbps(total.raw_size,total.secs[i]) << " MB/s" << std::endl;
+  }
+  return failed.empty() ? 0 : 1;
+}
+
+}
+
+int main(int argc, char** argv) {
+  return slip::runbench(argc,argv);
+}
@@ -0,0 +1,225 @@
+#include <chrono>
+
+#include "benchmark.h"
+#include "compressor.h"
+#include "lzmadict.h"
+#include "lzmatune.h"
+
+namespace slip {
+
+const uint64_t SHORT_REPLAY = 1 << 20;  //Encoded replays smaller than this count as short games
+
+static inline double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static inline double mbps(uint64_t bytes, double seconds) {
+  return (seconds > 0) ? (bytes / 1048576.0) / seconds : 0;
+}
+
+//The game start event immediately follows the event payloads event
+uint32_t replayVersion(const std::string &buf) {
+  unsigned gs = N_HEADER_BYTES + 1 + uint8_t(buf[N_HEADER_BYTES+1]);
+  if (gs + 3 >= buf.size()) {
+    return 0;
+  }
+  return (uint8_t(buf[gs+1]) << 16) | (uint8_t(buf[gs+2]) << 8) | uint8_t(buf[gs+3]);
+}
+
+void PresetResult::add(const PresetResult &o) {
+  replays   += o.replays;
+  raw_size  += o.raw_size;
+  comp_size += o.comp_size;
+  enc_time  += o.enc_time;
+  dec_time  += o.dec_time;
+}
+
+PresetBenchmark::PresetBenchmark(int debug, const std::vector<uint32_t> &presets, const LzmaOptions &lzma) {
+  _debug   = debug;
+  _presets = presets;
+  _lzma    = lzma;
+  _total.resize(_presets.size());
+}
+
+std::vector<uint32_t> PresetBenchmark::allPresets() {
+  std::vector<uint32_t> presets;
+  for (uint32_t p = 0; p <= 9; ++p) {
+    presets.push_back(p);
+  }
+  for (uint32_t p = 0; p <= 9; ++p) {
+    presets.push_back(p | LZMA_PRESET_EXTREME);
+  }
+  return presets;
+}
+
+bool PresetBenchmark::addFile(const std::string &path) {
+  DOUT1("Benchmarking " << path);
+  std::string enc, raw;
+  auto start = std::chrono::steady_clock::now();
+  if (!encodeReplayFile(path,_debug,enc,nullptr,_seek_window ? &raw : nullptr)) {
+    ++_failed;
+    return false;
+  }
+  _enc_time += secondsSince(start);
+  _encoded  += enc.size();
+
+  if (_seek_window) {
+    std::string seekable;
+    if (!SeekableReplay::encode(raw,seekable,_seek_window,_lzma,_debug)) {
+      FAIL("  Could not create a seekable replay from " << path);
+      ++_failed;
+      return false;
+    }
+    _seek_whole += compressWithLzma(enc.c_str(),enc.size(),_lzma).size();
+    _seek_size  += seekable.size();
+  }
+
+  if (_lzma.dict) {
+    LzmaOptions plain = _lzma;
+    plain.dict        = nullptr;
+    std::string comp, dec;
+    if (!(compressWithDict(enc.c_str(),enc.size(),_lzma,comp) && decompressWithDict(comp.c_str(),comp.size(),dec)
+      && dec == enc)) {
+      FAIL("  Preset dictionary did not round trip " << path);
+      ++_failed;
+      return false;
+    }
+    uint64_t without = compressWithLzma(enc.c_str(),enc.size(),plain).size();
+    DOUT2("    Preset dictionary: " << comp.size() << " bytes vs. " << without << " bytes without");
+    for (unsigned k = 0; k < ((enc.size() < SHORT_REPLAY) ? 2 : 1); ++k) {
+      _dict_plain[k] += without;
+      _dict_size[k]  += comp.size();
+    }
+  }
+
+  if (_tune) {
+    std::string comp;
+    std::vector<size_t> sizes;
+    int chain = compressWithLzmaTuned(enc.c_str(),enc.size(),_lzma,comp,&sizes);
+    if (chain < 0 || decompressWithLzma(comp.c_str(),comp.size()) != enc) {
+      FAIL("  Tuned compression did not round trip " << path);
+      ++_failed;
+      return false;
+    }
+    DOUT2("    Tuned compression: " << lzmaTuneChains()[chain].name << " (" << comp.size() << " bytes vs. "
+      << sizes[0] << " bytes untuned)");
+    std::vector<unsigned> &wins = _tune_wins[replayVersion(enc)];
+    wins.resize(sizes.size());
+    ++wins[chain];
+    _tune_size  += comp.size();
+    _tune_plain += sizes[0];
+  }
+
+  std::vector<PresetResult> &ver = _by_version[replayVersion(enc)];
+  ver.resize(_presets.size());
+  for (unsigned i = 0; i < _presets.size(); ++i) {
+    LzmaOptions opt = _lzma;
+    opt.preset      = _presets[i];
+    PresetResult r;
+    r.replays  = 1;
+    r.raw_size = enc.size();
+
+    start = std::chrono::steady_clock::now();
+    std::string comp = compressWithLzma(enc.c_str(),enc.size(),opt);
+    r.enc_time  = secondsSince(start);
+    r.comp_size = comp.size();
+
+    start = std::chrono::steady_clock::now();
+    std::string dec = decompressWithLzma(comp.c_str(),comp.size());
+    r.dec_time  = secondsSince(start);
+    if (dec != enc) {
+      FAIL("  Preset " << lzmaLevelName(_presets[i]) << " did not round trip " << path);
+      ++_failed;
+      return false;
+    }
+    DOUT2("    Preset " << lzmaLevelName(_presets[i]) << ": " << comp.size() << " bytes");
+    _total[i].add(r);
+    ver[i].add(r);
+  }
+  return true;
+}
+
+std::string PresetBenchmark::report() const {
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(2);
+  if (_total.empty() || _total[0].replays == 0) {
+    ss << "No replays benchmarked (" << _failed << " failed)" << std::endl;
+    return ss.str();
+  }
+  ss << "Encoded " << _total[0].replays << " replays (" << _encoded / 1048576.0 << " MB) at "
+    << mbps(_encoded,_enc_time) << " MB/s before LZMA compression";
+  if (_failed > 0) {
+    ss << " (" << _failed << " failed)";
+  }
+  ss << std::endl << std::endl;
+
+  ss << "Overall (ratio = compressed size / original size):" << std::endl;
+  ss << "  preset     ratio  enc MB/s  dec MB/s" << std::endl;
+  for (unsigned i = 0; i < _presets.size(); ++i) {
+    const PresetResult &r = _total[i];
+    ss << "  " << std::left << std::setw(6) << lzmaLevelName(_presets[i]) << std::right
+      << std::setw(9) << 100.0*r.comp_size/r.raw_size << "%"
+      << std::setw(10) << mbps(r.raw_size,r.enc_time)
+      << std::setw(10) << mbps(r.raw_size,r.dec_time) << std::endl;
+  }
+
+  if (_seek_window) {
+    ss << std::endl << "Seekable (" << _seek_window << "-frame windows, preset " << lzmaLevelName(_lzma.preset)
+      << "): " << _seek_size / 1048576.0 << " MB vs. " << _seek_whole / 1048576.0 << " MB whole ("
+      << std::showpos << 100.0*_seek_size/_seek_whole - 100.0 << std::noshowpos << "%)" << std::endl;
+  }
+
+  if (_lzma.dict) {
+    ss << std::endl << "Preset dictionary " << lzmaDictHash(*_lzma.dict) << " (preset " << lzmaLevelName(_lzma.preset) << "):" << std::endl;
+    const char* labels[2] = {"all replays", "short replays"};
+    for (unsigned k = 0; k < 2; ++k) {
+      if (_dict_plain[k] == 0) {
+        continue;
+      }
+      ss << "  " << std::left << std::setw(14) << labels[k] << std::right << _dict_size[k] / 1024.0 << " KB vs. "
+        << _dict_plain[k] / 1024.0 << " KB without (" << std::showpos << 100.0*_dict_size[k]/_dict_plain[k] - 100.0
+        << std::noshowpos << "%)" << std::endl;
+    }
+  }
+
+  if (_tune) {
+    const std::vector<LzmaChain> &chains = lzmaTuneChains();
+    ss << std::endl << "Tuned (preset " << lzmaLevelName(_lzma.preset) << "): " << _tune_size / 1048576.0
+      << " MB vs. " << _tune_plain / 1048576.0 << " MB untuned (" << std::showpos
+      << 100.0*_tune_size/_tune_plain - 100.0 << std::noshowpos << "%); replays won by each setting:" << std::endl;
+    ss << "  version ";
+    for (const LzmaChain &chain : chains) {
+      ss << std::setw(13) << chain.name;
+    }
+    ss << std::endl;
+    for (const auto &kv : _tune_wins) {
+      std::string version = std::to_string(kv.first >> 16) + "." + std::to_string((kv.first >> 8) & 0xff)
+        + "." + std::to_string(kv.first & 0xff);
+      ss << "  " << std::left << std::setw(8) << version << std::right;
+      for (unsigned wins : kv.second) {
+        ss << std::setw(13) << wins;
+      }
+      ss << std::endl;
+    }
+  }
+
+  ss << std::endl << "By Slippi version:" << std::endl;
+  ss << "  version  replays    raw MB  preset     ratio  enc MB/s  dec MB/s" << std::endl;
+  for (const auto &kv : _by_version) {
+    std::string version = std::to_string(kv.first >> 16) + "." + std::to_string((kv.first >> 8) & 0xff)
+      + "." + std::to_string(kv.first & 0xff);
+    for (unsigned i = 0; i < _presets.size(); ++i) {
+      const PresetResult &r = kv.second[i];
+      ss << "  " << std::left << std::setw(8) << ((i == 0) ? version : "") << std::right
+        << std::setw(8) << r.replays
+        << std::setw(10) << r.raw_size / 1048576.0 << "  "
+        << std::left << std::setw(6) << lzmaLevelName(_presets[i]) << std::right
+        << std::setw(9) << 100.0*r.comp_size/r.raw_size << "%"
+        << std::setw(10) << mbps(r.raw_size,r.enc_time)
+        << std::setw(10) << mbps(r.raw_size,r.dec_time) << std::endl;
+    }
+  }
+  return ss.str();
+}
+
+}
@@ -0,0 +1,72 @@
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "util.h"
+
+namespace slip {
+
+//Get the Slippi version of a replay (encoded or not) packed as 0x00MMmmrr, or 0 if it's too short
+uint32_t replayVersion(const std::string &buf);
+
+//Running totals for compressing a set of replays with a single LZMA preset
+struct PresetResult {
+  unsigned replays   = 0;  //Number of replays compressed
+  uint64_t raw_size  = 0;  //Total size of the encoded (= original) replays
+  uint64_t comp_size = 0;  //Total size after LZMA compression
+  double   enc_time  = 0;  //Total seconds spent in LZMA compression
+  double   dec_time  = 0;  //Total seconds spent in LZMA decompression
+
+  void add(const PresetResult &o);
+};
+
+//Class for measuring compression ratio and LZMA speed of each preset over a set of replays
+//  Each replay is delta / shuffle encoded once, then compressed and decompressed with every preset;
+//  results are reported overall and broken down by Slippi version
+//  If the LZMA options name a preset dictionary, each replay is also compressed with it to report its savings
+class PresetBenchmark {
+private:
+  int                                         _debug;
+  LzmaOptions                                 _lzma;           //Settings other than the preset (e.g., threads)
+  std::vector<uint32_t>                       _presets;        //Presets to benchmark
+  std::vector<PresetResult>                   _total;          //Results per preset across all replays
+  std::map<uint32_t,std::vector<PresetResult>> _by_version;    //Results per preset for each Slippi version
+  unsigned                                    _failed  = 0;    //Number of replays that couldn't be encoded
+  uint64_t                                    _encoded = 0;    //Bytes passed through the replay encoder
+  double                                      _enc_time = 0;   //Seconds spent in the replay encoder
+  unsigned                                    _seek_window = 0; //Frames per seekable window (0 = don't compare)
+  uint64_t                                    _seek_whole  = 0; //Total size compressed as whole files
+  uint64_t                                    _seek_size   = 0; //Total size compressed as seekable files
+  uint64_t                                    _dict_plain[2] = {0}; //Total size compressed without the preset dictionary (all, short)
+  uint64_t                                    _dict_size[2]  = {0}; //Total size compressed with the preset dictionary (all, short)
+  bool                                        _tune        = false; //Whether to compare tuned LZMA settings
+  uint64_t                                    _tune_size   = 0; //Total size compressed with the best settings for each replay
+  uint64_t                                    _tune_plain  = 0; //Total size compressed with the preset's own settings
+  std::map<uint32_t,std::vector<unsigned>>    _tune_wins;       //Number of replays each tuning candidate won, per Slippi version
+public:
+  PresetBenchmark(int debug, const std::vector<uint32_t> &presets, const LzmaOptions &lzma);
+
+  //Also compare each replay's size as a seekable .zlp with windows of window frames against its
+  //  size compressed as a whole (both with the preset in the LZMA options)
+  inline void setSeekWindow(unsigned window) {
+    _seek_window = window;
+  }
+
+  //Also compress each replay with every tuning candidate (with the preset in the LZMA options)
+  //  and count which candidate wins for each Slippi version
+  inline void setTune(bool tune) {
+    _tune = tune;
+  }
+
+  bool addFile(const std::string &path);  //Encode a replay and compress it with every preset
+  std::string report() const;             //Format the results as human-readable tables
+
+  static std::vector<uint32_t> allPresets();  //0 through 9, then 0e through 9e
+};
+
+}
+
+#endif /* BENCHMARK_H_ */
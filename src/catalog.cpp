@@ -0,0 +1,382 @@
+#include "catalog.h"
+#include "parser.h"
+
+#ifdef _WIN32
+  #define strcasecmp _stricmp
+#else
+  #include <strings.h>
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <unistd.h>
+#endif
+
+namespace slip {
+
+//Replay summary produced by a worker thread before its strings are interned
+struct PendingRecord {
+  bool          ok    = false;
+  int           index = -1;  //Index of the existing record to replace (-1 = new record)
+  CatalogRecord rec;
+  std::string   path;
+  std::string   start_time;
+  std::string   tag[4];
+  std::string   code[4];
+};
+
+static inline bool sameName(const std::string &a, const char* b) {
+  return strcasecmp(a.c_str(),b) == 0;
+}
+
+bool CatalogFilter::parseChars(const char* list) {
+  std::stringstream ss(list);
+  std::string name;
+  while (std::getline(ss,name,',')) {
+    bool found = false;
+    if (name.length() > 0 && isdigit(name[0])) {
+      unsigned id = atoi(name.c_str());
+      if (id < CharExt::__LAST) {
+        chars.push_back(id);
+        found = true;
+      }
+    } else {
+      for (unsigned i = 0; i < CharExt::__LAST; ++i) {
+        if (sameName(CharExt::name[i],name.c_str())) {
+          chars.push_back(i);
+          found = true;
+          break;
+        }
+      }
+    }
+    if (!found) {
+      FAIL("Unknown character '" << name << "'");
+      return false;
+    }
+  }
+  return true;
+}
+
+bool CatalogFilter::parseStage(const char* name) {
+  if (isdigit(name[0])) {
+    stage = atoi(name);
+    return stage < Stage::__LAST;
+  }
+  for (unsigned i = 0; i < Stage::__LAST; ++i) {
+    if (sameName(Stage::name[i],name)) {
+      stage = i;
+      return true;
+    }
+  }
+  FAIL("Unknown stage '" << name << "'");
+  return false;
+}
+
+//Check whether each requested character can be assigned to a different port
+static bool matchChars(const CatalogRecord &r, const std::vector<unsigned> &chars, unsigned next, unsigned used) {
+  if (next == chars.size()) {
+    return true;
+  }
+  for (unsigned p = 0; p < 4; ++p) {
+    if ((used & (1 << p)) || r.player[p].player_type == 3 || r.player[p].char_id != chars[next]) {
+      continue;
+    }
+    if (matchChars(r,chars,next+1,used | (1 << p))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool matches(const CatalogRecord &r, const char* strings, const CatalogFilter &f) {
+  if (f.stage >= 0 && r.stage != f.stage) {
+    return false;
+  }
+  if (f.chars.size() > 0 && !matchChars(r,f.chars,0,0)) {
+    return false;
+  }
+  if (f.code.length() > 0) {
+    bool found = false;
+    for (unsigned p = 0; p < 4 && !found; ++p) {
+      found = strcasecmp(strings+r.player[p].code,f.code.c_str()) == 0;
+    }
+    if (!found) {
+      return false;
+    }
+  }
+  if (f.tag.length() > 0) {
+    bool found = false;
+    for (unsigned p = 0; p < 4 && !found; ++p) {
+      found = strcasecmp(strings+r.player[p].tag,f.tag.c_str()) == 0;
+    }
+    if (!found) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//Check that a catalog's header is consistent with the size of the catalog
+static bool validHeader(const CatalogHeader* h, uint64_t size) {
+  if (size < sizeof(CatalogHeader) || h->magic != CATALOG_MAGIC || h->version != CATALOG_VERSION) {
+    return false;
+  }
+  uint64_t records_end = sizeof(CatalogHeader) + uint64_t(h->num_records)*sizeof(CatalogRecord);
+  return (h->strings_size > 0)
+    && (h->strings_size <= size)
+    && (h->strings_offset == size - h->strings_size)
+    && (records_end <= h->strings_offset);
+}
+
+//Check that every string table offset in a catalog's records points inside a null-terminated string table
+static bool validRecords(const CatalogRecord* recs, uint32_t num_records, const char* strings, uint64_t strings_size) {
+  if (strings[strings_size-1] != '\0') {
+    return false;
+  }
+  for (uint32_t i = 0; i < num_records; ++i) {
+    const CatalogRecord &r = recs[i];
+    if (r.path >= strings_size || r.start_time >= strings_size) {
+      return false;
+    }
+    for (unsigned p = 0; p < 4; ++p) {
+      if (r.player[p].tag >= strings_size || r.player[p].code >= strings_size) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+Catalog::Catalog(int debug) {
+  _debug = debug;
+  _intern("");  //offset 0 is always the empty string
+}
+
+uint32_t Catalog::_intern(const std::string &s) {
+  auto it = _string_ids.find(s);
+  if (it != _string_ids.end()) {
+    return it->second;
+  }
+  uint32_t offset = _strings.size();
+  _strings.append(s.c_str(),s.length()+1);
+  _string_ids[s] = offset;
+  return offset;
+}
+
+bool Catalog::load(const char* fname) {
+  std::ifstream f(fname, std::ios::binary | std::ios::in);
+  if (f.fail()) {
+    return false;
+  }
+  std::string buf((std::istreambuf_iterator<char>(f)),std::istreambuf_iterator<char>());
+  f.close();
+
+  const CatalogHeader* h = reinterpret_cast<const CatalogHeader*>(buf.c_str());
+  const CatalogRecord* recs = reinterpret_cast<const CatalogRecord*>(buf.c_str()+sizeof(CatalogHeader));
+  if (!validHeader(h,buf.size()) || !validRecords(recs,h->num_records,buf.c_str()+h->strings_offset,h->strings_size)) {
+    WARN("Catalog " << fname << " is invalid or was built by a different version; rebuilding");
+    return false;
+  }
+  _records.assign(recs,recs+h->num_records);
+  _strings.assign(buf.c_str()+h->strings_offset,h->strings_size);
+  _string_ids.clear();
+  for (uint32_t off = 0; off < _strings.size(); off += strlen(str(off))+1) {
+    _string_ids[std::string(str(off))] = off;
+  }
+  DOUT1("  Loaded " << _records.size() << " records from catalog " << fname);
+  return true;
+}
+
+bool Catalog::save(const char* fname) {
+  // compact the string table so strings from dropped records don't accumulate
+  std::string old_strings = _strings;
+  _strings.clear();
+  _string_ids.clear();
+  _intern("");
+  for (CatalogRecord &r : _records) {
+    r.path       = _intern(old_strings.c_str()+r.path);
+    r.start_time = _intern(old_strings.c_str()+r.start_time);
+    for (unsigned p = 0; p < 4; ++p) {
+      r.player[p].tag  = _intern(old_strings.c_str()+r.player[p].tag);
+      r.player[p].code = _intern(old_strings.c_str()+r.player[p].code);
+    }
+  }
+
+  CatalogHeader h;
+  h.num_records    = _records.size();
+  h.strings_offset = sizeof(CatalogHeader) + _records.size()*sizeof(CatalogRecord);
+  h.strings_size   = _strings.size();
+
+  // write to a temporary file first so an interrupted save never clobbers the old catalog
+  std::string tmpname = std::string(fname) + ".tmp";
+  std::ofstream f(tmpname, std::ios::binary | std::ios::out | std::ios::trunc);
+  if (f.fail()) {
+    FAIL("Could not open " << tmpname << " for writing");
+    return false;
+  }
+  f.write(reinterpret_cast<const char*>(&h),sizeof(CatalogHeader));
+  f.write(reinterpret_cast<const char*>(_records.data()),_records.size()*sizeof(CatalogRecord));
+  f.write(_strings.c_str(),_strings.size());
+  f.close();
+  if (f.fail()) {
+    FAIL("Could not write catalog to " << tmpname);
+    remove(tmpname.c_str());
+    return false;
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmpname,fname,ec);
+  if (ec) {
+    FAIL("Could not replace catalog " << fname << ": " << ec.message());
+    return false;
+  }
+  return true;
+}
+
+unsigned Catalog::update(const std::vector<std::string> &files, unsigned jobs) {
+  // drop records for replays that no longer exist and remember where the rest are
+  std::unordered_map<std::string,unsigned> known;
+  std::vector<CatalogRecord> kept;
+  for (const CatalogRecord &r : _records) {
+    if (!std::filesystem::exists(str(r.path))) {
+      DOUT1("  Dropping missing replay " << str(r.path));
+      continue;
+    }
+    known[str(r.path)] = kept.size();
+    kept.push_back(r);
+  }
+  _records.swap(kept);
+
+  // find replays that are new or have changed since they were last indexed
+  std::vector<PendingRecord> todo;
+  for (const std::string &f : files) {
+    std::error_code ec;
+    PATH path = std::filesystem::absolute(PATH(f),ec).lexically_normal();
+    uint64_t size  = std::filesystem::file_size(path,ec);
+    if (ec) {
+      WARN("Could not read " << f << "; skipping");
+      continue;
+    }
+    int64_t  mtime = std::filesystem::last_write_time(path,ec).time_since_epoch().count();
+    PendingRecord pr;
+    auto it = known.find(path.string());
+    if (it != known.end()) {
+      const CatalogRecord &r = _records[it->second];
+      if (r.file_size == size && r.mtime == mtime) {
+        continue;
+      }
+      pr.index = it->second;
+    }
+    pr.path          = path.string();
+    pr.rec.file_size = size;
+    pr.rec.mtime     = mtime;
+    todo.push_back(pr);
+  }
+  DOUT1("  " << todo.size() << " of " << files.size() << " replays need indexing");
+
+  parallelFor(todo.size(),jobs,[&](unsigned i, unsigned worker) {
+    PendingRecord &pr = todo[i];
+    slip::Parser p(_debug);
+    if (!p.peek(pr.path.c_str())) {  //Only needs the summary, which .zlp files carry uncompressed
+      WARN("Could not parse " << pr.path << "; not indexing");
+      return;
+    }
+    const SlippiReplay* s = p.replay();
+    pr.rec.version     = s->slippi_version_raw;
+    pr.rec.frame_count = s->frame_count;
+    pr.rec.stage       = s->stage;
+    pr.rec.winner_id   = s->winner_id;
+    pr.rec.end_type    = s->end_type;
+    pr.rec.flags       = (getFileExt(pr.path).compare("zlp") == 0) ? CatalogFlag::COMPRESSED : 0;
+    pr.start_time      = s->start_time;
+    for (unsigned q = 0; q < 4; ++q) {
+      pr.rec.player[q].player_type = s->player[q].player_type;
+      pr.rec.player[q].char_id     = s->player[q].ext_char_id;
+      pr.rec.player[q].color       = s->player[q].color;
+      pr.rec.player[q].team_id     = s->player[q].team_id;
+      pr.tag[q]                    = s->player[q].tag;
+      pr.code[q]                   = s->player[q].tag_code;
+    }
+    // hash the file as stored on disk
+    std::string md5 = md5file(pr.path);
+    for (unsigned b = 0; b < 16; ++b) {
+      pr.rec.md5[b] = std::stoi(md5.substr(2*b,2),nullptr,16);
+    }
+    pr.ok = true;
+  });
+
+  // intern strings and store records serially so the string table stays consistent
+  unsigned indexed = 0;
+  for (PendingRecord &pr : todo) {
+    if (!pr.ok) {
+      continue;
+    }
+    pr.rec.path       = _intern(pr.path);
+    pr.rec.start_time = _intern(pr.start_time);
+    for (unsigned q = 0; q < 4; ++q) {
+      pr.rec.player[q].tag  = _intern(pr.tag[q]);
+      pr.rec.player[q].code = _intern(pr.code[q]);
+    }
+    if (pr.index >= 0) {
+      _records[pr.index] = pr.rec;
+    } else {
+      _records.push_back(pr.rec);
+    }
+    ++indexed;
+  }
+  return indexed;
+}
+
+bool Catalog::query(const char* fname, const CatalogFilter &filter, std::vector<std::string> &results) {
+  #ifdef _WIN32
+    // no mmap on Windows; just read the whole catalog into memory
+    std::ifstream f(fname, std::ios::binary | std::ios::in);
+    if (f.fail()) {
+      FAIL("Could not open catalog " << fname);
+      return false;
+    }
+    std::string buf((std::istreambuf_iterator<char>(f)),std::istreambuf_iterator<char>());
+    f.close();
+    const char* base = buf.c_str();
+    uint64_t    size = buf.size();
+  #else
+    int fd = open(fname,O_RDONLY);
+    if (fd < 0) {
+      FAIL("Could not open catalog " << fname);
+      return false;
+    }
+    uint64_t size = lseek(fd,0,SEEK_END);
+    if (size < sizeof(CatalogHeader)) {
+      close(fd);
+      FAIL("Catalog " << fname << " is invalid");
+      return false;
+    }
+    void* mapped = mmap(nullptr,size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+      FAIL("Could not map catalog " << fname);
+      return false;
+    }
+    const char* base = reinterpret_cast<const char*>(mapped);
+  #endif
+
+  const CatalogHeader* h = reinterpret_cast<const CatalogHeader*>(base);
+  bool valid = validHeader(h,size)
+    && validRecords(reinterpret_cast<const CatalogRecord*>(base+sizeof(CatalogHeader)),
+      h->num_records,base+h->strings_offset,h->strings_size);
+  if (valid) {
+    const CatalogRecord* recs    = reinterpret_cast<const CatalogRecord*>(base+sizeof(CatalogHeader));
+    const char*          strings = base+h->strings_offset;
+    for (uint32_t i = 0; i < h->num_records; ++i) {
+      if (matches(recs[i],strings,filter)) {
+        results.push_back(std::string(strings+recs[i].path));
+      }
+    }
+  } else {
+    FAIL("Catalog " << fname << " is invalid or was built by a different version");
+  }
+
+  #ifndef _WIN32
+    munmap(mapped,size);
+  #endif
+  return valid;
+}
+
+}
@@ -0,0 +1,107 @@
+#ifndef CATALOG_H_
+#define CATALOG_H_
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "enums.h"
+#include "util.h"
+
+// Catalog file layout (all integers little-endian, as written by the host):
+//   CatalogHeader
+//   CatalogRecord[num_records]
+//   string table (null-terminated strings, referenced by byte offset; offset 0 is always "")
+const uint64_t CATALOG_MAGIC   = BYTE8(0x53,0x4c,0x50,0x43,0x41,0x54,0x00,0x00); // SLPCAT..
+const uint32_t CATALOG_VERSION = 1;  //Bump whenever CatalogRecord changes layout
+
+namespace slip {
+
+struct CatalogHeader {
+  uint64_t magic          = CATALOG_MAGIC;
+  uint32_t version        = CATALOG_VERSION;
+  uint32_t num_records    = 0;  //Number of fixed-size records following the header
+  uint64_t strings_offset = 0;  //Byte offset of the string table from the start of the file
+  uint64_t strings_size   = 0;  //Size of the string table in bytes
+};
+
+//Summary of a single player in a catalogued replay
+struct CatalogPlayer {
+  uint8_t  player_type = 3;  //0 = human, 1 = CPU, 2 = demo, 3 = empty
+  uint8_t  char_id     = 0;  //External character ID
+  uint8_t  color       = 0;  //Costume / color index
+  uint8_t  team_id     = 0;  //Team index
+  uint32_t tag         = 0;  //String table offset of the player's display tag
+  uint32_t code        = 0;  //String table offset of the player's connect code
+};
+
+//Summary of a single catalogued replay
+struct CatalogRecord {
+  uint64_t      file_size   = 0;   //Size of the replay file on disk (for incremental updates)
+  int64_t       mtime       = 0;   //Last modification time of the replay file (for incremental updates)
+  uint8_t       md5[16]     = {0}; //MD5 of the replay file on disk
+  uint32_t      path        = 0;   //String table offset of the replay's absolute path
+  uint32_t      start_time  = 0;   //String table offset of the game's start timestamp
+  uint32_t      version     = 0;   //Raw Slippi version number
+  uint32_t      frame_count = 0;   //Total number of frames in the game
+  uint16_t      stage       = 0;   //Stage ID
+  int8_t        winner_id   = -1;  //Port ID of the game's winner (-1 = no winner)
+  uint8_t       end_type    = 0;   //Game end type
+  uint32_t      flags       = 0;   //Bitfield of CatalogFlag values
+  CatalogPlayer player[4];         //Summaries for ports 1-4
+};
+static_assert(sizeof(CatalogHeader) == 32,  "CatalogHeader layout changed");
+static_assert(sizeof(CatalogRecord) == 104, "CatalogRecord layout changed");
+
+namespace CatalogFlag {
+  enum {
+    COMPRESSED = 0x01,  //Replay is stored as a .zlp file
+  };
+}
+
+//Filters for querying a catalog (unset filters match everything)
+struct CatalogFilter {
+  std::vector<unsigned> chars;       //External character IDs that must each be played by a different port
+  int                   stage = -1;  //Stage ID the game must be played on
+  std::string           code  = "";  //Connect code one of the players must have
+  std::string           tag   = "";  //Display tag one of the players must have
+
+  bool parseChars(const char* list);  //Parse a comma-separated list of character names / IDs
+  bool parseStage(const char* stage); //Parse a stage name / ID
+};
+
+//Class for building, updating, and querying an on-disk catalog of replay summaries
+class Catalog {
+private:
+  int                                       _debug;
+  std::vector<CatalogRecord>                _records;    //All catalogued replays
+  std::string                               _strings;    //String table referenced by records
+  std::unordered_map<std::string,uint32_t>  _string_ids; //Offsets of strings already in the string table
+
+  uint32_t _intern(const std::string &s);  //Get the string table offset for s, adding it if necessary
+public:
+  Catalog(int debug);
+
+  bool load(const char* fname);  //Load an existing catalog (returns false if missing or invalid)
+  bool save(const char* fname);  //Write the catalog out, replacing any existing catalog atomically
+  //Index all new or changed replays in files and drop records for replays that no longer exist
+  //  Returns the number of replays (re)indexed
+  unsigned update(const std::vector<std::string> &files, unsigned jobs);
+
+  inline unsigned size() const {
+    return _records.size();
+  }
+  inline const CatalogRecord& record(unsigned i) const {
+    return _records[i];
+  }
+  inline const char* str(uint32_t offset) const {
+    return _strings.c_str() + offset;
+  }
+
+  //Scan a catalog on disk (memory-mapped where supported) and return the paths of all matching replays
+  static bool query(const char* fname, const CatalogFilter &filter, std::vector<std::string> &results);
+};
+
+}
+
+#endif /* CATALOG_H_ */
@@ -0,0 +1,488 @@
+#include "cmcoder.h"
+
+namespace slip {
+
+const unsigned CM_MODELS     = 6;   //Number of context models
+const unsigned CM_INPUTS     = CM_MODELS + 2; //Number of mixer inputs (context models + match model + bias)
+const unsigned CM_TABLE_BITS = 21;  //log2 of the number of slots in each context model's table
+const unsigned CM_MIX_SETS   = 1 << 14;  //Number of mixer weight sets (selected by column and byte position)
+const unsigned CM_MATCH_MIN  = 6;   //Bytes of history hashed to look for matches
+const unsigned CM_MATCH_MAX  = 62;  //Longest match length we distinguish between
+const unsigned CM_MATCH_BITS = 20;  //log2 of the number of match table entries
+const uint32_t CM_MAX_SIZE   = 1 << 30;  //Largest replay we'll decompress (same limit as for LZMA)
+
+//Logistic function mapping the stretched domain (-2047..2047) to 12-bit probabilities
+static int squash(int d) {
+  static const int t[33] = {1,2,3,6,10,16,27,45,73,120,194,310,488,747,1101,1546,
+    2047,2549,2994,3348,3607,3785,3901,3975,4024,4050,4068,4079,4085,4089,4092,4093,4094};
+  if (d > 2047) {
+    return 4095;
+  }
+  if (d < -2047) {
+    return 0;
+  }
+  int w = d & 127;
+  d = (d >> 7) + 16;
+  return (t[d] * (128 - w) + t[d+1] * w + 64) >> 7;
+}
+
+//Inverse of squash(), tabulated
+struct CMStretch {
+  int16_t t[4096];
+  CMStretch() {
+    int pi = 0;
+    for (int x = -2047; x <= 2047; ++x) {
+      int v = squash(x);
+      for (int i = pi; i <= v; ++i) {
+        t[i] = x;
+      }
+      pi = v + 1;
+    }
+    for (int i = pi; i < 4096; ++i) {
+      t[i] = 2047;
+    }
+  }
+};
+static const CMStretch STRETCH;
+
+//Adaptation rates for context slots, fast while a context is new and slower as it is seen more often
+struct CMRates {
+  int t[1024];
+  CMRates() {
+    for (int i = 0; i < 1024; ++i) {
+      t[i] = 16384 / (i + i + 3);
+    }
+  }
+};
+static const CMRates RATES;
+
+//Hash a context into 32 bits
+static inline uint32_t cmHash(uint32_t a, uint32_t b, uint32_t c = 0, uint32_t d = 0) {
+  uint32_t h = (a * 0x9E3779B1u) ^ (b * 0x85EBCA77u) ^ (c * 0xC2B2AE3Du) ^ (d * 0x27D4EB2Fu);
+  h ^= h >> 15;
+  h *= 0x2C1B3C6Du;
+  return h ^ (h >> 13);
+}
+
+//Table of adaptive bit probabilities; each slot packs a 22-bit probability with a 10-bit count
+class CMTable {
+private:
+  std::vector<uint32_t> _t;
+  unsigned              _shift;
+public:
+  CMTable(unsigned bits) : _t(size_t(1) << bits, uint32_t(1) << 31), _shift(32 - bits) {}
+
+  inline uint32_t* slot(uint32_t h) {
+    return &_t[h >> _shift];
+  }
+  static inline int p(const uint32_t* s) {
+    return *s >> 20;
+  }
+  static inline void update(uint32_t* s, int y, unsigned limit) {
+    uint32_t v = *s;
+    unsigned n = v & 1023;
+    int      p = v >> 10;
+    if (n < limit) {
+      ++v;
+    } else {
+      v = (v & 0xfffffc00) | limit;
+    }
+    int64_t delta = int64_t(((y << 22) - p) >> 3) * RATES.t[n];
+    *s = v + (uint32_t(delta) & 0xfffffc00);
+  }
+};
+
+//Predicts the next bit of a replay from column-keyed contexts and the longest recent match
+class CMModel {
+private:
+  uint8_t*                          _buf;        //Bytes coded so far (written here when decoding)
+  size_t                            _len;        //Total number of bytes to code
+  bool                              _decoding;
+  const std::vector<ColumnSegment>& _segs;       //Segments covering the whole buffer
+  size_t                            _pos  = 0;   //Index of the byte being coded
+  unsigned                          _seg  = 0;   //Index of the segment containing _pos
+  size_t                            _seg_end = 0;
+  unsigned                          _j    = 0;   //Position of _pos within its column value
+  unsigned                          _c0   = 1;   //Bits of the current byte seen so far, with a leading 1
+  unsigned                          _nbit = 0;   //Number of bits of the current byte seen so far
+
+  std::vector<CMTable>              _t;                 //One table per context model
+  uint32_t                          _base[CM_MODELS];   //Per-byte context hashes for each table
+  uint32_t*                         _slot[CM_MODELS];   //Per-bit slots for each table
+
+  std::vector<uint32_t>             _match_table;    //Most recent position following each hashed history
+  size_t                            _match_ptr = 0;  //Position of the predicted byte
+  unsigned                          _match_len = 0;  //Length of the current match (0 = none)
+  CMTable                           _tm;
+  uint32_t*                         _mslot = nullptr;
+
+  std::vector<int>                  _weights;    //Mixer weights (16.16 fixed point)
+  int*                              _w;          //Weight set for the current bit
+  int                               _x[CM_INPUTS];
+  int                               _pr;         //Probability that the next bit is 1 (12 bits)
+
+  inline uint8_t _back(size_t dist, size_t start) const {
+    return (_pos >= start + dist) ? _buf[_pos - dist] : 0;
+  }
+
+  //Compute the contexts for the byte at _pos
+  void _nextByte() {
+    while (_seg + 1 < _segs.size() && _pos >= _seg_end) {
+      ++_seg;
+      _seg_end += _segs[_seg].size;
+      _j        = 0;
+    }
+    const ColumnSegment &s = _segs[_seg];
+    size_t   start = _seg_end - s.size;
+    unsigned w     = s.width ? s.width : 1;
+    unsigned col   = _seg + 1;
+    uint8_t  p1    = _back(w,start);    //Same byte of the previous value in this column
+    uint8_t  p2    = _back(2*w,start);  //Same byte of the value before that
+    uint8_t  c1    = _back(1,0);        //Previous byte
+    uint8_t  c2    = _back(2,0);        //Byte before that
+    unsigned j     = s.width ? _j : 0;
+
+    //Context models: position in the value alone, then with the column's history and the preceding bytes
+    _base[0] = cmHash(col, j);
+    _base[1] = cmHash(col, j | 0x100, p1);
+    _base[2] = cmHash(col, j | 0x200, p1, p2);
+    _base[3] = cmHash(col, j | 0x300, p1, c1);
+    _base[4] = cmHash(col, j | 0x400, c1 | (c2 << 8));
+    _base[5] = cmHash(col, j | 0x500, c1);
+    _w       = &_weights[(cmHash(col, j) >> 18) * CM_INPUTS];
+
+    //Extend or look up the match model
+    if (_pos >= CM_MATCH_MIN) {
+      uint32_t h = 0;
+      for (unsigned i = 1; i <= CM_MATCH_MIN; ++i) {
+        h = (h * 0x2F0F3A1Bu) + _buf[_pos - i] + 1;
+      }
+      h = (h * 0x9E3779B1u) >> (32 - CM_MATCH_BITS);
+      if (_match_len == 0) {
+        size_t ptr = _match_table[h];
+        if (ptr > 0) {
+          unsigned len = 0;
+          while (len < CM_MATCH_MAX && len < ptr && _buf[ptr - len - 1] == _buf[_pos - len - 1]) {
+            ++len;
+          }
+          if (len >= CM_MATCH_MIN) {
+            _match_len = len;
+            _match_ptr = ptr;
+          }
+        }
+      }
+      _match_table[h] = _pos;
+    }
+  }
+
+  //Compute the probability of the next bit
+  void _predict() {
+    unsigned c0 = _c0;
+    uint32_t hc0 = c0 * 0x9E3779B1u;
+    for (unsigned i = 0; i < CM_MODELS; ++i) {
+      _slot[i] = _t[i].slot(_base[i] + hc0);
+      _x[i] = STRETCH.t[CMTable::p(_slot[i])];
+    }
+    _x[CM_MODELS] = 0;
+    _mslot = nullptr;
+    if (_match_len > 0) {
+      unsigned expected = _buf[_match_ptr] | 0x100;
+      if ((expected >> (8 - _nbit)) == c0) {  //The match still agrees with this byte so far
+        unsigned bit = (expected >> (7 - _nbit)) & 1;
+        _mslot = _tm.slot(((std::min(_match_len,CM_MATCH_MAX) << 1) | bit) << 24);
+        _x[CM_MODELS]  = STRETCH.t[CMTable::p(_mslot)];
+      }
+    }
+    _x[CM_MODELS+1] = 256;  //Bias
+
+    int64_t dot = 0;
+    for (unsigned i = 0; i < CM_INPUTS; ++i) {
+      dot += int64_t(_x[i]) * _w[i];
+    }
+    _pr = std::max(1, std::min(4095, squash(int(dot >> 16))));
+  }
+
+public:
+  CMModel(uint8_t* buf, size_t len, const std::vector<ColumnSegment> &segs, bool decoding)
+    : _buf(buf), _len(len), _decoding(decoding), _segs(segs),
+      _t(CM_MODELS, CMTable(CM_TABLE_BITS)),
+      _match_table(size_t(1) << CM_MATCH_BITS, 0), _tm(8),
+      _weights(size_t(CM_MIX_SETS) * CM_INPUTS, 65536 / 4) {
+    _seg_end = _segs.empty() ? 0 : _segs[0].size;
+    if (_len > 0) {
+      _nextByte();
+      _predict();
+    }
+  }
+
+  inline int p() const {
+    return _pr;
+  }
+
+  void update(int y) {
+    //Train the mixer, then each model that contributed
+    int err = (y << 12) - _pr;
+    for (unsigned i = 0; i < CM_INPUTS; ++i) {
+      _w[i] += (_x[i] * err) >> 12;
+    }
+    for (unsigned i = 0; i < CM_MODELS; ++i) {
+      CMTable::update(_slot[i], y, 255);
+    }
+    if (_mslot) {
+      CMTable::update(_mslot, y, 1023);
+    } else if (_match_len > 0) {
+      _match_len = 0;  //The match mispredicted an earlier bit of this byte
+    }
+
+    _c0 = (_c0 << 1) | y;
+    if (++_nbit < 8) {
+      _predict();
+      return;
+    }
+    uint8_t byte = _c0 & 0xff;
+    if (_decoding) {
+      _buf[_pos] = byte;
+    }
+    if (_match_len > 0 && _buf[_match_ptr] == byte) {
+      ++_match_ptr;
+      _match_len = std::min(_match_len + 1, CM_MATCH_MAX);
+    } else {
+      _match_len = 0;
+    }
+    ++_pos;
+    _c0   = 1;
+    _nbit = 0;
+    if (++_j >= std::max(_segs[_seg].width,1u)) {
+      _j = 0;
+    }
+    if (_pos < _len) {
+      _nextByte();
+      _predict();
+    }
+  }
+};
+
+//Binary arithmetic coder (after lpaq1) driven by 12-bit probabilities that the next bit is 1
+class CMEncoder {
+private:
+  uint32_t     _x1 = 0, _x2 = 0xffffffff;
+  std::string& _out;
+public:
+  CMEncoder(std::string &out) : _out(out) {}
+
+  inline void encode(int y, int p) {
+    uint32_t xmid = _x1 + uint32_t((uint64_t(_x2 - _x1) * p) >> 12);
+    if (y) {
+      _x2 = xmid;
+    } else {
+      _x1 = xmid + 1;
+    }
+    while (((_x1 ^ _x2) & 0xff000000) == 0) {
+      _out.push_back(char(_x2 >> 24));
+      _x1 <<= 8;
+      _x2 = (_x2 << 8) | 255;
+    }
+  }
+  void flush() {
+    for (unsigned i = 0; i < 4; ++i, _x1 <<= 8) {
+      _out.push_back(char(_x1 >> 24));
+    }
+  }
+};
+
+class CMDecoder {
+private:
+  uint32_t       _x1 = 0, _x2 = 0xffffffff, _x = 0;
+  const uint8_t* _in;
+  const uint8_t* _end;
+
+  inline uint32_t _next() {
+    return (_in < _end) ? *_in++ : 0;
+  }
+public:
+  CMDecoder(const char* in, size_t len)
+    : _in(reinterpret_cast<const uint8_t*>(in)), _end(reinterpret_cast<const uint8_t*>(in) + len) {
+    for (unsigned i = 0; i < 4; ++i) {
+      _x = (_x << 8) | _next();
+    }
+  }
+
+  inline int decode(int p) {
+    uint32_t xmid = _x1 + uint32_t((uint64_t(_x2 - _x1) * p) >> 12);
+    int y = (_x <= xmid);
+    if (y) {
+      _x2 = xmid;
+    } else {
+      _x1 = xmid + 1;
+    }
+    while (((_x1 ^ _x2) & 0xff000000) == 0) {
+      _x1 <<= 8;
+      _x2 = (_x2 << 8) | 255;
+      _x  = (_x << 8) | _next();
+    }
+    return y;
+  }
+};
+
+static void putVarint(std::string &out, uint32_t v) {
+  while (v >= 0x80) {
+    out.push_back(char((v & 0x7f) | 0x80));
+    v >>= 7;
+  }
+  out.push_back(char(v));
+}
+
+static bool getVarint(const uint8_t* &p, const uint8_t* end, uint32_t &v) {
+  v = 0;
+  for (unsigned shift = 0; p < end && shift < 35; shift += 7) {
+    uint8_t b = *p++;
+    v |= uint32_t(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+//Pick a record stride for a run of bytes outside the columns: the distance at which bytes most often repeat
+static uint32_t cmFindStride(const uint8_t* buf, const ColumnSegment &s) {
+  const unsigned MAX_STRIDE = 2048;
+  const unsigned SAMPLES    = 8192;
+  if (s.size < 4 * 64) {
+    return 0;
+  }
+  unsigned max_stride = std::min<size_t>(MAX_STRIDE, s.size / 4);
+  unsigned step       = std::max<size_t>(1, (s.size - max_stride) / SAMPLES);
+  unsigned best = 0, best_score = 0;
+  for (unsigned d = 1; d <= max_stride; ++d) {
+    unsigned score = 0;
+    for (size_t i = s.offset + max_stride; i < s.offset + s.size; i += step) {
+      score += (buf[i] == buf[i - d]);
+    }
+    if (score > best_score + best_score / 16) {  //Prefer shorter strides unless a longer one is clearly better
+      best       = d;
+      best_score = score;
+    }
+  }
+  return best;
+}
+
+std::string compressWithColumns(const char* in, size_t inlen, const std::vector<ColumnSegment> &columns) {
+  const uint8_t* buf = reinterpret_cast<const uint8_t*>(in);
+
+  //Fill the gaps between columns so segments cover the whole buffer
+  std::vector<ColumnSegment> segs;
+  size_t pos = 0;
+  for (const ColumnSegment &c : columns) {
+    if (c.offset < pos || c.offset + c.size > inlen || c.size == 0) {
+      continue;  //Ignore overlapping or out-of-range columns rather than failing
+    }
+    if (c.offset > pos) {
+      segs.push_back({uint32_t(pos), uint32_t(c.offset - pos), 0});
+    }
+    segs.push_back(c);
+    pos = c.offset + c.size;
+  }
+  if (pos < inlen) {
+    segs.push_back({uint32_t(pos), uint32_t(inlen - pos), 0});
+  }
+  for (unsigned i = 0; i < segs.size(); ++i) {
+    if (segs[i].width == 0) {
+      segs[i].width = cmFindStride(buf,segs[i]);
+    }
+  }
+
+  std::string out(CM_HEADER_SIZE,'\0');
+  memcpy(&out[0],"SLCX",4);
+  out[4] = char(CM_VERSION);
+  writeBE4U(inlen,&out[8]);
+  writeBE4U(segs.size(),&out[12]);
+  for (unsigned i = 0; i < segs.size(); ++i) {
+    putVarint(out,segs[i].size);
+    putVarint(out,segs[i].width);
+  }
+
+  //The model only reads bytes before the one being coded, so it can work straight out of the input
+  CMModel   model(const_cast<uint8_t*>(buf),inlen,segs,false);
+  CMEncoder enc(out);
+  for (size_t i = 0; i < inlen; ++i) {
+    uint8_t c = buf[i];
+    for (int b = 7; b >= 0; --b) {
+      int y = (c >> b) & 1;
+      enc.encode(y,model.p());
+      model.update(y);
+    }
+  }
+  enc.flush();
+  return out;
+}
+
+bool decompressWithColumns(const char* in, size_t inlen, std::string &out) {
+  if (inlen < CM_HEADER_SIZE || !isColumnCoded(in,inlen) || uint8_t(in[4]) != CM_VERSION) {
+    return false;
+  }
+  uint32_t len   = readBE4U(const_cast<char*>(&in[8]));
+  uint32_t nsegs = readBE4U(const_cast<char*>(&in[12]));
+  const uint8_t* p   = reinterpret_cast<const uint8_t*>(in) + CM_HEADER_SIZE;
+  const uint8_t* end = reinterpret_cast<const uint8_t*>(in) + inlen;
+  if (nsegs > inlen || len > CM_MAX_SIZE) {  //Every segment takes at least two bytes of the table
+    return false;
+  }
+  std::vector<ColumnSegment> segs(nsegs);
+  uint64_t total = 0;
+  for (unsigned i = 0; i < nsegs; ++i) {
+    ColumnSegment &s = segs[i];
+    if (!(getVarint(p,end,s.size) && getVarint(p,end,s.width))) {
+      return false;
+    }
+    s.offset = total;
+    total   += s.size;
+  }
+  if (total != len) {
+    return false;
+  }
+
+  out.assign(len,'\0');
+  CMModel   model(reinterpret_cast<uint8_t*>(&out[0]),len,segs,true);
+  CMDecoder dec(reinterpret_cast<const char*>(p),end - p);
+  for (size_t i = 0; i < size_t(len) * 8; ++i) {
+    model.update(dec.decode(model.p()));
+  }
+  return true;
+}
+
+bool decompressReplay(const char* in, size_t inlen, std::string &out) {
+  if (isPeekable(in,inlen)) {  //The peek header isn't part of the compressed stream
+    size_t skip = peekHeaderSize(in,inlen);
+    if (skip == 0) {
+      return false;
+    }
+    in    += skip;
+    inlen -= skip;
+  }
+  if (isColumnCoded(in,inlen)) {
+    return decompressWithColumns(in,inlen,out);
+  }
+  if (isDictCoded(in,inlen)) {
+    return decompressWithDict(in,inlen,out);
+  }
+  out = decompressWithLzma(in,inlen);
+  return !out.empty();
+}
+
+std::string md5compressed(const std::string &fname) {
+  std::ifstream f(fname, std::ios::binary | std::ios::in);
+  if (f.fail()) {
+    FAIL("File " << fname << " could not be opened or does not exist");
+    return "";
+  }
+  std::string comp((std::istreambuf_iterator<char>(f)),std::istreambuf_iterator<char>());
+  std::string decomp;
+  if (!decompressReplay(comp.c_str(),comp.size(),decomp)) {
+    FAIL("File " << fname << " is not a valid compressed replay");
+    return "";
+  }
+  return md5data(reinterpret_cast<unsigned char*>(&decomp[0]),decomp.size());
+}
+
+}
@@ -0,0 +1,58 @@
+#ifndef CMCODER_H_
+#define CMCODER_H_
+
+#include <string>
+#include <vector>
+
+#include "util.h"
+#include "lzmadict.h"
+#include "peek.h"
+
+// Column model (.zlp) file layout (integers big-endian, like the rest of the replay format):
+//   magic "SLCX", version (1 byte), 3 reserved bytes
+//   size of the encoded replay (4 bytes)
+//   number of segments (4 bytes), then each segment's size and column width as varints
+//   arithmetic-coded bytes of the encoded replay
+// Segments cover the whole replay back to back; for bytes outside the shuffled columns, the width is
+//   instead the record stride guessed by the encoder (0 = none)
+// The coder is experimental and this layout is not a stable format: only files with exactly the current
+//   CM_VERSION can be read, and future versions of slippc may drop the coder (and reading SLCX files) entirely
+const uint32_t CM_HEADER      = BYTE4(0x53,0x4c,0x43,0x58); // SLCX
+const uint8_t  CM_VERSION     = 1;   //Bump whenever the model or layout changes
+const unsigned CM_HEADER_SIZE = 16;  //Bytes before the segment table
+
+namespace slip {
+
+//A run of bytes holding one column of fixed-width values, as laid out by the compressor's column shuffling
+struct ColumnSegment {
+  uint32_t offset = 0;  //Byte offset of the column from the start of the replay
+  uint32_t size   = 0;  //Size of the column in bytes
+  uint32_t width  = 0;  //Size of each value in the column (0 = not a column)
+};
+
+//Check whether a buffer holds a column-model-compressed replay
+inline bool isColumnCoded(const char* buf, size_t len) {
+  return len >= 4 && same4(const_cast<char*>(buf),CM_HEADER);
+}
+
+//Check whether a buffer holds a compressed (.zlp) replay from any backend
+inline bool isCompressedReplay(const char* buf, size_t len) {
+  return len >= 4 && (same4(const_cast<char*>(buf),LZMA_HEADER) || isColumnCoded(buf,len) || isDictCoded(buf,len)
+    || isPeekable(buf,len));
+}
+
+//Compress a buffer with an adaptive binary arithmetic coder whose context models are keyed on
+//  the column (and position within a value) each byte belongs to and on the preceding values in
+//  that column; columns must be sorted and non-overlapping (any bytes between them are coded as-is)
+std::string compressWithColumns(const char* in, size_t inlen, const std::vector<ColumnSegment> &columns);
+//Decompress a buffer produced by compressWithColumns(); returns false if the buffer is malformed
+bool decompressWithColumns(const char* in, size_t inlen, std::string &out);
+//Decompress a .zlp replay with whichever backend its header names; returns false if the buffer is malformed
+bool decompressReplay(const char* in, size_t inlen, std::string &out);
+//Get the MD5 of a .zlp replay's decompressed contents; returns an empty string (and reports an error)
+//  if the file can't be read or decompressed
+std::string md5compressed(const std::string &fname);
+
+}
+
+#endif /* CMCODER_H_ */
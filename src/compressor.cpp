@@ -8,12 +8,57 @@ namespace slip {
   }
 
   Compressor::~Compressor() {
-    if (_rb != nullptr)               { delete[] _rb; }
-    if (_wb != nullptr)               { delete[] _wb; }
     if (_outfilename != nullptr)      { delete   _outfilename; }
     if (_outgeckofilename != nullptr) { delete   _outgeckofilename; }
   }
 
+  void Compressor::reset() {
+    if (_outfilename != nullptr)      { delete   _outfilename;      _outfilename      = nullptr; }
+    if (_outgeckofilename != nullptr) { delete   _outgeckofilename; _outgeckofilename = nullptr; }
+    memset(_payload_sizes,0,sizeof(_payload_sizes));
+    _slippi_maj          = 0;
+    _slippi_min          = 0;
+    _slippi_rev          = 0;
+    _encode_ver          = 0;
+    _max_frames          = 0;
+    _shuffle_secs        = 0;
+    _preds               = 0;
+    _fails               = 0;
+    _infilename          = "";
+    _rng                 = 0;
+    _rng_start           = 0;
+    _players.clear();
+    _items.clear();
+    _items_used          = 0;
+    _last_spawn          = UINT32_MAX;
+    laststartframe       = -123;
+    lastitemstartframe   = -123;
+    lastshuffleframe     = -123;
+    lastitemshuffleframe = -123;
+    // only the first entry starts at -123, as in the member initializers (encodings depend on it)
+    for (int32_t* last : {lastpreframe,lastshufflepreframe,lastpostframe,lastshufflepostframe}) {
+      memset(last,0,8*sizeof(int32_t));
+      last[0] = -123;
+    }
+    _rbuf.clear();
+    _wbuf.clear();
+    _rb                  = nullptr;
+    _wb                  = nullptr;
+    _bp                  = 0;
+    _length_raw          = 0;
+    _length_raw_start    = 0;
+    _game_loop_start     = 0;
+    _game_loop_end       = 0;
+    _file_size           = 0;
+    _message_count       = 0;
+    _game_end_found      = false;
+    _raw_saved           = false;
+    _peek.clear();
+    _columns.clear();
+    _cw                  = ColumnWidths();
+    _dw                  = ColumnWidths();
+  }
+
   bool Compressor::loadFromFile(const char* replayfilename) {
     DOUT1("  Loading " << replayfilename);
     std::ifstream myfile;
@@ -31,32 +76,38 @@ namespace slip {
     }
     myfile.seekg(0, myfile.beg);
 
-    _rb = new char[_file_size];
+    _rbuf.resize(_file_size);
+    _rb = &_rbuf[0];
     myfile.read(_rb,_file_size);
     myfile.close();
 
+    if (isSeekableReplay(_rb,_file_size)) {
+      FAIL("    File " << replayfilename << " is a seekable replay; decompress it with -x first");
+      return false;
+    }
+
     // Check if we have a compressed stream
-    bool is_compressed = same4(&_rb[0],LZMA_HEADER);
+    bool is_compressed = isCompressedReplay(_rb,_file_size);
     if (is_compressed) {
       DOUT1("    File Size: " << +_file_size << ", compressed");
       // Decompress the read buffer
-      std::string decomp = decompressWithLzma(_rb, _file_size);
-      // Get the new file size
+      std::string decomp;
+      if (!decompressReplay(_rb, _file_size, decomp)) {
+        FAIL("    File " << replayfilename << " is not a valid compressed replay");
+        return false;
+      }
+      // Replace the read buffer with the decompressed replay
       _file_size    = decomp.size();
-      // Delete the old read buffer
-      delete [] _rb;
-      // Reallocate it with more spce
-      _rb = new char[_file_size];
-      // Copy buffer from the decompressed string
-      memcpy(_rb,decomp.c_str(),_file_size);
+      _rbuf.swap(decomp);
+      _rb           = &_rbuf[0];
     } else {
       DOUT1("    File Size: " << +_file_size);
     }
 
     _infilename = replayfilename;
 
-    _wb           = new char[_file_size];
-    memcpy(_wb,_rb,sizeof(char)*_file_size);
+    _wbuf.assign(_rb,_file_size);
+    _wb           = &_wbuf[0];
 
     return this->_parse();
   }
@@ -67,15 +118,65 @@ namespace slip {
       return;
     }
 
+    // Summarize the original replay for Parser::peek() while we still have it
+    _raw_saved = rawencode;
+    bool compress = !(_encode_ver || rawencode);
+    _peek.clear();
+    if (compress && _peekable && _rb != nullptr && !buildPeekHeader(_rb,_file_size,_peek)) {
+      DOUT1("  Replay has no frames or game end event; not writing a peek header");
+    }
+
+    // The original replay and the column transpose scratch are no longer needed once the output
+    //   is final, so release them before compressing to keep only one copy of the replay in memory
+    //   alongside the LZMA encoder's state
+    std::string().swap(_rbuf);
+    std::vector<char>().swap(_shuffle_buf);
+    _rb = nullptr;
+
     std::ofstream ofile;
     ofile.open(*_outfilename, std::ios::binary | std::ios::out);
+    ofile.write(_peek.c_str(),_peek.size());
     // If this is the unencoded version, compress it first
-    if (!(_encode_ver || rawencode)) {
-      // Compress the write buffer
-      std::string comp = compressWithLzma(_wb, _file_size);
+    if (compress && _column_coder) {
+      // Compress with column-aware context models, using the column layout from shuffling
+      std::string comp = compressWithColumns(_wb, _file_size, _columns);
+      ofile.write(comp.c_str(),comp.size());
+      if (!ofile.good()) {
+        FAIL("  Failed to compress " << *_outfilename);
+      }
+      DOUT1("  Compression Ratio = " << float(_file_size-comp.size())/_file_size);
+    } else if (compress && _lzma.dict != nullptr) {
+      // Raw LZMA2 primed with a preset dictionary has no streaming container, so compress in memory
+      std::string comp;
+      bool ok = compressWithDict(_wb, _file_size, _lzma, comp);
+      ofile.write(comp.c_str(),comp.size());
+      if (!(ok && ofile.good())) {
+        FAIL("  Failed to compress " << *_outfilename);
+      }
       DOUT1("  Compression Ratio = " << float(_file_size-comp.size())/_file_size);
-      // Write compressed buffer to file
-      ofile.write(comp.c_str(),sizeof(char)*comp.size());
+    } else if (compress && _lzma.tune) {
+      // Try each candidate lc / lp / pb setting in memory and write the smallest .xz stream
+      std::string comp;
+      int chain = compressWithLzmaTuned(_wb, _file_size, _lzma, comp);
+      ofile.write(comp.c_str(),comp.size());
+      if (!(chain >= 0 && ofile.good())) {
+        FAIL("  Failed to compress " << *_outfilename);
+      } else {
+        DOUT1("  Tuned compression chose " << lzmaTuneChains()[chain].name);
+      }
+      DOUT1("  Compression Ratio = " << float(_file_size-comp.size())/_file_size);
+    } else if (compress) {
+      // Stream the compressed write buffer to the file as it is produced
+      size_t comp_size = 0;
+      bool ok = compressWithLzmaStream(_wb, _file_size, _lzma, [&](const char* chunk, size_t len) {
+        ofile.write(chunk,len);
+        comp_size += len;
+        return ofile.good();
+      });
+      if (!(ok && ofile.good())) {
+        FAIL("  Failed to compress " << *_outfilename);
+      }
+      DOUT1("  Compression Ratio = " << float(_file_size-comp_size)/_file_size);
     } else {
       // Write normal buffer to file
       ofile.write(_wb,sizeof(char)*_file_size);
@@ -85,6 +186,87 @@ namespace slip {
 
   }
 
+  bool Compressor::verifySavedFile() const {
+    const size_t CHUNK = 65536;
+    if (_outfilename == nullptr || _wb == nullptr) {
+      return false;
+    }
+    std::ifstream ifile(*_outfilename, std::ios::binary | std::ios::in);
+    if (ifile.fail()) {
+      FAIL("  Could not reopen " << *_outfilename << " for verification");
+      return false;
+    }
+
+    // The column model coder and dictionary-primed LZMA have no streaming decoders, so check their output in one go
+    bool compressed = !(_encode_ver || _raw_saved);
+    if (compressed && (_column_coder || _lzma.dict != nullptr)) {
+      std::string comp((std::istreambuf_iterator<char>(ifile)),std::istreambuf_iterator<char>());
+      std::string decomp;
+      size_t   stream = std::min(comp.size(),_peek.size());
+      bool ok = (comp.compare(0,stream,_peek) == 0)
+        && (_column_coder ? decompressWithColumns(comp.c_str()+stream,comp.size()-stream,decomp)
+                          : decompressWithDict(comp.c_str()+stream,comp.size()-stream,decomp))
+        && (decomp.size() == _file_size) && (memcmp(_wb,decomp.c_str(),_file_size) == 0);
+      if (!ok) {
+        FAIL("  Contents of " << *_outfilename << " do not match the validated replay");
+      }
+      return ok;
+    }
+
+    // Decompress the file (if needed) a chunk at a time and compare each chunk against the write buffer
+    char in[CHUNK], out[CHUNK];
+    lzma_stream strm = LZMA_STREAM_INIT;
+    if (compressed && lzma_stream_decoder(&strm, UINT64_MAX, 0) != LZMA_OK) {
+      return false;
+    }
+    size_t   pos = 0;
+    lzma_ret ret = LZMA_OK;
+    bool     ok  = true;
+    if (compressed && !_peek.empty()) {  //The peek header comes first
+      std::string head(_peek.size(),'\0');
+      ifile.read(&head[0],head.size());
+      ok = !ifile.fail() && (head == _peek);
+    }
+    while (ok && ret != LZMA_STREAM_END) {
+      ifile.read(in,CHUNK);
+      size_t got = ifile.gcount();
+      if (!compressed) {
+        ok   = (pos + got <= _file_size) && (memcmp(&_wb[pos],in,got) == 0);
+        pos += got;
+        if (got < CHUNK) {
+          break;
+        }
+        continue;
+      }
+      strm.next_in  = reinterpret_cast<uint8_t*>(in);
+      strm.avail_in = got;
+      do {
+        strm.next_out  = reinterpret_cast<uint8_t*>(out);
+        strm.avail_out = CHUNK;
+        ret = lzma_code(&strm, (got < CHUNK) ? LZMA_FINISH : LZMA_RUN);
+        size_t len = CHUNK - strm.avail_out;
+        ok   = (ret == LZMA_OK || ret == LZMA_STREAM_END)
+          && (pos + len <= _file_size) && (memcmp(&_wb[pos],out,len) == 0);
+        pos += len;
+      } while (ok && strm.avail_out == 0 && ret != LZMA_STREAM_END);
+      if (got < CHUNK && ret != LZMA_STREAM_END) {
+        ok = false;  //Truncated stream
+      }
+    }
+    if (compressed) {
+      // Nothing may follow the stream
+      std::string rest(reinterpret_cast<const char*>(strm.next_in),strm.avail_in);
+      rest.append(std::istreambuf_iterator<char>(ifile),std::istreambuf_iterator<char>());
+      ok = ok && rest.empty();
+      lzma_end(&strm);
+    }
+    ok = ok && (pos == _file_size);
+    if (!ok) {
+      FAIL("  Contents of " << *_outfilename << " do not match the validated replay");
+    }
+    return ok;
+  }
+
   bool Compressor::setOutputFilename(const char* fname) {
     if (fileExists(fname)) {
       return false;
@@ -117,43 +299,89 @@ namespace slip {
 
   bool Compressor::loadFromBuff(char** buffer, unsigned size) {
     _file_size = size;
-    _wb        = new char[_file_size];
-    _rb        = new char[_file_size];
-    memcpy(_wb,*buffer,sizeof(char)*_file_size);
-    memcpy(_rb,*buffer,sizeof(char)*_file_size);
+    _wbuf.assign(*buffer,_file_size);
+    _rbuf.assign(*buffer,_file_size);
+    _wb        = &_wbuf[0];
+    _rb        = &_rbuf[0];
     return this->_parse();
   }
 
+  bool Compressor::decodeBuff(std::string &buf) {
+    if (!isEncodedReplay(&buf[0],buf.size())) {
+      return false;
+    }
+    // Decoding only ever reads an event's encoded bytes before overwriting them with decoded ones,
+    //   so the write buffer can share the read buffer's storage
+    _file_size = buf.size();
+    _rbuf.swap(buf);
+    _rb        = &_rbuf[0];
+    _wb        = _rb;
+    bool ok    = this->_parse();
+    if (ok) {
+      buf.swap(_rbuf);  //Hand the decoded replay back in place of the encoded one
+    }
+    std::string().swap(_rbuf);
+    _rb        = nullptr;
+    _wb        = nullptr;
+    return ok;
+  }
+
   bool Compressor::validate() {
     if (_encode_ver) {
       return true;
     }
+    if (_rb == nullptr) {
+      FAIL("  Cannot validate after the original replay has been released by saveToFile()");
+      return false;
+    }
 
-    char *enc_buff = nullptr, *dec_buff = nullptr;
-    unsigned size  = this->saveToBuff(&enc_buff);
-    Compressor *d  = new slip::Compressor(_debug);
-    d->loadFromBuff(&enc_buff,size);
-    d->saveToBuff(&dec_buff);
+    // Checksum the original, then decode a copy of the encoding in place in the original's storage,
+    //   so validating needs no buffers beyond the ones we already hold (a valid encoding decodes
+    //   back to the original byte for byte, so the read buffer holds the original again afterwards)
+    unsigned char orig_md5[PICOHASH_MD5_DIGEST_LENGTH];
+    unsigned char dec_md5[PICOHASH_MD5_DIGEST_LENGTH];
+    picohash_ctx_t ctx;
+    picohash_init_md5(&ctx);
+    picohash_update(&ctx, _rb, _file_size);
+    picohash_final(&ctx, orig_md5);
+    std::string orig;
+    if (_debug >= 2) {
+      orig.assign(_rb,_file_size);  //Keep the original around to report which bytes differ
+    }
 
-    bool success = (memcmp(_rb,dec_buff,size) == 0);
+    std::string buf;
+    buf.swap(_rbuf);
+    buf.assign(_wb,_file_size);
+    _rb = nullptr;
+    Compressor d(_debug);
+    if (!d.decodeBuff(buf)) {
+      DOUT1("Encoded replay could not be decoded");
+      return false;
+    }
+    picohash_init_md5(&ctx);
+    picohash_update(&ctx, buf.c_str(), buf.size());
+    picohash_final(&ctx, dec_md5);
+    bool success = (buf.size() == _file_size) && (memcmp(orig_md5,dec_md5,PICOHASH_MD5_DIGEST_LENGTH) == 0);
     if (!success) {
-      unsigned diff = 0;
-      for(unsigned i = 0; i < size; ++i) {
-        if(_rb[i] != dec_buff[i]) {
-          if ((++diff) <= 500) {
-            DOUT2("    Byte " << i << " differs! orig "
-            << int(_rb[i]) << " != " << int(dec_buff[i]) << " new");
+      DOUT1("Decoded replay does not match the original");
+      if (_debug >= 2) {
+        unsigned diff = 0;
+        unsigned size = std::min(_file_size,unsigned(buf.size()));
+        for(unsigned i = 0; i < size; ++i) {
+          if(orig[i] != buf[i]) {
+            if ((++diff) <= 500) {
+              DOUT2("    Byte " << i << " differs! orig "
+              << int(orig[i]) << " != " << int(buf[i]) << " new");
+            }
           }
         }
+        DOUT1("Differs in " << diff << "/" << _file_size << " bytes");
       }
-      DOUT1("Differs in " << diff << "/" << size << " bytes");
+      return false;
     }
-
-    delete[] dec_buff;
-    delete[] enc_buff;
-    delete d;
-
-    return success;
+    _rbuf.swap(buf);
+    _rb = &_rbuf[0];
+    return true;
   }
 
   bool Compressor::_parse() {
@@ -268,10 +496,12 @@ namespace slip {
         case Event::GAME_END:
             _game_end_found = true;
             _game_loop_end = _bp;
+            success        = true;
             if (! _encode_ver) {
-                _shuffleEvents();
+                auto start = std::chrono::steady_clock::now();
+                success = _shuffleEvents();
+                _shuffle_secs += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
             }
-            success        = true;
             break;
         default:
           DOUT1("    Warning: unknown event code " << hex(ev_code) << " encountered; skipping");
@@ -404,21 +634,22 @@ namespace slip {
     }
 
     //Get a storage slot for the item
-    uint8_t slot = readBE4U(&_rb[_bp+O_ITEM_ID]) % ITEM_SLOTS;
+    unsigned slot = _itemSlot(readBE4U(&_rb[_bp+O_ITEM_ID]),lastitemstartframe);
+    ItemHistory &hist = _items[slot];
 
     //XOR all of the remaining data for the item
     uint16_t itype;
     // TODO: not sure if I even need this split
     if (ENCODE_VERSION_MIN(2)) {
       // we use ITEM_TYPE for other purposes, so don't XOR it
-      xorEncodeRange(O_ITEM_STATE,O_ITEM_XVEL,_x_item[slot]);
+      xorEncodeRange(O_ITEM_STATE,O_ITEM_XVEL,hist.x);
       // Ignore the bits used for storing defer information
       itype = decodeDeferInfo(readBE2U(&main_buf[_bp+O_ITEM_TYPE]));
     } else {
-      xorEncodeRange(O_ITEM_TYPE,O_ITEM_XVEL,_x_item[slot]);
+      xorEncodeRange(O_ITEM_TYPE,O_ITEM_XVEL,hist.x);
       itype = readBE2U(&main_buf[_bp+O_ITEM_TYPE]);
     }
-    xorEncodeRange(O_ITEM_DAMAGE,O_ITEM_EXPIRE,_x_item[slot]);
+    xorEncodeRange(O_ITEM_DAMAGE,O_ITEM_EXPIRE,hist.x);
 
     //Predict item positions based on velocity
     predictVelocItem(slot,O_ITEM_XPOS);
@@ -437,16 +668,16 @@ namespace slip {
     }
 
     // Use item positions to determine their velocties
-    predictAsDifference(O_ITEM_XVEL,O_ITEM_XPOS,_x_item_p[slot]);
-    predictAsDifference(O_ITEM_YVEL,O_ITEM_YPOS,_x_item_p[slot]);
+    predictAsDifference(O_ITEM_XVEL,O_ITEM_XPOS,hist.pos);
+    predictAsDifference(O_ITEM_YVEL,O_ITEM_YPOS,hist.pos);
 
     //Predict item expiration based on velocity
     predictVelocItem(slot,O_ITEM_EXPIRE);
 
     if(MIN_VERSION(3,2,0)) {
-      xorEncodeRange(O_ITEM_MISC,O_ITEM_OWNER,_x_item[slot]);
+      xorEncodeRange(O_ITEM_MISC,O_ITEM_OWNER,hist.x);
       if (MIN_VERSION(3,6,0)) {
-        xorEncodeRange(O_ITEM_OWNER,O_ITEM_END,_x_item[slot]);
+        xorEncodeRange(O_ITEM_OWNER,O_ITEM_END,hist.x);
       }
     }
 
@@ -576,6 +807,7 @@ namespace slip {
       FAIL_CORRUPT("    Invalid player index " << +p);
       return false;
     }
+    PlayerHistory &hist = _playerHistory(p);
 
     if (_debug >= 3) {
         int fnum = readBE4S(&_rb[_bp+O_FRAME]);
@@ -594,20 +826,20 @@ namespace slip {
     predictRNG(O_FRAME,O_RNG_PRE);
 
     //Carry over action state from last post-frame
-    writeBE2U(readBE2U(&_rb[_bp+O_ACTION_PRE]) ^ readBE2U(&_x_post_frame[p][O_ACTION_POST]),&_wb[_bp+O_ACTION_PRE]);
-    memcpy(&_x_pre_frame[p][O_ACTION_PRE],&main_buf[_bp+O_ACTION_PRE],2);
+    writeBE2U(readBE2U(&_rb[_bp+O_ACTION_PRE]) ^ readBE2U(&hist.post[O_ACTION_POST]),&_wb[_bp+O_ACTION_PRE]);
+    memcpy(&hist.pre[O_ACTION_PRE],&main_buf[_bp+O_ACTION_PRE],2);
 
     //Carry over x position from last post-frame
-    writeBE4U(readBE4U(&_rb[_bp+O_XPOS_PRE]) ^ readBE4U(&_x_post_frame[p][O_XPOS_POST]),&_wb[_bp+O_XPOS_PRE]);
-    memcpy(&_x_pre_frame[p][O_XPOS_PRE],&main_buf[_bp+O_XPOS_PRE],4);
+    writeBE4U(readBE4U(&_rb[_bp+O_XPOS_PRE]) ^ readBE4U(&hist.post[O_XPOS_POST]),&_wb[_bp+O_XPOS_PRE]);
+    memcpy(&hist.pre[O_XPOS_PRE],&main_buf[_bp+O_XPOS_PRE],4);
 
     //Carry over y position from last post-frame
-    writeBE4U(readBE4U(&_rb[_bp+O_YPOS_PRE]) ^ readBE4U(&_x_post_frame[p][O_YPOS_POST]),&_wb[_bp+O_YPOS_PRE]);
-    memcpy(&_x_pre_frame[p][O_YPOS_PRE],&main_buf[_bp+O_YPOS_PRE],4);
+    writeBE4U(readBE4U(&_rb[_bp+O_YPOS_PRE]) ^ readBE4U(&hist.post[O_YPOS_POST]),&_wb[_bp+O_YPOS_PRE]);
+    memcpy(&hist.pre[O_YPOS_PRE],&main_buf[_bp+O_YPOS_PRE],4);
 
     //Carry over facing direction from last post-frame
-    writeBE4U(readBE4U(&_rb[_bp+O_FACING_PRE]) ^ readBE4U(&_x_post_frame[p][O_FACING_POST]),&_wb[_bp+O_FACING_PRE]);
-    memcpy(&_x_pre_frame[p][O_FACING_PRE],&main_buf[_bp+O_FACING_PRE],4);
+    writeBE4U(readBE4U(&_rb[_bp+O_FACING_PRE]) ^ readBE4U(&hist.post[O_FACING_POST]),&_wb[_bp+O_FACING_PRE]);
+    memcpy(&hist.pre[O_FACING_PRE],&main_buf[_bp+O_FACING_PRE],4);
 
     // Encode analog stick and trigger values as integers
     encodeAnalog(O_JOY_X,   80.0f);
@@ -670,6 +902,7 @@ namespace slip {
       FAIL_CORRUPT("    Invalid player index " << +p);
       return false;
     }
+    PlayerHistory &hist = _playerHistory(p);
 
     if (_debug >= 3) {
         int fnum = readBE4S(&_rb[_bp+O_FRAME]);
@@ -690,21 +923,21 @@ namespace slip {
     predictAccelPost(p,O_YPOS_POST);
 
     //Copy action state to post-frame
-    memcpy(&_x_post_frame[p][O_ACTION_POST],&main_buf[_bp+O_ACTION_POST],2);
+    memcpy(&hist.post[O_ACTION_POST],&main_buf[_bp+O_ACTION_POST],2);
     //Copy x position to post-frame
-    memcpy(&_x_post_frame[p][O_XPOS_POST],&main_buf[_bp+O_XPOS_POST],4);
+    memcpy(&hist.post[O_XPOS_POST],&main_buf[_bp+O_XPOS_POST],4);
     //Copy y position to post-frame
-    memcpy(&_x_post_frame[p][O_YPOS_POST],&main_buf[_bp+O_YPOS_POST],4);
+    memcpy(&hist.post[O_YPOS_POST],&main_buf[_bp+O_YPOS_POST],4);
     //Copy facing direction to post-frame
-    memcpy(&_x_post_frame[p][O_FACING_POST],&main_buf[_bp+O_FACING_POST],4);
+    memcpy(&hist.post[O_FACING_POST],&main_buf[_bp+O_FACING_POST],4);
     //Copy damage to post-frame
-    memcpy(&_x_post_frame[p][O_DAMAGE_POST],&main_buf[_bp+O_DAMAGE_POST],4);
+    memcpy(&hist.post[O_DAMAGE_POST],&main_buf[_bp+O_DAMAGE_POST],4);
 
     //Predict shield decay as velocity
     predictVelocPost(p,O_SHIELD);
 
     //Compress single byte values with XOR encoding
-    xorEncodeRange(O_LAST_HIT_ID,O_ACTION_FRAMES,_x_post_frame[p]);
+    xorEncodeRange(O_LAST_HIT_ID,O_ACTION_FRAMES,hist.post);
 
     //Predict this frame's action state counter from the last 2 frames' counters
     if (MIN_VERSION(0,2,0)) {
@@ -713,7 +946,7 @@ namespace slip {
 
     if (MIN_VERSION(2,0,0)) {
       //XOR encode state bit flags
-      xorEncodeRange(O_STATE_BITS_1,O_HITSTUN,_x_post_frame[p]);
+      xorEncodeRange(O_STATE_BITS_1,O_HITSTUN,hist.post);
 
       //Predict this frame's hitstun counter from the last 2 frames' counters
       predictVelocPost(p,O_HITSTUN);
@@ -743,14 +976,18 @@ namespace slip {
     if (MAX_VERSION(3,0,0)) {
         return true;
     }
+    auto start   = std::chrono::steady_clock::now();
     bool success = _shuffleEvents(true);
+    _shuffle_secs += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
     if (success) {
-        // Copy the relevant portion of _rb to _wb
-        memcpy(
-          &_wb[_game_loop_start],
-          &_rb[_game_loop_start],
-          sizeof(char)*(_game_loop_end-_game_loop_start)
-          );
+        // Copy the relevant portion of _rb to _wb (unless we're decoding in place)
+        if (_wb != _rb) {
+          memcpy(
+            &_wb[_game_loop_start],
+            &_rb[_game_loop_start],
+            sizeof(char)*(_game_loop_end-_game_loop_start)
+            );
+        }
     } else {
         FAIL("BIG PROBLEM UNSHUFFLING");
     }
@@ -785,42 +1022,63 @@ namespace slip {
       // We don't actually know where _game_loop_end is yet
       _game_loop_end = _file_size;
       // We also need to unshuffle columns
-      _unshuffleColumns(main_buf);
-    }
-
-    //Allocate space for storing shuffled events
-    int max_events          = ALLOC_EVENTS;  //initial number of events to allocate space for
-    unsigned offset[ETYPES] = {0};  //Size of individual event arrays
-    unsigned* ev_counts     = new unsigned[ETYPES];
-    unsigned* ev_max        = new unsigned[ETYPES];
-    unsigned* ev_size       = new unsigned[ETYPES];
-    ev_size[0]  = _payload_sizes[Event::FRAME_START];
-    ev_size[9]  = _payload_sizes[Event::ITEM_UPDATE];
-    ev_size[18] = _payload_sizes[Event::BOOKEND];
-    ev_size[19] = _payload_sizes[Event::SPLIT_MSG];
-    for (unsigned i = 0; i < 8; ++i) {
-      ev_size[1+i]  = _payload_sizes[Event::PRE_FRAME];
-      ev_size[10+i] = _payload_sizes[Event::POST_FRAME];
-    }
-    char** ev_buf           = new char*[ETYPES];
-    for (unsigned i = 0; i < 20; ++i) {
-      ev_counts[i] = 0;          //set event counter to 0
-      ev_max[i]    = max_events; //initially allocate space for arrays
-      ev_buf[i]    = new char[ev_max[i]*ev_size[i]];
-    }
-    int *frame_counter          = new int[max_events]{0};
-    unsigned *finalized_counter = new unsigned[max_events]{0};
-    unsigned start_fp           = 0;  //Frame pointer to next start frame
-    unsigned end_fp             = 0;  //Frame pointer to next end frame
+      if (!_unshuffleColumns(main_buf)) {
+        return false;
+      }
+    }
 
-    //Initialize data for frame deferral counting
-    char* defer_pre[8];
-    char* defer_post[8];
-    for (unsigned i = 0; i < 8; ++i) {
-      defer_pre[i]  = new char[RB_SIZE]{0};
-      defer_post[i] = new char[RB_SIZE]{0};
+    //Count the bytes of each event type in a pre-pass so every shuffle buffer can be allocated
+    //  once, at exact size, as part of a single slab
+    unsigned offset[ETYPES]   = {0};  //Size of individual event arrays
+    unsigned ev_bytes[ETYPES] = {0};  //Final size of individual event arrays
+    unsigned num_frames       = 0;    //Number of frame start events
+    unsigned num_bookends     = 0;    //Number of frame bookend events
+    for (unsigned b = _game_loop_start, end = _game_loop_end; b < end; ) {
+      unsigned ev_code = uint8_t(main_buf[b]);
+      unsigned shift   = _payload_sizes[ev_code];
+      unsigned oid     = ETYPES-1;
+      switch(ev_code) {
+        case Event::FRAME_START: oid = 0; ++num_frames;   break;
+        case Event::ITEM_UPDATE: oid = 9;                 break;
+        case Event::BOOKEND:     oid = 18; ++num_bookends; break;
+        case Event::PRE_FRAME:   //Same (8-bit) arithmetic as below so sizes always match
+          oid = uint8_t(1+uint8_t(uint8_t(main_buf[b+O_PLAYER])+4*uint8_t(main_buf[b+O_FOLLOWER]))); break;
+        case Event::POST_FRAME:
+          oid = uint8_t(10+uint8_t(uint8_t(main_buf[b+O_PLAYER])+4*uint8_t(main_buf[b+O_FOLLOWER]))); break;
+        case Event::GAME_END:
+          end = b; break;
+        default:
+          break;
+      }
+      if (shift == 0) {  //Unknown event with no payload size, we'd never make progress
+        FAIL("    Event " << hex(ev_code) << " at byte " << b << " has no payload size");
+        return false;
+      }
+      if (oid < EMAX) {
+        ev_bytes[oid] += shift;
+      }
+      b += shift;
     }
-    char* dupe_frames = new char[RB_SIZE]{0};
+    unsigned slab_size = 0;
+    for (unsigned i = 0; i < EMAX; ++i) {
+      slab_size += ev_bytes[i];
+    }
+    std::vector<char> slab(slab_size);
+    char* ev_buf[EMAX];
+    for (unsigned i = 0, pos = 0; i < EMAX; ++i) {
+      ev_buf[i] = slab.data() + pos;
+      pos      += ev_bytes[i];
+    }
+    unsigned max_fp = std::max(num_frames,num_bookends)+1;
+    std::vector<int>      frame_counter(max_fp,0);
+    std::vector<unsigned> finalized_counter(max_fp,0);
+    unsigned start_fp = 0;  //Frame pointer to next start frame
+    unsigned end_fp   = 0;  //Frame pointer to next end frame
+
+    //Initialize data for frame deferral counting
+    char defer_pre[8][RB_SIZE]  = {{0}};
+    char defer_post[8][RB_SIZE] = {{0}};
+    char dupe_frames[RB_SIZE]   = {0};
     int max_frame          = -125;
     unsigned max_item_seen = 0;
     int modframe           = 0;
@@ -865,32 +1123,6 @@ namespace slip {
 
             frame_counter[start_fp] = cur_frame;
             ++start_fp;
-
-            // check if we've reached the event limit, and reallocate memory for more
-            //   events if so
-            if((int)start_fp == max_events) {
-              DOUT1("    Maxed out frame count, resizing to " << max_events*2 << " events");
-              // double the size of the buffer for storing frame count information
-              int* newstartbuf = new int[max_events*2];
-              // copy data from the old buffer to the new one
-              memcpy(&newstartbuf[0],&frame_counter[0],max_events);
-              // free the old frame counter buffer
-              delete[] frame_counter;
-              // set the buffer pointer to the new buffer
-              frame_counter = newstartbuf;
-
-              // double the size of the buffer for storing finalized frame information
-              unsigned* newendbuf = new unsigned[max_events*2];
-              // copy data from the old buffer to the new one
-              memcpy(&newendbuf[0],&finalized_counter[0],max_events);
-              // free the old finalized counter buffer
-              delete[] finalized_counter;
-              // set the buffer pointer to the new buffer
-              finalized_counter = newendbuf;
-
-              // actually properly double the size of the event buffer
-              max_events *= 2;
-            }
             // std::cout << "Started frame " << cur_frame << std::endl;
             break;
         case Event::PRE_FRAME: //Includes follower
@@ -944,6 +1176,9 @@ namespace slip {
                 // check last 128 frames for duplicates
                 // start at 2 because frame_ptr is incremented
                 for(unsigned fi = 2; fi < MAX_ROLLBACK; ++fi) {
+                  if (start_fp < fi) {
+                    break;
+                  }
                   if(frame_counter[start_fp-fi] == cur_frame) {
                     before += 1;
                   }
@@ -1017,20 +1252,6 @@ namespace slip {
         //   << std::hex << ev_code << std::dec
         //   << " at byte " << +b << std::endl;
         memcpy(&ev_buf[oid][offset[oid]],&main_buf[b],sizeof(char)*shift);
-        ++(ev_counts[oid]);
-        if(ev_counts[oid] == ev_max[oid]) {
-          DOUT1("    Maxed out events for " << +oid << ", resizing to " << ev_max[oid]*2 << " events");
-          // double the size of the buffer for storing event information
-          char* newbuf = new char[ev_max[oid]*ev_size[oid]*2];
-          // copy data from the old buffer to the new one
-          memcpy(&newbuf[0],&ev_buf[oid][0],ev_max[oid]*ev_size[oid]);
-          // actually properly double the size of the event buffer
-          ev_max[oid] *= 2;
-          // free the old buffer
-          delete[] ev_buf[oid];
-          // set the buffer pointer to the new buffer
-          ev_buf[oid] = newbuf;
-        }
       }
       offset[oid] += shift;
       b           += shift;
@@ -1063,10 +1284,10 @@ namespace slip {
                 b += offset[i];
             }
             // Shuffle columns
-            _shuffleColumns(offset);
+            success = _shuffleColumns(offset);
         } else { //Unshuffle into main memory, excluding message event
             unsigned cpos[EMAX] = {0};  //Buffer positions we're copying out of
-            int* dec_frames = new int[_game_loop_end];
+            std::vector<int> dec_frames(num_frames+1);
             for(unsigned frame_ptr = 0; b < _game_loop_end; ++frame_ptr) {
                 // Sanity checks to make sure this is an actual frame start event
                 if (cpos[0] >= offset[0]) {
@@ -1239,34 +1460,220 @@ namespace slip {
                 }
 
                 // Copy the frame end event over to the main buffer
-                if (DECODEFRAMEMATCHES(18,lastshuffleframe)) {
+                if (cpos[18] < offset[18] && DECODEFRAMEMATCHES(18,lastshuffleframe)) {
                     DOUNSHUFFLE(18,Event::BOOKEND);
                 }
             }
-            delete[] dec_frames;
         }
     }
 
-    //Free memory
+    return success;
+  }
 
-    delete[] ev_counts;
-    delete[] ev_max;
-    delete[] ev_size;
+  std::string replayFingerprint(const char* replayfilename) {
+    const unsigned CHUNK = 65536;
+    std::ifstream f(replayfilename, std::ios::binary | std::ios::in);
+    if (f.fail()) {
+      return "";
+    }
+    char header[N_HEADER_BYTES];
+    f.read(header,N_HEADER_BYTES);
+    if (f.gcount() < N_HEADER_BYTES) {
+      return "";
+    }
 
-    for (unsigned i = 0; i < 8; ++i) {
-      delete[] defer_pre[i];
-      delete[] defer_post[i];
+    picohash_ctx_t ctx;
+    unsigned char digest[PICOHASH_MD5_DIGEST_LENGTH];
+    picohash_init_md5(&ctx);
+
+    bool seekable = same8(header,SEEK_MAGIC);
+    if (seekable || isCompressedReplay(header,N_HEADER_BYTES)) {
+      // compressed files need to be decompressed (and possibly decoded) in memory first
+      std::string decomp;
+      if (seekable) {
+        if (!decodeSeekableFile(replayfilename,decomp)) {
+          return "";
+        }
+      } else {
+        f.seekg(0, f.end);
+        size_t size = f.tellg();
+        f.seekg(0, f.beg);
+        std::string comp(size,'\0');
+        f.read(&comp[0],size);
+        if (!decompressReplay(comp.c_str(),size,decomp)) {
+          return "";
+        }
+      }
+      if (decomp.size() < MIN_REPLAY_LENGTH || !same8(&decomp[0],SLP_HEADER)) {
+        return "";
+      }
+      if (isEncodedReplay(&decomp[0],decomp.size())) {
+        Compressor c(0);
+        if (!c.decodeBuff(decomp)) {
+          return "";
+        }
+      }
+      unsigned len = decomp.size();
+      uint32_t raw = readBE4U(&decomp[11]);
+      if (raw == 0 || raw > len - N_HEADER_BYTES) {
+        raw = len - N_HEADER_BYTES;
+      }
+      picohash_update(&ctx, &decomp[N_HEADER_BYTES], raw);
+    } else {
+      if (!same8(header,SLP_HEADER)) {
+        return "";
+      }
+      // a raw length of 0 means the replay was never finalized, so hash everything
+      uint64_t raw = readBE4U(&header[11]);
+      if (raw == 0) {
+        raw = UINT64_MAX;
+      }
+      char buf[CHUNK];
+      while (raw > 0 && f.good()) {
+        f.read(buf,std::min(uint64_t(CHUNK),raw));
+        picohash_update(&ctx, buf, f.gcount());
+        raw -= f.gcount();
+      }
     }
-    delete[] dupe_frames;
 
-    for (unsigned i = 0; i < 20; ++i) {
-        delete[] ev_buf[i];
+    picohash_final(&ctx, digest);
+    return md5tostring(digest);
+  }
+
+  bool encodeReplayFile(const std::string &path, int _debug, std::string &enc, uint8_t* md5, std::string* raw,
+    Compressor* cmp) {
+    std::ifstream f(path, std::ios::binary | std::ios::in);
+    if (f.fail()) {
+      FAIL("  File " << path << " could not be opened or does not exist");
+      return false;
+    }
+    std::string buf((std::istreambuf_iterator<char>(f)),std::istreambuf_iterator<char>());
+    f.close();
+    if (isSeekableReplay(buf.c_str(),buf.size())) {
+      if (!decodeSeekableFile(path.c_str(),buf,_debug)) {
+        FAIL("  File " << path << " is not a valid seekable replay");
+        return false;
+      }
+    } else if (isCompressedReplay(buf.c_str(),buf.size())) {
+      std::string decomp;
+      if (!decompressReplay(buf.c_str(),buf.size(),decomp)) {
+        FAIL("  File " << path << " is not a valid compressed replay");
+        return false;
+      }
+      buf.swap(decomp);
+    }
+    if (buf.size() < MIN_REPLAY_LENGTH || !same8(&buf[0],SLP_HEADER)) {
+      FAIL("  File " << path << " is not a valid Slippi replay");
+      return false;
     }
-    delete[] ev_buf;
-    delete[] frame_counter;
-    delete[] finalized_counter;
 
-    return success;
+    // decode .zlp files first so we always return a fresh encoding of the original
+    std::unique_ptr<Compressor> own;
+    if (cmp == nullptr) {
+      own.reset(new Compressor(_debug));
+      cmp = own.get();
+    }
+    if (isEncodedReplay(&buf[0],buf.size())) {
+      cmp->reset();
+      if (!cmp->decodeBuff(buf)) {
+        FAIL("  Could not decode " << path);
+        return false;
+      }
+    }
+
+    if (md5) {
+      picohash_ctx_t ctx;
+      picohash_init_md5(&ctx);
+      picohash_update(&ctx, buf.c_str(), buf.size());
+      picohash_final(&ctx, md5);
+    }
+
+    char* p = &buf[0];
+    char* out = nullptr;
+    cmp->reset();
+    if (!(cmp->loadFromBuff(&p,buf.size()) && cmp->validate())) {
+      FAIL("  Could not encode " << path);
+      return false;
+    }
+    unsigned len = cmp->saveToBuff(&out);
+    enc.assign(out,len);
+    delete[] out;
+    if (raw) {
+      raw->swap(buf);
+    }
+    return true;
+  }
+
+
+  bool upgradeReplayFile(const std::string &path, int _debug, bool &upgraded, Compressor* cmp) {
+    upgraded = false;
+    std::ifstream f(path, std::ios::binary | std::ios::in);
+    if (f.fail()) {
+      FAIL("  File " << path << " could not be opened or does not exist");
+      return false;
+    }
+    std::string buf((std::istreambuf_iterator<char>(f)),std::istreambuf_iterator<char>());
+    f.close();
+    // seekable replays encode each window separately; re-create them with --seekable instead
+    if (isSeekableReplay(buf.c_str(),buf.size()) || !isCompressedReplay(buf.c_str(),buf.size())) {
+      DOUT1("  " << path << " is not a .zlp; skipping");
+      return true;
+    }
+    std::string decomp;
+    if (!decompressReplay(buf.c_str(),buf.size(),decomp)) {
+      FAIL("  File " << path << " is not a valid compressed replay");
+      return false;
+    }
+    std::string().swap(buf);
+    uint8_t ver = encodedVersion(&decomp[0],decomp.size());
+    if (ver == 0 || ver >= COMPRETZ_VERSION) {
+      DOUT1("  " << path << " is already encoded with version " << +ver << "; skipping");
+      return true;
+    }
+
+    std::unique_ptr<Compressor> own;
+    if (cmp == nullptr) {
+      own.reset(new Compressor(_debug));
+      cmp = own.get();
+    }
+    cmp->reset();
+    if (!cmp->decodeBuff(decomp)) {
+      FAIL("  Could not decode " << path);
+      return false;
+    }
+
+    cmp->reset();
+    char* p = &decomp[0];
+    if (!(cmp->loadFromBuff(&p,decomp.size()) && cmp->validate())) {
+      FAIL("  Could not re-encode " << path);
+      return false;
+    }
+    // write the upgraded replay next to the original (replacing any copy left by an interrupted upgrade);
+    //   the name is only set now since loading checks it for a .zlp extension
+    std::string tmpname = path + ".tmp";
+    remove(tmpname.c_str());
+    cmp->setOutputFilename(tmpname.c_str());
+    cmp->saveToFile(false);
+    if (!cmp->verifySavedFile()) {
+      FAIL("  Upgraded copy of " << path << " does not match the original; leaving it alone");
+      remove(tmpname.c_str());
+      return false;
+    }
+
+    std::error_code ec;
+    std::filesystem::file_time_type mtime = std::filesystem::last_write_time(path,ec);
+    if (!ec) {
+      std::filesystem::last_write_time(tmpname,mtime,ec);
+    }
+    std::filesystem::rename(tmpname,path,ec);
+    if (ec) {
+      FAIL("  Could not replace " << path << ": " << ec.message());
+      remove(tmpname.c_str());
+      return false;
+    }
+    DOUT1("  Upgraded " << path << " from version " << +ver << " to " << +COMPRETZ_VERSION);
+    upgraded = true;
+    return true;
   }
 
 }
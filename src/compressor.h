@@ -10,32 +10,193 @@
 #include <limits>
 #include <cstdio>
 #include <filesystem>
+#include <chrono>
+#include <memory>
 
 #include "util.h"
+#include "cmcoder.h"
+#include "seekable.h"
+#include "peek.h"
+#include "lzmatune.h"
 #include "enums.h"
 #include "schema.h"
 #include "gecko-legacy.h"
 
 // Replay File (.slp) Spec: https://github.com/project-slippi/slippi-wiki/blob/master/SPEC.md
 
-const uint8_t  COMPRETZ_VERSION      = 2;           //Internal version of this compressor
+const uint8_t  COMPRETZ_VERSION      = 3;           //Internal version of this compressor
 
 const uint32_t RAW_RNG_MASK          = 0x40000000;  //Second bit of unsigned int
 const uint32_t MAGIC_FLOAT           = 0xFF000000;  //First 8 bits of float
 const uint32_t EXPONENT_BITS         = 0x7F800000;  //Exponent bits 2-9 of a float
 const uint32_t DEFER_ITEM_BITS       = 0xC000;      //Bitmask for storing deferred writes of items
 
-const uint32_t ITEM_SLOTS            = 256;         //Max number of items we expect to track at once
+const uint32_t ITEM_SLOTS            = 256;         //Number of item history slots (by id % ITEM_SLOTS) in compressor versions 1-2
+const uint32_t ITEM_TABLE_MIN        = 64;          //Initial size of the item history table (by full id) in compressor versions 3+
+const uint32_t ITEM_HISTORY          = 64;          //Bytes of history kept for each item (covers every item field we predict)
 const uint32_t MESSAGE_SIZE          = 517;         //Size of Message Splitter event
-const uint32_t MAX_ITEMS_C           = 2048;        //Max number of items to track initially
 const uint32_t MAX_ROLLBACK          = 128;         //Max number of frames game can roll back
 const int      RB_SIZE               = 4;           //Size of circular queue for tracking repeated frames
 
 const int      FRAME_ENC_DELTA       = 1;           //Delta when predicting and encoding next frame
-const int      ALLOC_EVENTS          = 100000;      //Number of events to initially allocate space for shuffling
 
 namespace slip {
 
+//Prediction history for a single item
+struct ItemHistory {
+  uint32_t id    = 0;                  //Full spawn id of the item
+  int32_t  frame = 0;                  //Last frame the item was updated on
+  bool     used  = false;              //Whether this entry has ever held an item
+  char     x[ITEM_HISTORY]   = {0};    //Delta for item updates
+  char     x2[ITEM_HISTORY]  = {0};    //Delta for item updates 2 frames ago
+  char     x3[ITEM_HISTORY]  = {0};    //Delta for item updates 3 frames ago
+  char     x4[ITEM_HISTORY]  = {0};    //Delta for item updates 4 frames ago
+  char     pos[ITEM_HISTORY] = {0};    //Delta for item position updates
+};
+
+//Prediction history for a single player (or follower)
+struct PlayerHistory {
+  char     pre[256]          = {0};    //Delta for pre-frames
+  char     pre2[256]         = {0};    //Delta for 2 pre-frames ago
+  char     post[256]         = {0};    //Delta for post-frames
+  char     post2[256]        = {0};    //Delta for 2 post-frames ago
+  char     post3[256]        = {0};    //Delta for 3 post-frames ago
+};
+
+//Frame event column byte widths (negative numbers denote bit shuffling)
+struct ColumnWidths {
+  int32_t  start[5] = {1,4,4,4,0};
+  int32_t  mesg[6]  = {1,512,2,1,1,0};
+  int32_t  pre[21]  = {1,4,1,1,4,2,4,4,4,4,4,4,4,4,4,2,4,4,1,4,0};
+  int32_t  item[21] = {1,4,2,1,4,4,4,4,4,2,4, 1,1,1,1 ,1,1,1,1,1,0}; // Shuffle bytes of item id
+  int32_t  post[35] = {1,4,1,1,1,2,4,4,4,4,4,1,1,1,1,4,1,1,1,1,1,4,1,2,1,1,1,4,4,4,4,4,4,4,0};
+  int32_t  end[4]   = {1,4,4,0};
+};
+
+//Jump table for Melee's legacy LCG (seed' = 214013*seed + 2531011 mod 2^32)
+//  https://www.reddit.com/r/SSBM/comments/71gn1d/the_basics_of_rng_in_melee/
+//  Entry i holds the multiplier and increment that advance a seed by 2^i rolls at once, so
+//  any number of rolls takes at most 32 steps. The LCG has full period (odd increment,
+//  multiplier = 1 mod 4), so every seed is reachable from every other seed in exactly one
+//  number of rolls below 2^32, which distance() recovers one bit at a time
+struct LegacyRNGTable {
+  uint32_t mult[32];
+  uint32_t plus[32];
+  constexpr LegacyRNGTable() : mult(), plus() {
+    uint32_t m = 214013, p = 2531011;
+    for (unsigned i = 0; i < 32; ++i) {
+      mult[i] = m;
+      plus[i] = p;
+      p      *= m + 1;  //Applying the same step twice: m*(m*x+p)+p
+      m      *= m;
+    }
+  }
+};
+
+class LegacyRNG {
+private:
+  static constexpr LegacyRNGTable _table = LegacyRNGTable();
+public:
+  //Roll seed forward by the given number of rolls
+  static inline uint32_t jump(uint32_t seed, uint32_t rolls) {
+    for (unsigned i = 0; rolls; ++i, rolls >>= 1) {
+      if (rolls & 1) {
+        seed = _table.mult[i] * seed + _table.plus[i];
+      }
+    }
+    return seed;
+  }
+  //Get the number of rolls needed to get from seed "from" to seed "to"
+  static inline uint32_t distance(uint32_t from, uint32_t to) {
+    uint32_t rolls = 0;
+    for (unsigned i = 0; from != to; ++i) {
+      //Rolling by 2^i never changes the lowest i bits, so bit i decides whether we need that jump
+      uint32_t bit = uint32_t(1) << i;
+      if ((from ^ to) & bit) {
+        from   = _table.mult[i] * from + _table.plus[i];
+        rolls |= bit;
+      }
+    }
+    return rolls;
+  }
+};
+
+//Copy one W-byte column of n fixed-size structs (stride bytes apart) into a contiguous block, or back
+template <unsigned W>
+inline void transposeByteColumn(char* block, char* structs, unsigned n, unsigned stride, bool unshuffle) {
+  if (unshuffle) {
+    for (unsigned e = 0; e < n; ++e, block += W, structs += stride) {
+      memcpy(structs,block,W);
+    }
+  } else {
+    for (unsigned e = 0; e < n; ++e, block += W, structs += stride) {
+      memcpy(block,structs,W);
+    }
+  }
+}
+
+//Transpose an 8x8 bit matrix stored one row per byte (bit c of row r <-> bit r of row c)
+//  Hacker's Delight, section 7-3
+inline uint64_t transposeBits8x8(uint64_t x) {
+  uint64_t t;
+  t = (x ^ (x >>  7)) & 0x00AA00AA00AA00AAULL;  x = x ^ t ^ (t <<  7);
+  t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;  x = x ^ t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;  x = x ^ t ^ (t << 28);
+  return x;
+}
+
+//Split a one-byte column of n structs into 8 bit planes (most significant first, n bits each,
+//  packed back to back most significant bit first), or merge the planes back
+//  The n bytes of block must be zeroed before shuffling
+inline void transposeBitColumn(char* block, char* structs, unsigned n, unsigned stride, bool unshuffle) {
+  uint8_t* planes = reinterpret_cast<uint8_t*>(block);
+  unsigned full   = n & ~7u;
+  //Groups of 8 structs form one byte in each plane, starting plane*n + e bits into the block
+  for (unsigned e = 0; e < full; e += 8) {
+    uint64_t x = 0;
+    if (unshuffle) {
+      for (unsigned p = 0; p < 8; ++p) {
+        unsigned off = p*n + e, s = off & 7;
+        unsigned v   = s ? ((planes[off >> 3] << s) | (planes[(off >> 3) + 1] >> (8 - s))) : planes[off >> 3];
+        x |= uint64_t(v & 0xFF) << (8*(7-p));
+      }
+      x = transposeBits8x8(x);
+      for (unsigned j = 0; j < 8; ++j) {
+        structs[(e+j)*stride] = char(x >> (8*(7-j)));
+      }
+    } else {
+      for (unsigned j = 0; j < 8; ++j) {
+        x |= uint64_t(uint8_t(structs[(e+j)*stride])) << (8*(7-j));
+      }
+      x = transposeBits8x8(x);
+      for (unsigned p = 0; p < 8; ++p) {
+        uint8_t  v   = uint8_t(x >> (8*(7-p)));
+        unsigned off = p*n + e, s = off & 7;
+        planes[off >> 3] |= v >> s;
+        if (s) {
+          planes[(off >> 3) + 1] |= uint8_t(v << (8 - s));
+        }
+      }
+    }
+  }
+  //Leftover structs one bit at a time
+  for (unsigned e = full; e < n; ++e) {
+    uint8_t byte = unshuffle ? 0 : uint8_t(structs[e*stride]);
+    for (unsigned p = 0; p < 8; ++p) {
+      unsigned off = p*n + e;
+      uint8_t  bit = 0x80 >> (off & 7);
+      if (unshuffle) {
+        byte |= (planes[off >> 3] & bit) ? (0x80 >> p) : 0;
+      } else if (byte & (0x80 >> p)) {
+        planes[off >> 3] |= bit;
+      }
+    }
+    if (unshuffle) {
+      structs[e*stride] = char(byte);
+    }
+  }
+}
+
 class Compressor {
 private:
 
@@ -48,12 +209,10 @@ private:
   int32_t         _max_frames         =  0;       //Maximum number of frames that there will be in the replay file
   std::string*    _outfilename        =  nullptr; //Name of the file to write
   std::string*    _outgeckofilename   =  nullptr; //Name of gecko file to write
-
-  //Variables needed for mapping floats to ints and vice versa
-  std::map<unsigned,unsigned> float_to_int;  //Map of floats to ints
-  std::map<unsigned,unsigned> int_to_float;  //Reverse map of ints back to floats
-  std::map<unsigned,unsigned> int_to_float_c;//Counter for reverse map of ints back to floats
-  unsigned            num_floats = 0;        //Total number of floats in float map
+  LzmaOptions     _lzma;                          //Settings for compressing the encoded replay
+  bool            _column_coder       =  false;   //Whether to compress with the column model coder instead of LZMA
+  bool            _peekable           =  false;   //Whether to write a peek header before the compressed stream
+  double          _shuffle_secs       =  0;       //Seconds spent shuffling (or unshuffling) events and columns
 
   uint32_t        _preds = 0;
   uint32_t        _fails = 0;
@@ -62,16 +221,10 @@ private:
 
   uint32_t        _rng;                                //Current RNG seed we're working with
   uint32_t        _rng_start;                          //Starting RNG seed
-  char            _x_pre_frame[8][256]       = {0};    //Delta for pre-frames
-  char            _x_pre_frame_2[8][256]     = {0};    //Delta for 2 pre-frames ago
-  char            _x_post_frame[8][256]      = {0};    //Delta for post-frames
-  char            _x_post_frame_2[8][256]    = {0};    //Delta for 2 post-frames ago
-  char            _x_post_frame_3[8][256]    = {0};    //Delta for 3 post-frames ago
-  char            _x_item[ITEM_SLOTS][256]   = {0};    //Delta for item updates
-  char            _x_item_2[ITEM_SLOTS][256] = {0};    //Delta for item updates 2 frames ago
-  char            _x_item_3[ITEM_SLOTS][256] = {0};    //Delta for item updates 3 frames ago
-  char            _x_item_4[ITEM_SLOTS][256] = {0};    //Delta for item updates 4 frames ago
-  char            _x_item_p[ITEM_SLOTS][256] = {0};    //Delta for item position updates
+  std::vector<PlayerHistory> _players;                 //Prediction history for players (see _playerHistory())
+  std::vector<ItemHistory> _items;                     //Prediction history for items (see _itemSlot())
+  unsigned        _items_used                = 0;      //Number of used entries in the item history table
+  unsigned        _last_spawn                = UINT32_MAX;  //Index of the most recently spawned item's history
   int32_t         laststartframe             = -123;   //Last frame used in frame start event, encoding
   int32_t         lastitemstartframe         = -123;   //Last frame used in item event, encoding
   int32_t         lastshuffleframe           = -123;   //Last frame used in frame start event, shuffling
@@ -81,8 +234,10 @@ private:
   int32_t         lastpostframe[8]           = {-123}; //Last frame used in post frame event, encoding
   int32_t         lastshufflepostframe[8]    = {-123}; //Last frame used in post frame event, shuffling
 
-  char*           _rb                        = nullptr; //Read buffer
-  char*           _wb                        = nullptr; //Write buffer
+  std::string     _rbuf;                                //Storage for the read buffer
+  std::string     _wbuf;                                //Storage for the write buffer
+  char*           _rb                        = nullptr; //Read buffer (points into _rbuf)
+  char*           _wb                        = nullptr; //Write buffer (points into _wbuf)
   unsigned        _bp                        = 0;       //Current position in buffer
   uint32_t        _length_raw                = 0;       //Remaining length of raw payload
   uint32_t        _length_raw_start          = 0;       //Total length of raw payload
@@ -91,22 +246,13 @@ private:
   uint32_t        _file_size                 = 0;       //Total size of the replay file on disk
   uint32_t        _message_count             = 0;       //Number of gecko messages we've parsed thus far
   bool            _game_end_found            = false;   //Whether we've found the game end event
+  bool            _raw_saved                 = false;   //Whether saveToFile() wrote a raw encode (no LZMA)
+  std::string     _peek;                                //Peek header saveToFile() wrote before the compressed stream
+  std::vector<char> _shuffle_buf;                       //Scratch space for transposing event columns
+  std::vector<ColumnSegment> _columns;                  //Location of each shuffled column in the write buffer
 
-  // Frame event column byte widths (negative numbers denote bit shuffling)
-  int32_t         _cw_start[5] = {1,4,4,4,0};
-  int32_t         _cw_mesg[6]  = {1,512,2,1,1,0};
-  int32_t         _cw_pre[21]  = {1,4,1,1,4,2,4,4,4,4,4,4,4,4,4,2,4,4,1,4,0};
-  int32_t         _cw_item[21] = {1,4,2,1,4,4,4,4,4,2,4, 1,1,1,1 ,1,1,1,1,1,0}; // Shuffle bytes of item id
-  int32_t         _cw_post[35] = {1,4,1,1,1,2,4,4,4,4,4,1,1,1,1,4,1,1,1,1,1,4,1,2,1,1,1,4,4,4,4,4,4,4,0};
-  int32_t         _cw_end[4]   = {1,4,4,0};
-
-  // Debug Frame event column byte widths (negative numbers denote bit shuffling)
-  int32_t         _dw_start[5] = {1,4,4,4,0};
-  int32_t         _dw_mesg[6]  = {1,512,2,1,1,0};
-  int32_t         _dw_pre[21]  = {1,4,1,1,4,2,4,4,4,4,4,4,4,4,4,2,4,4,1,4,0};
-  int32_t         _dw_item[21] = {1,4,2,1,4,4,4,4,4,2,4, 1,1,1,1 ,1,1,1,1,1,0}; // Shuffle bytes of item id
-  int32_t         _dw_post[35] = {1,4,1,1,1,2,4,4,4,4,4,1,1,1,1,4,1,1,1,1,1,4,1,2,1,1,1,4,4,4,4,4,4,4,0};
-  int32_t         _dw_end[4]   = {1,4,4,0};
+  ColumnWidths    _cw;                                  //Frame event column byte widths (truncated to the replay's version)
+  ColumnWidths    _dw;                                  //Debug frame event column byte widths (truncated to the replay's version)
 
   bool            _parse();             //Internal main parsing funnction
   bool            _parseHeader();
@@ -125,24 +271,28 @@ private:
 public:
   Compressor(int debug_level);                     //Instantiate the parser (possibly in debug mode)
   ~Compressor();                                   //Destroy the parser
+  Compressor(const Compressor&) = delete;          //Owns its output file names, so can't be copied
+  Compressor& operator=(const Compressor&) = delete;
+  void reset();                                    //Forget the current replay so another can be loaded (keeps
+                                                   //  settings and buffer storage, e.g., to reuse one per thread)
   bool loadFromFile(const char* replayfilename);   //Load a replay file
-  void saveToFile(bool rawencode);              //Save an encoded replay file
+  void saveToFile(bool rawencode);                 //Save an encoded replay file (releases the original replay)
   bool setOutputFilename(const char* fname);       //Set output file name
+  const char* outputFilename() const { return _outfilename ? _outfilename->c_str() : ""; }  //Get output file name
   bool setGeckoOutputFilename(const char* fname);  //Set gecko code output filename
+  void setLzmaOptions(const LzmaOptions &o) { _lzma = o; }  //Set LZMA preset / threading for saveToFile()
+  void setColumnCoder(bool cm) { _column_coder = cm; }     //Use the column model coder instead of LZMA in saveToFile()
+  void setPeekable(bool pk) { _peekable = pk; }            //Write a summary for Parser::peek() in saveToFile()
   bool loadFromBuff(char** buffer, unsigned size); //Load a replay from a buffer
   unsigned saveToBuff(char** buffer);              //Save an encoded replay buffer
-  bool validate();                                 //Validate the encoding
-
-  //https://www.reddit.com/r/SSBM/comments/71gn1d/the_basics_of_rng_in_melee/
-  inline int32_t rollRNGLegacy(int32_t seed) const {
-    int64_t bigseed = seed;  //Cast from 32-bit to 64-bit int
-    return ((bigseed * 214013) + 2531011) % 4294967296;
-  }
-
-  //Given the current frame's RNG value, just add 65536 to get the next frame's
-  inline int32_t rollRNGRollback(int32_t seed) const {
-    return (seed + 65536) % 4294967296;
-  }
+  //Decode the encoded replay in buf into buf itself; buf's storage is moved in and decoded in place
+  //  (the read and write buffers are the same), so the replay is never copied (buf is emptied on failure)
+  bool decodeBuff(std::string &buf);
+  //Validate the encoding by decoding it in place in the read buffer's storage and comparing checksums
+  //  with the original replay (on failure, the original replay is released)
+  bool validate();
+  bool verifySavedFile() const;                    //Verify the file written by saveToFile() against the validated buffer
+  double shuffleSeconds() const { return _shuffle_secs; }  //Get the time spent (un)shuffling while encoding or decoding
 
   //Per Fizzi and Nikki, RNG is just the starting RNG + 65536*<0-indexed frame>
   inline int32_t computeRNGRollback(int32_t framenum) const {
@@ -188,36 +338,6 @@ public:
     return predictFrame(frame, ref_frame, nullptr);
   }
 
-  //Create a mapping of floats we've already seen by treating them as unsigned integer indices
-  //  to an index build on-the-fly
-  inline void buildFloatMap(unsigned off) {
-    uint32_t enc_float = readBE4U(&_rb[_bp+off]);
-    if (_encode_ver) {                  //Decode
-      if ((enc_float & MAGIC_FLOAT) != MAGIC_FLOAT) {
-        //If it's our first encounter with a float, add it to our maps
-        float_to_int[enc_float]  = num_floats;
-        int_to_float[num_floats] = enc_float;
-        ++num_floats;
-      } else {
-        //Decode our int back to a float
-        unsigned as_unsigned = int_to_float[enc_float & (MAGIC_FLOAT ^ 0xFFFFFFFF)];
-        writeBE4U(as_unsigned, &_wb[_bp+off]);
-      }
-    } else {                            //Encode
-      if (float_to_int.find(enc_float) == float_to_int.end()) {
-        //If it's our first encounter with a float, add it to our maps
-        float_to_int[enc_float]    = num_floats;
-        int_to_float[num_floats]   = enc_float;
-        int_to_float_c[num_floats] = 1;
-        ++num_floats;
-      } else {
-        //Set the 2nd and 3rd bit, since they will never be set simultaneously in real floats
-        ++int_to_float_c[float_to_int[enc_float]];
-        writeBE4U(float_to_int[enc_float] | MAGIC_FLOAT, &_wb[_bp+off]);
-      }
-    }
-  }
-
   //Compress analog float values by converting them to ints
   inline void encodeAnalog(unsigned off, float mult) {
     union { float f; uint32_t u; uint8_t c[4]; int8_t i[4]; } float_true, float_pred, float_rest;
@@ -426,37 +546,136 @@ public:
   //Using the previous four item events as reference, predict a floating point value, and store
   //  an otherwise-impossible float if our prediction was correct
   inline void predictJoltItem(unsigned p, unsigned off, bool verbose = false) {
-    predictJolt(p,off,_x_item[p],_x_item_2[p],_x_item_3[p],_x_item_4[p],verbose);
+    ItemHistory &h = _items[p];
+    predictJolt(p,off,h.x,h.x2,h.x3,h.x4,verbose);
   }
 
   //Using the previous three post-frame events as reference, predict a floating point value, and store
   //  an otherwise-impossible float if our prediction was correct
   inline void predictAccelPost(unsigned p, unsigned off) {
-    predictAccel(p,off,_x_post_frame[p],_x_post_frame_2[p],_x_post_frame_3[p]);
+    PlayerHistory &h = _players[p];
+    predictAccel(p,off,h.post,h.post2,h.post3);
   }
 
   //Using the previous three item events as reference, predict a floating point value, and store
   //  an otherwise-impossible float if our prediction was correct
   inline void predictAccelItem(unsigned p, unsigned off, bool verbose = false) {
-    predictAccel(p,off,_x_item[p],_x_item_2[p],_x_item_3[p],verbose);
+    ItemHistory &h = _items[p];
+    predictAccel(p,off,h.x,h.x2,h.x3,verbose);
   }
 
   //Using the previous two pre-frame events as reference, predict a floating point value, and store
   //  an otherwise-impossible float if our prediction was correct
   inline void predictVelocPre(unsigned p, unsigned off) {
-    predictVeloc(p,off,_x_pre_frame[p],_x_pre_frame_2[p]);
+    PlayerHistory &h = _players[p];
+    predictVeloc(p,off,h.pre,h.pre2);
   }
 
   //Using the previous two post-frame events as reference, predict a floating point value, and store
   //  an otherwise-impossible float if our prediction was correct
   inline void predictVelocPost(unsigned p, unsigned off) {
-    predictVeloc(p,off,_x_post_frame[p],_x_post_frame_2[p]);
+    PlayerHistory &h = _players[p];
+    predictVeloc(p,off,h.post,h.post2);
   }
 
   //Using the previous two item events with slot id as reference, predict a floating point value, and store
   //  an otherwise-impossible float if our prediction was correct
   inline void predictVelocItem(unsigned p, unsigned off) {
-    predictVeloc(p,off,_x_item[p],_x_item_2[p]);
+    ItemHistory &h = _items[p];
+    predictVeloc(p,off,h.x,h.x2);
+  }
+
+  //Get the prediction history for a player, allocating histories only for the player indices
+  //  a replay actually uses (usually just the first two of the eight)
+  inline PlayerHistory &_playerHistory(unsigned p) {
+    if (p >= _players.size()) {
+      _players.resize(p + 1);
+    }
+    return _players[p];
+  }
+
+  //Get the index of the prediction history for an item updated on a given frame
+  //  Versions 1-2 of the compressor share one history between all items with the same id % ITEM_SLOTS,
+  //  so two live items in the same slot trash each other's predictions. Later versions key an
+  //  open-addressing table by the full id instead, and recycle the entries of items that have
+  //  despawned (i.e., weren't updated on the previous frame, since items update every frame)
+  inline unsigned _itemSlot(uint32_t id, int32_t frame) {
+    if (!ENCODE_VERSION_MIN(3)) {
+      if (_items.size() != ITEM_SLOTS) {
+        _items.resize(ITEM_SLOTS);
+      }
+      return id % ITEM_SLOTS;
+    }
+    if (_items.empty()) {
+      _items.resize(ITEM_TABLE_MIN);
+    }
+    unsigned mask  = _items.size() - 1;
+    unsigned reuse = _items.size();  //First entry of a despawned item along the probe sequence
+    unsigned i     = _itemHash(id) & mask;
+    for ( ; _items[i].used; i = (i + 1) & mask) {
+      if (_items[i].id == id) {
+        _items[i].frame = frame;
+        return i;
+      }
+      if (reuse == _items.size() && _items[i].frame < frame - 1) {
+        reuse = i;
+      }
+    }
+    if (reuse == _items.size()) {
+      // Keep at least a quarter of the table empty so probe sequences stay short and always end
+      if (4 * (_items_used + 1) > 3 * _items.size()) {
+        _rehashItems(frame);
+        return _itemSlot(id, frame);
+      }
+      reuse = i;
+      ++_items_used;
+    }
+    // New items are often the same kind as the last item spawned, so start from its history
+    if (reuse != _last_spawn) {
+      _items[reuse] = (_last_spawn < _items.size()) ? _items[_last_spawn] : ItemHistory();
+    }
+    _last_spawn         = reuse;
+    _items[reuse].id    = id;
+    _items[reuse].frame = frame;
+    _items[reuse].used  = true;
+    return reuse;
+  }
+
+  static inline uint32_t _itemHash(uint32_t id) {
+    uint32_t h = id * 0x9E3779B1u;
+    return h ^ (h >> 16);
+  }
+
+  //Rebuild the item history table with only the items still alive on a given frame,
+  //  sized so they fill at most a quarter of it
+  void _rehashItems(int32_t frame) {
+    std::vector<ItemHistory> old;
+    old.swap(_items);
+    unsigned live = 0;
+    for (const ItemHistory &h : old) {
+      live += (h.used && h.frame >= frame - 1);
+    }
+    unsigned size = ITEM_TABLE_MIN;
+    while (size < 4 * (live + 1)) {
+      size *= 2;
+    }
+    _items.resize(size);
+    _items_used = live;
+    unsigned last_spawn = UINT32_MAX;
+    for (unsigned j = 0; j < old.size(); ++j) {
+      const ItemHistory &h = old[j];
+      if (h.used && h.frame >= frame - 1) {
+        unsigned i = _itemHash(h.id) & (size - 1);
+        while (_items[i].used) {
+          i = (i + 1) & (size - 1);
+        }
+        _items[i] = h;
+        if (j == _last_spawn) {
+          last_spawn = i;
+        }
+      }
+    }
+    _last_spawn = last_spawn;
   }
 
   //Predict the RNG by reading a full (not delta-encoded) frame and
@@ -483,33 +702,24 @@ public:
         if (rng_is_raw == 0) { //Roll RNG a few times until we get to the desired value
           unsigned rolls = readBE4U(&_rb[_bp+rngoff]);
           if (rolls < MAX_ROLLS) {
-            for(unsigned i = 0; i < rolls; ++i) {
-              _rng = rollRNGRollback(_rng);
-            }
+            _rng += rolls * 65536;
           } else {  //Fallback on old RNG rolling method
-            for(unsigned i = MAX_ROLLS; i < rolls; ++i) {
-              _rng = rollRNGLegacy(_rng);
-            }
+            _rng = LegacyRNG::jump(_rng,rolls-MAX_ROLLS);
           }
           writeBE4U(_rng,&_wb[_bp+rngoff]);
         } else {
           writeBE4U(frame,&_wb[_bp+frameoff]);
         }
       } else {  //Encode
-        unsigned rolls  = 0;
         unsigned target = readBE4U(&_rb[_bp+rngoff]);
-        for(uint32_t start_rng = _rng; (start_rng != target) && (rolls < MAX_ROLLS); ++rolls) {
-          start_rng = rollRNGRollback(start_rng);
-        }
+        uint32_t delta  = target - _rng;  //Rollback RNG advances by 65536 per roll
+        unsigned rolls  = (delta & 0xFFFF) ? MAX_ROLLS : (delta >> 16);
         if (rolls < MAX_ROLLS) {  //If we can encode RNG as < 256 rolls, do it
           // std::cout << "Rollback rolled " << rolls << " at byte " << _bp << " frame " << frame << std::endl;
           writeBE4U(rolls,&_wb[_bp+rngoff]);
           _rng = target;
         } else {
-          rolls  = 0;
-          for(uint32_t start_rng = _rng; (start_rng != target) && (rolls < MAX_ROLLS); ++rolls) {
-            start_rng = rollRNGLegacy(start_rng);
-          }
+          rolls = LegacyRNG::distance(_rng,target);
           if (rolls < MAX_ROLLS) {
             // std::cout << "Legacy rolled " << rolls << " at byte " << _bp << " frame " << frame << std::endl;
             writeBE4U(rolls+MAX_ROLLS,&_wb[_bp+rngoff]);
@@ -525,16 +735,12 @@ public:
     } else { //Old RNG
       if (_encode_ver) {
         unsigned rolls = readBE4U(&_rb[_bp+rngoff]);
-        for(unsigned i = 0; i < rolls; ++i) {
-          _rng = rollRNGLegacy(_rng);
-        }
+        _rng = LegacyRNG::jump(_rng,rolls);
         writeBE4U(_rng,&_wb[_bp+rngoff]);
-      } else { //Roll RNG until we hit the target, write the # of rolls
-        unsigned rolls, seed = readBE4U(&_rb[_bp+rngoff]);
-        for(rolls = 0; _rng != seed; ++rolls) {
-          _rng = rollRNGLegacy(_rng);
-        }
-        writeBE4U(rolls,&_wb[_bp+rngoff]);
+      } else { //Count the rolls it takes to hit the target (always < 32 jumps, even for corrupt seeds)
+        unsigned seed = readBE4U(&_rb[_bp+rngoff]);
+        writeBE4U(LegacyRNG::distance(_rng,seed),&_wb[_bp+rngoff]);
+        _rng = seed;
       }
     }
   }
@@ -548,121 +754,135 @@ public:
   }
 
   inline bool _shuffleItems(char* iblock_start, unsigned iblock_len, bool shuffle=true) {
-    // allocate temporary buffers for shuffling
-    // TODO: dynamically reallocate this array later
     unsigned ps         = _payload_sizes[Event::ITEM_UPDATE];
-    unsigned* icount    = new unsigned[MAX_ITEMS_C]{0};
-    unsigned* ilast     = new unsigned[MAX_ITEMS_C]{0};
-    char** ibuffs       = new char*[MAX_ITEMS_C];
-    for(unsigned i = 0; i < MAX_ITEMS_C; ++i) {
-      ibuffs[i] = nullptr;
-    }
-
-    // bin item payloads by item ID
-    bool success      = true;
-    bool first_item   = true;  //apparently the first item isn't always id 0
-    unsigned wait     = 0;
-    unsigned ev_total = 0;
-    unsigned cur_id   = 0;
-    unsigned max_item = 0;
-    for (unsigned i = 0; i < iblock_len; i += ps) {
-      // read the raw (possibly encoded) item id
-      uint32_t ouid   = readBE4U(&iblock_start[i+O_ITEM_ID]);
-      // parse out the frame modulus from the item id
-      uint32_t uid    = encodeFrameIntoItemId(ouid,getFrameModFromItemId(ouid));
-
-      // if we're shuffling, we need to do some counting
-      if(shuffle) {
-        unsigned encid;
-        if(icount[uid] == 0) {
-          // get the number of elapsed item events since the last new item,
-          encid = encodeWaitIntoItemId(ouid,wait);
-          // if this isn't item 0, flag this as a new item
-          if(!first_item) {
-            // ids aren't always consecutive, so count the item id delta since last item
-            unsigned skip = 0;
-            while(icount[uid-skip] == 0) {
-              ++skip;
-            }
-            encid = encodeNewItemIntoId(encid,skip);
-          } else {
-            // if our first item isn't id 0, encode its uid as the skip value
-            encid = encodeNewItemIntoId(encid,uid);
-            // set first item status to false
-            first_item = false;
+    unsigned num_events = iblock_len / ps;
+
+    // Pass 1: find which item each payload belongs to and count payloads per item
+    //   Items are numbered densely in order of item id, which is also the order they first appear in
+    //   (the encoding of new item ids below depends on this), so per-item state stays proportional to
+    //   the number of payloads no matter how large the item ids get
+    std::vector<uint32_t> item_ids;     //Actual item id of each dense item number
+    std::vector<uint32_t> icount;       //Number of payloads for each item
+    std::vector<uint32_t> ev_item;      //Dense item number of each payload (shuffling only)
+    if(shuffle) {
+      ev_item.resize(num_events);
+      for (unsigned e = 0; e < num_events; ++e) {
+        uint32_t ouid = readBE4U(&iblock_start[e*ps+O_ITEM_ID]);
+        uint32_t uid  = encodeFrameIntoItemId(ouid,getFrameModFromItemId(ouid));
+        if (item_ids.empty() || uid > item_ids.back()) {
+          item_ids.push_back(uid);
+          icount.push_back(0);
+        } else if (uid != item_ids.back()) {
+          auto it = std::lower_bound(item_ids.begin(),item_ids.end(),uid);
+          if (*it != uid) {
+            FAIL("    Item " << uid << " first appears after item " << item_ids.back());
+            return false;
           }
-
-          // set the wait since last new item to 1
-          wait = 0;
-        } else {
-          // get the number of elapsed item events since the last time we saw this item
-          encid = encodeWaitIntoItemId(ouid,ev_total-ilast[uid]);
+          ev_item[e] = it - item_ids.begin();
+          ++icount[ev_item[e]];
+          continue;
+        }
+        ev_item[e] = item_ids.size() - 1;
+        ++icount[ev_item[e]];
+      }
+    } else {
+      uint32_t cur_id = 0;
+      for (unsigned e = 0; e < num_events; ++e) {
+        // shuffled payloads are grouped by item, and the first payload of each new item holds the id delta
+        uint32_t ouid = readBE4U(&iblock_start[e*ps+O_ITEM_ID]);
+        if (e == 0 && ENCODE_VERSION_MIN(3)) {
+          // the first item's whole id is in its wait bits
+          cur_id = getWaitFromItemId(ouid);
+          ouid   = encodeWaitIntoItemId(ouid,0);
+          writeBE4U(ouid,&iblock_start[O_ITEM_ID]);
         }
-
-        // increment the waiting counter
-        wait += 1;
-
-        // update the last time we saw this item with ev_total
-        ilast[uid] = ev_total;
-
-        // increment the total events
-        ev_total += 1;
-
-        // write the new encoded item back to the block to be copied
-        writeBE4U(encid,&iblock_start[i+O_ITEM_ID]);
-      } else {  // otherwise, we need to do some unpacking
-        // if we've found a new item, increment our cur_id and copy as appropriate into the block
         unsigned skip = getIsNewItem(ouid);
         if(skip) {
           cur_id += skip;
-          writeBE4U(encodeNewItemIntoId(ouid,skip),&iblock_start[i+O_ITEM_ID]);
+          writeBE4U(encodeNewItemIntoId(ouid,skip),&iblock_start[e*ps+O_ITEM_ID]);
         }
-        // set uid to the current item
-        uid = cur_id;
+        if (skip || item_ids.empty()) {
+          item_ids.push_back(cur_id);
+          icount.push_back(0);
+        }
+        ++icount.back();
       }
+    }
+    unsigned num_items = item_ids.size();
 
-      // allocate a buffer for this item if we don't have one already
-      if(ibuffs[uid] == nullptr) {
-        ibuffs[uid] = new char[iblock_len];
+    // New items store their id delta in a single byte, so check every delta fits before we start
+    //   rewriting ids in place (the first item's whole id goes in its wait bits instead)
+    if(shuffle) {
+      for (unsigned n = 1; n < num_items; ++n) {
+        if (item_ids[n]-item_ids[n-1] > 255) {
+          FAIL("    Item id jumps from " << item_ids[n-1] << " to " << item_ids[n]);
+          return false;
+        }
       }
+    }
 
-      // copy an item payload into each item's individual buffer
-      memcpy(&(ibuffs[uid][ps*icount[uid]]),&iblock_start[i],ps);
-
-      // increment number of payloads for this item
-      icount[uid] += 1;
+    // Compute where each item's payloads start in the shuffled block
+    std::vector<uint32_t> ioff(num_items);
+    for (unsigned n = 0, off = 0; n < num_items; ++n) {
+      ioff[n] = off;
+      off    += icount[n] * ps;
+    }
 
-      // keep track of the highest item id we've encountered so far
-      if (uid >= max_item) {
-        max_item = uid+1;
-      }
+    // Reuse the scratch buffer shared with column transposes
+    if (_shuffle_buf.size() < iblock_len) {
+      _shuffle_buf.resize(iblock_len);
     }
+    char* ibuff = _shuffle_buf.data();
 
-    // if we're shuffling, copy these payloads in item order back into main memory
+    bool success      = true;
+    std::vector<uint32_t> ipos(num_items,0);  //Number of payloads of each item processed so far
+    std::vector<uint32_t> ilast(num_items,0); //Event count when each item was last seen
+    unsigned ev_total = 0;
+    unsigned waited   = 0;
     if(shuffle) {
-      unsigned ind    = 0;
-      for (unsigned n = 0; ind != iblock_len; ++n) {
-        if (icount[n] == 0) {
-          continue;
+      // Pass 2: encode the timing of each payload into its item id and scatter it into its item's bin
+      for (unsigned e = 0; e < num_events; ++e) {
+        char*    ev   = &iblock_start[e*ps];
+        unsigned n    = ev_item[e];
+        uint32_t ouid = readBE4U(&ev[O_ITEM_ID]);
+        unsigned encid;
+        if(ipos[n] == 0) {
+          // get the number of elapsed item events since the last new item,
+          encid = encodeWaitIntoItemId(ouid,waited);
+          // flag this as a new item with the item id delta since the last new item
+          //   (or, for the first item, which isn't always id 0, its whole id)
+          if (n == 0 && ENCODE_VERSION_MIN(3)) {
+            // v3+ stores the first item's whole id in its wait bits (always 0 for the first item),
+            //   since the delta byte can't hold ids >= 256 (e.g., in windows of a seekable replay)
+            encid = encodeWaitIntoItemId(ouid,item_ids[0]);
+          } else {
+            encid = encodeNewItemIntoId(encid,(n == 0) ? item_ids[0] : item_ids[n]-item_ids[n-1]);
+          }
+          // set the wait since last new item to 1
+          waited = 0;
+        } else {
+          // get the number of elapsed item events since the last time we saw this item
+          encid = encodeWaitIntoItemId(ouid,ev_total-ilast[n]);
         }
-        memcpy(&iblock_start[ind],&(ibuffs[n][0]),icount[n]*ps);
-        ind += icount[n]*ps;
+        waited    += 1;
+        ilast[n]   = ev_total;
+        ev_total  += 1;
+
+        // write the new encoded item id and copy the payload into its item's bin
+        writeBE4U(encid,&ev[O_ITEM_ID]);
+        memcpy(&ibuff[ioff[n]+ps*ipos[n]],ev,ps);
+        ipos[n] += 1;
       }
+      memcpy(iblock_start,ibuff,num_events*ps);
     } else { // otherwise, gotta do lots of math to unshuffle everything
-      ev_total        = 0;
+      memcpy(ibuff,iblock_start,num_events*ps);
       unsigned start  = 0;
-      unsigned waited = 0;
       unsigned ind    = 0;
-      unsigned* ipos  = new unsigned[max_item]{0};
       // until we've copied every block
-      while(ind < iblock_len) {
+      while(ind < num_events*ps) {
         bool written = false;
         // from the first active item until the last one
-        for (unsigned n = start; n < max_item; ++n) {
-          // if this item doesn't acutally exist, we're done with this iteration
-          if (icount[n] == 0) {
-            continue;
-          }
+        for (unsigned n = start; n < num_items; ++n) {
           // if we've already copied all of this item over, go on to the next one
           if (ipos[n] == icount[n]) {
             // if this item is the start, move our start forward
@@ -674,7 +894,8 @@ public:
 
           // determine whether we've spent an appropriate amount time waiting for previous item events
           bool donewaiting;
-          unsigned ouid = readBE4U(&(ibuffs[n][ipos[n]*ps+O_ITEM_ID]));
+          char*    ev   = &ibuff[ioff[n]+ipos[n]*ps];
+          unsigned ouid = readBE4U(&ev[O_ITEM_ID]);
           unsigned wait = getWaitFromItemId(ouid);
           // if this is the first time this item appears, wait time is based off item events since last new item
           if (ipos[n] == 0) {
@@ -691,9 +912,9 @@ public:
             }
             ilast[n] = ev_total;
             // decode the actual item ID without the wait time and put it back into memory
-            writeBE4U(encodeWaitIntoItemId(ouid,n),&ibuffs[n][ipos[n]*ps+O_ITEM_ID]);
+            writeBE4U(encodeWaitIntoItemId(ouid,item_ids[n]),&ev[O_ITEM_ID]);
             // copy over to main memory
-            memcpy(&iblock_start[ind],&(ibuffs[n][ipos[n]*ps]),ps);
+            memcpy(&iblock_start[ind],ev,ps);
             // update counters as appropriate
             ind      += ps;
             ipos[n]  += 1;
@@ -717,18 +938,8 @@ public:
           break;
         }
       }
-      delete[] ipos;  //delete position buffer
     }
 
-    // delete all the temporary buffers
-    for(unsigned i = 0; i < MAX_ITEMS_C; ++i) {
-      if (ibuffs[i] != nullptr) {
-        delete[] ibuffs[i];
-      }
-    }
-    delete[] ibuffs;
-    delete[] icount;
-    delete[] ilast;
     return success;
   }
 
@@ -739,23 +950,24 @@ public:
   inline bool _shuffleColumns(unsigned *offset) {
       truncateColumnWidthsToVersion();
       char* main_buf = _wb;
+      _columns.clear();
 
       // Track the starting position of the buffer
       unsigned s         = _game_loop_start;
-      unsigned *mem_size = new unsigned[1];
+      unsigned mem_size  = 0;
 
       // Shuffle message columns
       if (main_buf[s] == Event::SPLIT_MSG) {
-        *mem_size = offset[19];
-        _transposeEventColumns(main_buf,s,mem_size,_debug ? this->_dw_mesg : this->_cw_mesg,false);
-        s += *mem_size;
+        mem_size = offset[19];
+        _transposeEventColumns(main_buf,s,&mem_size,_debug ? this->_dw.mesg : this->_cw.mesg,false);
+        s += mem_size;
       }
 
       // Shuffle frame start columns
       if (main_buf[s] == Event::FRAME_START) {
-        *mem_size = offset[0];
-        _transposeEventColumns(main_buf,s,mem_size,_debug ? this->_dw_start : this->_cw_start,false);
-        s += *mem_size;
+        mem_size = offset[0];
+        _transposeEventColumns(main_buf,s,&mem_size,_debug ? this->_dw.start : this->_cw.start,false);
+        s += mem_size;
       }
 
       // Shuffle pre frame columns
@@ -765,23 +977,23 @@ public:
           if (main_buf[s] != Event::PRE_FRAME) {
               break;
           }
-          *mem_size = offset[1+i];
-          if (*mem_size == 0) {
+          mem_size = offset[1+i];
+          if (mem_size == 0) {
             continue;
           }
-          _transposeEventColumns(main_buf,s,mem_size,_debug ? this->_dw_pre : this->_cw_pre,false);
-          s += *mem_size;
+          _transposeEventColumns(main_buf,s,&mem_size,_debug ? this->_dw.pre : this->_cw.pre,false);
+          s += mem_size;
       }
 
 
       // Shuffle item columns
       if (main_buf[s] == Event::ITEM_UPDATE) {
-        *mem_size = offset[9];
-        if(ENCODE_VERSION_MIN(2)) {
-          _shuffleItems(&main_buf[s],*mem_size);
+        mem_size = offset[9];
+        if(ENCODE_VERSION_MIN(2) && !_shuffleItems(&main_buf[s],mem_size)) {
+          return false;
         }
-        _transposeEventColumns(main_buf,s,mem_size,_debug ? this->_dw_item : this->_cw_item,false);
-        s += *mem_size;
+        _transposeEventColumns(main_buf,s,&mem_size,_debug ? this->_dw.item : this->_cw.item,false);
+        s += mem_size;
       }
 
       // Shuffle post frame columns
@@ -791,23 +1003,21 @@ public:
           if (main_buf[s] != Event::POST_FRAME) {
               break;
           }
-          *mem_size = offset[10+i];
-          if (*mem_size == 0) {
+          mem_size = offset[10+i];
+          if (mem_size == 0) {
             continue;
           }
-          _transposeEventColumns(main_buf,s,mem_size,_debug ? this->_dw_post : this->_cw_post,false);
-          s += *mem_size;
+          _transposeEventColumns(main_buf,s,&mem_size,_debug ? this->_dw.post : this->_cw.post,false);
+          s += mem_size;
       }
 
       // Shuffle frame end columns
       if (main_buf[s] == Event::BOOKEND) {
-        *mem_size = offset[18];
-        _transposeEventColumns(main_buf,s,mem_size,_debug ? this->_dw_end : this->_cw_end,false);
-        s += *mem_size;
+        mem_size = offset[18];
+        _transposeEventColumns(main_buf,s,&mem_size,_debug ? this->_dw.end : this->_cw.end,false);
+        s += mem_size;
       }
 
-      delete[] mem_size;
-
       return true;
   }
 
@@ -816,18 +1026,18 @@ public:
       // We need to unshuffle event columns before doing anything else
       // Track the starting position of the buffer
       unsigned s         = _game_loop_start;
-      unsigned *mem_size = new unsigned[1]{0};
+      unsigned mem_size  = 0;
 
       // Unshuffle message columns
       if (main_buf[s] == Event::SPLIT_MSG) {
-        _revertEventColumns(main_buf,s,mem_size,_debug ? this->_dw_mesg : this->_cw_mesg);
-        s += *mem_size;
+        _revertEventColumns(main_buf,s,&mem_size,_debug ? this->_dw.mesg : this->_cw.mesg);
+        s += mem_size;
       }
 
       // Unshuffle frame start columns
       if (main_buf[s] == Event::FRAME_START) {
-        _revertEventColumns(main_buf,s,mem_size,_debug ? this->_dw_start : this->_cw_start);
-        s += *mem_size;
+        _revertEventColumns(main_buf,s,&mem_size,_debug ? this->_dw.start : this->_cw.start);
+        s += mem_size;
       }
 
       // Unshuffle pre frame columns
@@ -835,17 +1045,17 @@ public:
           if (main_buf[s] != Event::PRE_FRAME) {
               break;
           }
-          _revertEventColumns(main_buf,s,mem_size,_debug ? this->_dw_pre : this->_cw_pre);
-          s += *mem_size;
+          _revertEventColumns(main_buf,s,&mem_size,_debug ? this->_dw.pre : this->_cw.pre);
+          s += mem_size;
       }
 
       // Unshuffle item columns
       if (main_buf[s] == Event::ITEM_UPDATE) {
-        _revertEventColumns(main_buf,s,mem_size,_debug ? this->_dw_item : this->_cw_item);
-        if(ENCODE_VERSION_MIN(2)) {
-          _unshuffleItems(&main_buf[s],*mem_size);
+        _revertEventColumns(main_buf,s,&mem_size,_debug ? this->_dw.item : this->_cw.item);
+        if(ENCODE_VERSION_MIN(2) && !_unshuffleItems(&main_buf[s],mem_size)) {
+          return false;
         }
-        s += *mem_size;
+        s += mem_size;
       }
 
       // Unshuffle post frame columns
@@ -853,19 +1063,16 @@ public:
           if (main_buf[s] != Event::POST_FRAME) {
               break;
           }
-          _revertEventColumns(main_buf,s,mem_size,_debug ? this->_dw_post : this->_cw_post);
-          s += *mem_size;
+          _revertEventColumns(main_buf,s,&mem_size,_debug ? this->_dw.post : this->_cw.post);
+          s += mem_size;
       }
 
       // Unshuffle frame end columns
       if (main_buf[s] == Event::BOOKEND) {
-        _revertEventColumns(main_buf,s,mem_size,_debug ? this->_dw_end : this->_cw_end);
-        s += *mem_size;
+        _revertEventColumns(main_buf,s,&mem_size,_debug ? this->_dw.end : this->_cw.end);
+        s += mem_size;
       }
 
-      // Reset _game_loop_start
-      delete[] mem_size;
-
       // All done!
       return true;
   }
@@ -877,7 +1084,7 @@ public:
 
     // Compute the total size of all columns in the event struct
     unsigned struct_size       = 0;
-    unsigned col_offsets[1024] = {0};
+    unsigned col_offsets[64];
     for(unsigned i = 0; col_widths[i] != 0; ++i) {
         col_offsets[i] = struct_size;
         if (col_widths[i] > 0) {
@@ -899,8 +1106,11 @@ public:
       *mem_size *= struct_size;
     }
 
-    // Create a new buffer for storing all intermediate data
-    char* buff = new char[*mem_size];
+    // Reuse the scratch buffer between calls, growing it as needed
+    if (_shuffle_buf.size() < *mem_size) {
+      _shuffle_buf.resize(*mem_size);
+    }
+    char* buff = _shuffle_buf.data();
 
     // Use struct size to get the total number of entries in the event array
     unsigned num_entries = (*mem_size) / struct_size;
@@ -910,40 +1120,42 @@ public:
     unsigned b = 0;
     for(unsigned i = 0; col_widths[i] != 0; ++i) {
       unsigned block_start = mem_off+b;
-      if (col_widths[i] > 0) {  //Normal column shuffling
-        for (unsigned e = 0; e < num_entries; ++e) {
-          unsigned mempos = (e*struct_size+col_offsets[i]);
-          memcpy(
-              &buff[     unshuffle ? mempos : b],
-              &mem_start[unshuffle ? b : mempos],
-              col_widths[i]
-              );
-          b += col_widths[i];
-        }
-      } else {  //If col_widths[i] < 0, then use bitwise column shuffling
-        for (int bit = 7, ib = 7; ib >= 0; --ib) {
-          for (unsigned e = 0; e < num_entries; ++e) {
-            unsigned mempos = (e*struct_size+col_offsets[i]);
-            char r_byte     = mem_start[shuffle ? mempos : b];
-            char r_bit      = (r_byte >> (shuffle ? ib : bit)) & 0x01;
-            char w_bit      = r_bit << (shuffle ? bit : ib);
-            buff[shuffle ? b : mempos] ^= w_bit;
-            if ((--bit) < 0) {
-              bit   = 7;
-              b    += 1;
+      char* block = unshuffle ? &mem_start[b] : &buff[b];
+      char* cols  = unshuffle ? &buff[col_offsets[i]] : &mem_start[col_offsets[i]];
+      switch(col_widths[i]) {  //Fixed widths let the compiler turn each copy into a single load / store
+        case 1:  transposeByteColumn<1>(block,cols,num_entries,struct_size,unshuffle); break;
+        case 2:  transposeByteColumn<2>(block,cols,num_entries,struct_size,unshuffle); break;
+        case 4:  transposeByteColumn<4>(block,cols,num_entries,struct_size,unshuffle); break;
+        default:
+          if (col_widths[i] > 0) {  //Normal column shuffling
+            for (unsigned e = 0; e < num_entries; ++e) {
+              unsigned mempos = (e*struct_size+col_offsets[i]);
+              memcpy(
+                  &buff[     unshuffle ? mempos : b+e*col_widths[i]],
+                  &mem_start[unshuffle ? b+e*col_widths[i] : mempos],
+                  col_widths[i]
+                  );
             }
+          } else {  //If col_widths[i] < 0, then use bitwise column shuffling
+            if (shuffle) {
+              memset(block,0,num_entries);
+            }
+            transposeBitColumn(block,cols,num_entries,struct_size,unshuffle);
           }
-        }
+      }
+      b += num_entries * ((col_widths[i] > 0) ? col_widths[i] : 1);
+      if (shuffle) {  //Remember where each column landed for the column model coder
+        _columns.push_back({block_start, mem_off+b-block_start, uint32_t((col_widths[i] > 0) ? col_widths[i] : 1)});
       }
       DOUT3("SHUFFLE " << hex(ev_code) << " column " << i << " at " << block_start << " to " << mem_off+b);
     }
 
+    // Leave any trailing partial struct as is
+    memcpy(&buff[b], &mem_start[b], *mem_size - b);
+
     // Copy back the shuffled columns
     memcpy(&mem_start[0], &buff[0], *mem_size);
 
-    // Clear the memory buffer
-    delete[] buff;
-
     // All done!
     return true;
   }
@@ -1020,67 +1232,97 @@ public:
   }
 
   static inline const char* readLegacyGeckoCodes() {
-    static bool _legacy_codes_codes_read = false;
-    static char _legacy_gecko_codes[32571];  //exact magic number of decompressed bytes
-    if (! _legacy_codes_codes_read) {
-      _legacy_codes_codes_read = true;
-      // decompress the legacy gecko code data
-      std::string decomp = decompressWithLzma(GECKO_LZMA,GECKO_LZMA_LEN);
-      // Copy buffer from the decompressed string
-      memcpy(_legacy_gecko_codes,decomp.c_str(),decomp.size());
-    }
-    return _legacy_gecko_codes;
+    // decompress the legacy gecko code data exactly once (static init is thread-safe)
+    static const std::string _legacy_gecko_codes = decompressWithLzma(GECKO_LZMA,GECKO_LZMA_LEN);
+    return _legacy_gecko_codes.c_str();
   }
 
   inline void truncateColumnWidthsToVersion() {
     if (MAX_VERSION(3,11,0)) {
-      this->_cw_post[33] = 0; //Animation index is invalid
-      this->_dw_post[33] = 0;
+      this->_cw.post[33] = 0; //Animation index is invalid
+      this->_dw.post[33] = 0;
     }
     if (MAX_VERSION(3,10,0)) {
-      this->_cw_start[3] = 0; //Scene frame counter is invalid
-      this->_dw_start[3] = 0;
+      this->_cw.start[3] = 0; //Scene frame counter is invalid
+      this->_dw.start[3] = 0;
     }
     if (MAX_VERSION(3,8,0)) {
-      this->_cw_post[32] = 0; //Hitlag and onward is invalid
-      this->_dw_post[32] = 0;
+      this->_cw.post[32] = 0; //Hitlag and onward is invalid
+      this->_dw.post[32] = 0;
     }
     if (MAX_VERSION(3,7,0)) {
-      this->_cw_end[2] = 0; //Rollback frame is invalid
-      this->_dw_end[2] = 0;
+      this->_cw.end[2] = 0; //Rollback frame is invalid
+      this->_dw.end[2] = 0;
     }
     if (MAX_VERSION(3,6,0)) {
-      this->_cw_item[19] = 0; //Item owner is invalid
-      this->_dw_item[19] = 0;
+      this->_cw.item[19] = 0; //Item owner is invalid
+      this->_dw.item[19] = 0;
     }
     if (MAX_VERSION(3,5,0)) {
-      this->_cw_post[27] = 0; //Self-induced Air x Speed and onward are invalid
-      this->_dw_post[27] = 0;
+      this->_cw.post[27] = 0; //Self-induced Air x Speed and onward are invalid
+      this->_dw.post[27] = 0;
     }
     if (MAX_VERSION(3,2,0)) {
-      this->_cw_item[15] = 0; //Item state bits are invalid
-      this->_dw_item[15] = 0;
+      this->_cw.item[15] = 0; //Item state bits are invalid
+      this->_dw.item[15] = 0;
     }
     if (MAX_VERSION(2,1,0)) {
-      this->_cw_post[26] = 0; //Hurtbox Collision State and onward are invalid
-      this->_dw_post[26] = 0;
+      this->_cw.post[26] = 0; //Hurtbox Collision State and onward are invalid
+      this->_dw.post[26] = 0;
     }
     if (MAX_VERSION(2,0,0)) {
-      this->_cw_post[16] = 0; //State bit flags 1 and onward are invalid
-      this->_dw_post[16] = 0;
+      this->_cw.post[16] = 0; //State bit flags 1 and onward are invalid
+      this->_dw.post[16] = 0;
     }
     if (MAX_VERSION(1,4,0)) {
-      this->_cw_pre[19] = 0; //Pre-frame damage percent is invalid
-      this->_dw_pre[19] = 0;
+      this->_cw.pre[19] = 0; //Pre-frame damage percent is invalid
+      this->_dw.pre[19] = 0;
     }
     if (MAX_VERSION(1,2,0)) {
-      this->_cw_pre[18] = 0; //UCF X-analog is invalid
-      this->_dw_pre[18] = 0;
+      this->_cw.pre[18] = 0; //UCF X-analog is invalid
+      this->_dw.pre[18] = 0;
     }
   }
 
 };
 
+//Compute a fingerprint (MD5) of a replay's raw event data, ignoring metadata, so the same game
+//  hashes identically whether it is stored as a .slp, a .zlp, or an xz-compressed .slp
+//  Uncompressed replays are hashed in a streaming fashion without loading the whole file
+//  Returns an empty string if the file is not a valid replay
+std::string replayFingerprint(const char* replayfilename);
+
+//Load a replay in any supported form (.slp, .zlp, seekable .zlp, xz-compressed .slp) and encode it in memory
+//  .zlp files are decoded first so enc always holds a fresh encoding of the original replay
+//  If md5 is non-null, the MD5 digest of the original .slp is written to it (16 bytes)
+//  If raw is non-null, the original .slp itself is stored in it
+//  If cmp is non-null, it's reset and used for decoding and encoding instead of fresh Compressors
+//    (e.g., to keep one warm Compressor per worker thread)
+bool encodeReplayFile(const std::string &path, int debug, std::string &enc, uint8_t* md5 = nullptr,
+  std::string* raw = nullptr, Compressor* cmp = nullptr);
+
+//Re-encode a .zlp written by an older version of the compressor with the current version, replacing
+//  it (via a temporary file, keeping its modification time) only once the new file has been verified
+//  The new file is compressed with cmp's settings (if cmp is non-null, it's reset and reused as for
+//  encodeReplayFile()); upgraded is set only if the file was replaced, so files that are already
+//  current, aren't .zlp files, or are seekable are left alone and still count as successes
+bool upgradeReplayFile(const std::string &path, int debug, bool &upgraded, Compressor* cmp = nullptr);
+
+//Get the version of the compressor that encoded an (uncompressed) replay buffer (0 if it isn't encoded)
+//  The game start event always immediately follows the event payloads event
+inline uint8_t encodedVersion(char* buf, unsigned len) {
+  if (len < MIN_REPLAY_LENGTH || !same8(buf,SLP_HEADER)) {
+    return 0;
+  }
+  unsigned gs = N_HEADER_BYTES + 1 + uint8_t(buf[N_HEADER_BYTES+1]);
+  return (gs + O_SLP_ENC < len) ? uint8_t(buf[gs+O_SLP_ENC]) : 0;
+}
+
+//Check whether an (uncompressed) replay buffer has been encoded by the compressor
+inline bool isEncodedReplay(char* buf, unsigned len) {
+  return encodedVersion(buf,len) != 0;
+}
+
 }
 
 #endif /* COMPRESSOR_H_ */
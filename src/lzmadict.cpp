@@ -0,0 +1,176 @@
+#include "lzmadict.h"
+
+#include <fstream>
+#include <map>
+#include <set>
+
+#include "compressor.h"
+
+namespace slip {
+
+//Registered preset dictionaries, keyed by their raw MD5 digests
+static std::map<std::string,std::string> &dictRegistry() {
+  static std::map<std::string,std::string> registry;
+  return registry;
+}
+
+static std::string dictDigest(const std::string &dict) {
+  picohash_ctx_t ctx;
+  unsigned char digest[PICOHASH_MD5_DIGEST_LENGTH];
+  picohash_init_md5(&ctx);
+  picohash_update(&ctx, dict.c_str(), dict.size());
+  picohash_final(&ctx, digest);
+  return std::string(reinterpret_cast<char*>(digest),PICOHASH_MD5_DIGEST_LENGTH);
+}
+
+std::string lzmaDictHash(const std::string &dict) {
+  std::string digest = dictDigest(dict);
+  return md5tostring(reinterpret_cast<unsigned char*>(&digest[0]));
+}
+
+const std::string* registerLzmaDict(const std::string &dict) {
+  return &(dictRegistry().emplace(dictDigest(dict),dict).first->second);
+}
+
+const std::string* loadLzmaDict(const char* fname) {
+  std::ifstream f(fname, std::ios::binary | std::ios::in);
+  if (f.fail()) {
+    return nullptr;
+  }
+  std::string dict((std::istreambuf_iterator<char>(f)),std::istreambuf_iterator<char>());
+  if (dict.empty() || dict.size() > DICT_MAX_SIZE) {
+    return nullptr;
+  }
+  return registerLzmaDict(dict);
+}
+
+bool compressWithDict(const char* in, size_t inlen, const LzmaOptions &o, std::string &out) {
+  const size_t CHUNK = 65536;
+  if (o.dict == nullptr || o.dict->empty() || inlen > UINT32_MAX) {
+    return false;
+  }
+  lzma_options_lzma opt;
+  if (lzma_lzma_preset(&opt, o.preset)) {
+    return false;
+  }
+  if (o.dict_size > 0) {
+    opt.dict_size = std::max(uint32_t(LZMA_DICT_SIZE_MIN),o.dict_size);
+  }
+  // the low presets' dictionaries are smaller than a trained one; make sure all of it stays in reach
+  opt.dict_size       = std::max(opt.dict_size,uint32_t(o.dict->size()));
+  opt.preset_dict      = reinterpret_cast<const uint8_t*>(o.dict->c_str());
+  opt.preset_dict_size = o.dict->size();
+  lzma_filter filters[] = {
+    { LZMA_FILTER_LZMA2, &opt },
+    { LZMA_VLI_UNKNOWN,  NULL },
+  };
+  lzma_stream strm = LZMA_STREAM_INIT;
+  if (lzma_raw_encoder(&strm, filters) != LZMA_OK) {
+    return false;
+  }
+
+  out.assign(DZ_HEADER_SIZE,'\0');
+  memcpy(&out[0],"SLDZ",4);
+  out[4] = char(DZ_VERSION);
+  writeBE4U(inlen,&out[8]);
+  writeBE4U(opt.dict_size,&out[12]);
+  out.replace(16,PICOHASH_MD5_DIGEST_LENGTH,dictDigest(*o.dict));
+
+  uint8_t chunk[CHUNK];
+  lzma_ret ret;
+  strm.next_in  = reinterpret_cast<const uint8_t*>(in);
+  strm.avail_in = inlen;
+  do {
+    strm.next_out  = chunk;
+    strm.avail_out = CHUNK;
+    ret = lzma_code(&strm, LZMA_FINISH);
+    if (ret != LZMA_OK && ret != LZMA_STREAM_END) {
+      lzma_end(&strm);
+      return false;
+    }
+    out.append(reinterpret_cast<const char*>(chunk), CHUNK - strm.avail_out);
+  } while (ret != LZMA_STREAM_END);
+  lzma_end(&strm);
+  return true;
+}
+
+bool decompressWithDict(const char* in, size_t inlen, std::string &out) {
+  static const uint32_t kMaxSize = 1 << 30;  //Same limit as for plain LZMA
+  if (inlen < DZ_HEADER_SIZE || !isDictCoded(in,inlen) || uint8_t(in[4]) != DZ_VERSION) {
+    return false;
+  }
+  uint32_t len       = readBE4U(const_cast<char*>(&in[8]));
+  uint32_t dict_size = readBE4U(const_cast<char*>(&in[12]));
+  if (len > kMaxSize || dict_size < LZMA_DICT_SIZE_MIN || dict_size > kMaxSize) {
+    return false;
+  }
+  std::string digest(in + 16,PICOHASH_MD5_DIGEST_LENGTH);
+  auto it = dictRegistry().find(digest);
+  if (it == dictRegistry().end()) {
+    FAIL("Replay was compressed with preset dictionary "
+      << md5tostring(reinterpret_cast<unsigned char*>(&digest[0])) << "; load it with --dict");
+    return false;
+  }
+
+  lzma_options_lzma opt;
+  lzma_lzma_preset(&opt, 6);
+  opt.dict_size        = dict_size;
+  opt.preset_dict      = reinterpret_cast<const uint8_t*>(it->second.c_str());
+  opt.preset_dict_size = it->second.size();
+  lzma_filter filters[] = {
+    { LZMA_FILTER_LZMA2, &opt },
+    { LZMA_VLI_UNKNOWN,  NULL },
+  };
+  // leave a spare byte of output, or the decoder stops short of the end marker once the output is full
+  out.assign(len + 1,'\0');
+  size_t in_pos = DZ_HEADER_SIZE, out_pos = 0;
+  lzma_ret ret = lzma_raw_buffer_decode(filters, nullptr, reinterpret_cast<const uint8_t*>(in), &in_pos,
+    inlen, reinterpret_cast<uint8_t*>(&out[0]), &out_pos, out.size());
+  if (ret != LZMA_OK || out_pos != len) {
+    out.clear();
+    return false;
+  }
+  out.resize(len);
+  return true;
+}
+
+bool trainLzmaDict(const std::vector<std::string> &files, unsigned jobs, int debug, std::string &dict) {
+  int _debug = debug;
+  std::vector<std::string> samples(files.size());
+  std::vector<std::unique_ptr<Compressor>> cmps(numWorkers(files.size(),jobs));
+  parallelFor(files.size(), jobs, [&](unsigned i, unsigned worker) {
+    DOUT1("Sampling " << files[i]);
+    if (!cmps[worker]) {
+      cmps[worker].reset(new Compressor(_debug));
+    }
+    std::string enc;
+    if (!encodeReplayFile(files[i],_debug,enc,nullptr,nullptr,cmps[worker].get())) {
+      WARN("Could not encode " << files[i] << "; skipping");
+      return;
+    }
+    enc.resize(std::min(size_t(DICT_SAMPLE),enc.size()));
+    samples[i].swap(enc);
+  });
+
+  // drop failed and duplicate samples (e.g., the same replay stored in multiple forms)
+  std::vector<const std::string*> kept;
+  std::set<std::string> seen;
+  for (const std::string &sample : samples) {
+    if (!sample.empty() && seen.insert(sample).second) {
+      kept.push_back(&sample);
+    }
+  }
+  if (kept.empty()) {
+    return false;
+  }
+
+  // with more samples than fit, spread the ones we keep evenly over the corpus
+  size_t n = std::min(kept.size(),size_t(DICT_MAX_SIZE / DICT_SAMPLE));
+  dict.clear();
+  for (size_t k = 0; k < n; ++k) {
+    dict.append(*kept[k * kept.size() / n]);
+  }
+  return true;
+}
+
+}
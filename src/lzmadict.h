@@ -0,0 +1,52 @@
+#ifndef LZMADICT_H_
+#define LZMADICT_H_
+
+#include <string>
+#include <vector>
+
+#include "util.h"
+
+// Dictionary-primed (.zlp) file layout (integers big-endian, like the rest of the replay format):
+//   magic "SLDZ", version (1 byte), 3 reserved bytes
+//   size of the encoded replay (4 bytes)
+//   LZMA2 dictionary size used by the encoder (4 bytes)
+//   MD5 of the preset dictionary (16 bytes)
+//   raw LZMA2 stream (no .xz container) of the encoded replay, primed with the preset dictionary
+// The dictionary itself isn't stored; decoders look it up by its MD5 among the dictionaries
+//   registered with registerLzmaDict()
+const uint32_t DZ_HEADER      = BYTE4(0x53,0x4c,0x44,0x5a); // SLDZ
+const uint8_t  DZ_VERSION     = 1;   //Bump whenever the layout changes
+const unsigned DZ_HEADER_SIZE = 32;  //Bytes before the LZMA2 stream
+const unsigned DICT_SAMPLE    = 32 << 10;  //Bytes taken from the start of each training replay
+const unsigned DICT_MAX_SIZE  = 1 << 20;   //Largest dictionary we'll train
+
+namespace slip {
+
+//Check whether a buffer holds a dictionary-primed LZMA replay
+inline bool isDictCoded(const char* buf, size_t len) {
+  return len >= 4 && same4(const_cast<char*>(buf),DZ_HEADER);
+}
+
+//Get the hex MD5 identifying a preset dictionary
+std::string lzmaDictHash(const std::string &dict);
+//Make a preset dictionary available to decompressWithDict(), returning a pointer to the registered copy
+//  (stable for the life of the program, so it can be stored in LzmaOptions)
+//  Not thread-safe; register dictionaries before compressing or decompressing on worker threads
+const std::string* registerLzmaDict(const std::string &dict);
+//Read a preset dictionary from a file and register it; returns nullptr if the file can't be read
+const std::string* loadLzmaDict(const char* fname);
+
+//Compress a buffer into a raw LZMA2 stream primed with the preset dictionary in o.dict
+//  (o.threads and o.block_size are ignored); returns false if encoding fails
+bool compressWithDict(const char* in, size_t inlen, const LzmaOptions &o, std::string &out);
+//Decompress a buffer produced by compressWithDict(); returns false if the buffer is malformed
+//  or its dictionary hasn't been registered
+bool decompressWithDict(const char* in, size_t inlen, std::string &out);
+
+//Build a preset dictionary from the starts of a corpus of replays (any supported form), encoding
+//  them on up to jobs threads; returns false if no replay could be encoded
+bool trainLzmaDict(const std::vector<std::string> &files, unsigned jobs, int debug, std::string &dict);
+
+}
+
+#endif /* LZMADICT_H_ */
@@ -0,0 +1,53 @@
+#include "lzmatune.h"
+
+namespace slip {
+
+const std::vector<LzmaChain> &lzmaTuneChains() {
+  static const std::vector<LzmaChain> chains = {
+    {"lc3-lp0-pb2", LZMA_LC_DEFAULT, LZMA_LP_DEFAULT, LZMA_PB_DEFAULT},
+    {"lc0-lp2-pb2", 0, 2, 2},
+    {"lc2-lp2-pb2", 2, 2, 2},
+    {"lc0-lp3-pb3", 0, 3, 3},
+    {"lc0-lp1-pb1", 0, 1, 1},
+    {"lc3-lp0-pb0", 3, 0, 0},
+  };
+  return chains;
+}
+
+int compressWithLzmaTuned(const char* in, size_t inlen, const LzmaOptions &o, std::string &out,
+  std::vector<size_t>* sizes) {
+  const std::vector<LzmaChain> &chains = lzmaTuneChains();
+  std::vector<std::string> comp(chains.size());
+  std::vector<uint8_t>     ok(chains.size(),0);  //Not vector<bool>, which workers can't write to concurrently
+  parallelFor(chains.size(), o.threads, [&](unsigned i, unsigned) {
+    LzmaOptions opt = o;
+    opt.threads     = 1;
+    opt.lc          = chains[i].lc;
+    opt.lp          = chains[i].lp;
+    opt.pb          = chains[i].pb;
+    ok[i] = compressWithLzmaStream(in, inlen, opt, [&comp,i](const char* chunk, size_t len) {
+      comp[i].append(chunk, len);
+      return true;
+    });
+  });
+
+  int best = -1;
+  if (sizes) {
+    sizes->assign(chains.size(),0);
+  }
+  for (unsigned i = 0; i < chains.size(); ++i) {
+    if (!ok[i]) {
+      return -1;
+    }
+    if (sizes) {
+      (*sizes)[i] = comp[i].size();
+    }
+    if (best < 0 || comp[i].size() < comp[best].size()) {
+      best = i;
+    }
+  }
+  out.swap(comp[best]);
+  return best;
+}
+
+}
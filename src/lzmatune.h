@@ -0,0 +1,32 @@
+#ifndef LZMATUNE_H_
+#define LZMATUNE_H_
+
+#include <string>
+#include <vector>
+
+#include "util.h"
+
+namespace slip {
+
+//LZMA2 literal / position settings tried when tuning compression for a replay
+struct LzmaChain {
+  const char* name;  //Short name for reports
+  int         lc;    //Literal context bits
+  int         lp;    //Literal position bits
+  int         pb;    //Position bits
+};
+
+//Candidates in the order they're tried; the first is the preset's own settings, and the rest favor
+//  the 2- and 4-byte-aligned columns left by column shuffling (ties go to the earlier candidate)
+const std::vector<LzmaChain> &lzmaTuneChains();
+
+//Compress a buffer into an in-memory .xz stream with every candidate in lzmaTuneChains() (compressing
+//  up to o.threads candidates at once, each single-threaded) and keep the smallest
+//  If sizes is non-null, the compressed size with each candidate is written to it
+//  Returns the index of the winning candidate, or -1 if encoding fails
+int compressWithLzmaTuned(const char* in, size_t inlen, const LzmaOptions &o, std::string &out,
+  std::vector<size_t>* sizes = nullptr);
+
+}
+
+#endif /* LZMATUNE_H_ */
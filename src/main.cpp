@@ -1,11 +1,18 @@
 #include <algorithm>
 #include <sys/stat.h>
 #include <filesystem>
+#include <unordered_map>
+#include <map>
 
 #include "util.h"
 #include "parser.h"
 #include "analyzer.h"
+#include "aggregate.h"
+#include "catalog.h"
+#include "archive.h"
+#include "benchmark.h"
 #include "compressor.h"
+#include "lzmadict.h"
 
 // #define GUI_ENABLED 1  //debug, normally enable this from the makefile
 
@@ -13,8 +20,14 @@
   #include "portable-file-dialogs.h"
 #endif
 
-typedef std::filesystem::directory_iterator            f_iter;
-typedef std::filesystem::directory_entry               f_entry;
+#ifdef __linux__
+  #include <csignal>
+  #include <poll.h>
+  #include <unistd.h>
+  #include <sys/inotify.h>
+  #include <sys/resource.h>
+#endif
+
 typedef std::vector<std::__cxx11::basic_string<char> > str_vec;
 
 namespace slip {
@@ -48,8 +61,68 @@ void printUsage() {
     << "  -j        Output <infile> in .json format to <jsonfile> (use \"-\" for stdout)" << std::endl
     << "  -a        Output an analysis of <infile> in .json format to <analysisfile> (use \"-\" for stdout)" << std::endl
     << "  -f        When used with -j <jsonfile>, write full frame info (instead of just frame deltas)" << std::endl
+    << "  --peek    Output only the settings, players, results, and metadata of <infile> in .json format to" << std::endl
+    << "            <jsonfile> (default: stdout), reading .zlp files without decompressing them" << std::endl
+    << "  --aggregate <aggfile>" << std::endl
+    << "            Output per-player and per-character stats summed over all analyzed inputs to <aggfile>" << std::endl
     << "  -x        Compress or decompress a replay" << std::endl
     << "  -X        Set output file name for compression" << std::endl
+    << "  --peekable" << std::endl
+    << "            When compressing, also store a small compressed summary for --peek at the start of the .zlp" << std::endl
+    << "            (such files can't be read by versions of slippc older than this one)" << std::endl
+    << "  --verify  After compressing or decompressing, re-read the output file and check it against the validated replay" << std::endl
+    << "  --level L Compress with LZMA preset L (0-9, optionally followed by e for extreme; default: 6)" << std::endl
+    << "  --experimental-cm" << std::endl
+    << "            Compress with the experimental column model coder instead of LZMA (smaller, but about 100x" << std::endl
+    << "            slower to decompress; output may not be readable by other versions of slippc)" << std::endl
+    << "  --lzma-threads N" << std::endl
+    << "            Compress with N LZMA threads (default: 1; 0 = one per CPU core)" << std::endl
+    << "  --lzma-block MB" << std::endl
+    << "            With --lzma-threads, compress each MB megabytes independently (default: split evenly)" << std::endl
+    << "  --tune    Compress with several LZMA literal / position settings and keep the smallest output" << std::endl
+    << "            (with --lzma-threads N, N settings are tried at once)" << std::endl
+    << "  --dict D  Prime LZMA with the preset dictionary in file D when compressing, and use it to decompress" << std::endl
+    << "            .zlp files compressed with it" << std::endl
+    << "  --seekable N" << std::endl
+    << "            Compress a .slp into independently decodable windows of N frames (default: " << SEEK_WINDOW << ")" << std::endl
+    << "  --frames A:B" << std::endl
+    << "            When decompressing a seekable .zlp, only decode frames A through B" << std::endl
+    << "  --upgrade Re-encode every .zlp in <infile> made by an older compressor version in place" << std::endl
+    << "            (compressed with the options above; each file is verified before it is replaced)" << std::endl
+    << std::endl
+    << "Dictionary options:" << std::endl
+    << "  --train-dict <dict>  Build a preset dictionary for --dict from the replays in <infile>" << std::endl
+    << std::endl
+    << "Catalog options:" << std::endl
+    << "  --index <catalog>  Add all new or changed replays in <infile> to a summary catalog" << std::endl
+    << "  --query <catalog>  List all replays in a catalog matching the filters below" << std::endl
+    << "    --char A[,B...]  Match games where each listed character is played (e.g., FOX,MARTH)" << std::endl
+    << "    --stage S        Match games played on stage S (e.g., BATTLE)" << std::endl
+    << "    --code C         Match games where one player has connect code C" << std::endl
+    << "    --tag T          Match games where one player has display tag T" << std::endl
+    << std::endl
+    << "Archive options:" << std::endl
+    << "  --archive <archive>  Pack <infile> (a replay or a directory of replays) into a single solid archive" << std::endl
+    << "    --block-size N     Compress replays together in blocks of N (default: " << ARCHIVE_BLOCK_SIZE << ")" << std::endl
+    << "  --list <archive>     List the replays in an archive (without decompressing it)" << std::endl
+    << "  --extract <archive>  Extract all replays from an archive to the directory given by -X (default: .)" << std::endl
+    << "    --entry <name>     Extract only the named replay (only its block is decompressed)" << std::endl
+    << std::endl
+    << "Watch mode options (Linux only):" << std::endl
+    << "  --watch <dir>  Compress (and analyze with -a) every new .slp written to <dir> until interrupted" << std::endl
+    << "                 -X and -a name output directories (default -X: next to each replay); -r watches subdirectories" << std::endl
+    << std::endl
+    << "Directory mode options (when <infile> is a directory):" << std::endl
+    << "  -r        Recurse into subdirectories (output keeps the same folder layout)" << std::endl
+    << "  --jobs N  Process N replays in parallel (default: 1; 0 = one per CPU core)" << std::endl
+    << "  --dedup   Report replays containing the same game (.slp or .zlp) and only process the first" << std::endl
+    << "  --hardlink  Same as --dedup, but also replace byte-identical duplicates with hard links" << std::endl
+    << std::endl
+    << "Benchmark options:" << std::endl
+    << "  --bench-compress <dir>  Report ratio and LZMA speed of every preset (or only --level) over the replays in <dir>" << std::endl
+    << "    --seekable N          Also report the size cost of seekable .zlp files with N-frame windows" << std::endl
+    << "    --tune                Also report which LZMA settings --tune picks for each Slippi version" << std::endl
+    << "    --dict D              Also report the size saved by priming LZMA with preset dictionary D" << std::endl
     << std::endl
     << "Debug options:" << std::endl
     << "  -d           Run at debug level <debuglevel> (show debug output)" << std::endl
@@ -66,12 +139,37 @@ typedef struct _cmdoptions {
   char* cfile        = nullptr;
   char* outfile      = nullptr;
   char* analysisfile = nullptr;
+  char* aggregatefile = nullptr;
+  char* indexfile    = nullptr;
+  char* queryfile    = nullptr;
+  char* watchdir     = nullptr;
+  char* archivefile  = nullptr;
+  char* listfile     = nullptr;
+  char* extractfile  = nullptr;
+  char* entry        = nullptr;
+  char* level        = nullptr;
+  char* benchdir     = nullptr;
+  char* dictfile     = nullptr;   //Preset dictionary to compress / decompress with
+  char* traindict    = nullptr;   //Where to write a newly trained preset dictionary
   bool  nodelta      = false;
   bool  encode       = false;
   bool  rawencode    = false;
   bool  skipsave     = false;
+  bool  verify       = false;
   bool  dumpgecko    = false;
   bool  dirmode      = false;
+  bool  recursive    = false;
+  bool  dedup        = false;
+  bool  hardlink     = false;
+  unsigned jobs      = 1;
+  unsigned blocksize = ARCHIVE_BLOCK_SIZE;
+  LzmaOptions lzma;
+  bool  columncoder  = false;
+  unsigned seekwindow = 0;        //Frames per window for seekable output (0 = not seekable)
+  char* frames       = nullptr;   //Frame range to decode from a seekable .zlp
+  bool  peek         = false;     //Only read the summary of a replay (no frame data)
+  bool  peekable     = false;     //Write a summary for --peek before each compressed replay
+  bool  upgrade      = false;     //Re-encode .zlp files from older compressor versions in place
   int   debug        = 0;
 } cmdoptions;
 
@@ -82,12 +180,105 @@ cmdoptions getCommandLineOptions(int argc, char** argv) {
   c.cfile        = getCmdOption(   argv, argv+argc, "-X");
   c.outfile      = getCmdOption(   argv, argv+argc, "-j");
   c.analysisfile = getCmdOption(   argv, argv+argc, "-a");
+  c.aggregatefile = getCmdOption(  argv, argv+argc, "--aggregate");
+  c.indexfile    = getCmdOption(   argv, argv+argc, "--index");
+  c.queryfile    = getCmdOption(   argv, argv+argc, "--query");
+  c.watchdir     = getCmdOption(   argv, argv+argc, "--watch");
+  c.archivefile  = getCmdOption(   argv, argv+argc, "--archive");
+  c.listfile     = getCmdOption(   argv, argv+argc, "--list");
+  c.extractfile  = getCmdOption(   argv, argv+argc, "--extract");
+  c.entry        = getCmdOption(   argv, argv+argc, "--entry");
+  c.level        = getCmdOption(   argv, argv+argc, "--level");
+  c.benchdir     = getCmdOption(   argv, argv+argc, "--bench-compress");
+  c.dictfile     = getCmdOption(   argv, argv+argc, "--dict");
+  c.traindict    = getCmdOption(   argv, argv+argc, "--train-dict");
   c.nodelta      = cmdOptionExists(argv, argv+argc, "-f");
   c.encode       = cmdOptionExists(argv, argv+argc, "-x");
   c.rawencode    = cmdOptionExists(argv, argv+argc, "--raw-enc");
   c.skipsave     = cmdOptionExists(argv, argv+argc, "--skip-save");
+  c.verify       = cmdOptionExists(argv, argv+argc, "--verify");
   c.dumpgecko    = cmdOptionExists(argv, argv+argc, "--dump-gecko");
+  c.peek         = cmdOptionExists(argv, argv+argc, "--peek");
+  c.peekable     = cmdOptionExists(argv, argv+argc, "--peekable");
+  c.lzma.tune    = cmdOptionExists(argv, argv+argc, "--tune");
+  c.upgrade      = cmdOptionExists(argv, argv+argc, "--upgrade");
   c.dirmode      = isDirectory(c.infile);
+  c.recursive    = cmdOptionExists(argv, argv+argc, "-r");
+  c.hardlink     = cmdOptionExists(argv, argv+argc, "--hardlink");
+  c.dedup        = cmdOptionExists(argv, argv+argc, "--dedup") || c.hardlink;
+
+  char* jobs     = getCmdOption(   argv, argv+argc, "--jobs");
+  if (jobs) {
+    if (jobs[0] >= '0' && jobs[0] <= '9') {
+      c.jobs = atoi(jobs);
+    } else {
+      std::cerr << "Warning: invalid number of jobs" << std::endl;
+    }
+  }
+
+  if (c.level && !parseLzmaLevel(c.level,c.lzma.preset)) {
+    std::cerr << "Warning: invalid compression level (expected 0-9, optionally followed by e)" << std::endl;
+    c.level = nullptr;
+  }
+
+  c.columncoder  = cmdOptionExists(argv, argv+argc, "--experimental-cm");
+  if (c.columncoder) {
+    std::cerr << "Warning: --experimental-cm output can only be read by this version of slippc" << std::endl;
+  }
+
+  c.frames       = getCmdOption(   argv, argv+argc, "--frames");
+  if (cmdOptionExists(argv, argv+argc, "--seekable")) {
+    char* seek = getCmdOption(     argv, argv+argc, "--seekable");
+    c.seekwindow = SEEK_WINDOW;
+    if (seek && seek[0] >= '1' && seek[0] <= '9') {
+      c.seekwindow = atoi(seek);
+    } else if (seek && seek[0] != '-') {
+      std::cerr << "Warning: invalid seekable window size" << std::endl;
+    }
+  }
+
+  char* lzthreads = getCmdOption(  argv, argv+argc, "--lzma-threads");
+  if (lzthreads) {
+    if (lzthreads[0] >= '0' && lzthreads[0] <= '9') {
+      c.lzma.threads = atoi(lzthreads);
+    } else {
+      std::cerr << "Warning: invalid number of LZMA threads" << std::endl;
+    }
+  }
+
+  char* lzblock = getCmdOption(    argv, argv+argc, "--lzma-block");
+  if (lzblock) {
+    if (lzblock[0] >= '1' && lzblock[0] <= '9') {
+      c.lzma.block_size = uint64_t(atoi(lzblock)) << 20;
+    } else {
+      std::cerr << "Warning: invalid LZMA block size" << std::endl;
+    }
+  }
+
+  if (c.lzma.tune && c.columncoder) {
+    std::cerr << "Warning: --tune has no effect with --experimental-cm" << std::endl;
+  }
+  if (c.dictfile) {
+    // registering the dictionary also lets every decoder find it by the hash in a .zlp's header
+    c.lzma.dict = slip::loadLzmaDict(c.dictfile);
+    if (c.lzma.dict && c.columncoder) {
+      std::cerr << "Warning: --dict has no effect with --experimental-cm" << std::endl;
+    } else if (c.lzma.dict && c.lzma.threads != 1) {
+      std::cerr << "Warning: --dict compresses single-threaded; ignoring --lzma-threads" << std::endl;
+    }
+    if (c.lzma.dict && c.lzma.tune) {
+      std::cerr << "Warning: --tune has no effect with --dict" << std::endl;
+    }
+  }
+
+  char* blocksize = getCmdOption(  argv, argv+argc, "--block-size");
+  if (blocksize) {
+    if (blocksize[0] >= '1' && blocksize[0] <= '9') {
+      c.blocksize = atoi(blocksize);
+    } else {
+      std::cerr << "Warning: invalid block size" << std::endl;
+    }
+  }
 
   if (c.dlevel) {
     if (c.dlevel[0] >= '0' && c.dlevel[0] <= '9') {
@@ -165,8 +356,103 @@ inline void cleanupCommandOptions(cmdoptions &c) {
   }
 }
 
-int handleCompression(const cmdoptions &c, const int debug) {
-  slip::Compressor cmp(debug);
+// read a whole file into buf
+bool readWholeFile(const char* fname, std::string &buf) {
+  std::ifstream f(fname, std::ios::binary | std::ios::in);
+  if (f.fail()) {
+    return false;
+  }
+  buf.assign((std::istreambuf_iterator<char>(f)),std::istreambuf_iterator<char>());
+  return true;
+}
+
+// create a seekable .zlp from a raw replay, or decode (part of) an existing one
+int handleSeekable(const cmdoptions &c, const int debug, const std::string &buf) {
+  if (isSeekableReplay(buf.c_str(),buf.size())) {
+    slip::SeekableReplay s(debug);
+    if (!s.open(c.infile)) {
+      return 2;
+    }
+    int32_t first = INT32_MIN, last = INT32_MAX;
+    if (c.frames && sscanf(c.frames,"%d:%d",&first,&last) != 2) {
+      FAIL("  Invalid frame range " << c.frames << " (expected A:B)");
+      return 2;
+    }
+    std::string slp;
+    if (!s.decodeFrames(first,last,slp)) {
+      FAIL("  Failed to decode input; exiting");
+      return 3;
+    }
+    std::string outfile = c.cfile ? c.cfile : getFileBase(c.infile) + ".slp";
+    if (!ensureExt(".slp",outfile.c_str())) {
+      FAIL("  File " << outfile << " does not have required extension .slp");
+      return 4;
+    }
+    if (fileExists(outfile)) {
+      FAIL("  File " << outfile << " exists, refusing to overwrite");
+      return 4;
+    }
+    if (!c.skipsave) {
+      std::ofstream f(outfile, std::ios::binary | std::ios::out);
+      f.write(slp.c_str(),slp.size());
+    }
+    return 0;
+  }
+
+  if (c.frames) {
+    FAIL("  --frames needs a seekable .zlp as input");
+    return 2;
+  }
+  if (buf.size() < MIN_REPLAY_LENGTH || !same8(const_cast<char*>(buf.c_str()),SLP_HEADER)
+    || isEncodedReplay(const_cast<char*>(buf.c_str()),buf.size())) {
+    FAIL("  --seekable needs an uncompressed .slp as input");
+    return 2;
+  }
+  std::string outfile = c.cfile ? c.cfile : getFileBase(c.infile) + ".zlp";
+  if (!ensureExt(".zlp",outfile.c_str())) {
+    FAIL("  File " << outfile << " does not have required extension .zlp");
+    return 4;
+  }
+  slip::SeekableReplay s(debug);
+  if (c.skipsave) {
+    std::string out;
+    return slip::SeekableReplay::encode(buf,out,c.seekwindow,c.lzma,debug) ? 0 : 3;
+  }
+  if (!s.create(outfile.c_str(),buf,c.seekwindow,c.lzma)) {
+    FAIL("  Failed to create seekable replay; exiting");
+    return 3;
+  }
+  DOUT1("  Wrote " << s.size() << " windows of " << s.window() << " frames to " << outfile);
+  return 0;
+}
+
+// reuse, if non-null, is reset and used instead of a new Compressor
+int handleCompression(const cmdoptions &c, const int debug, slip::Compressor* reuse = nullptr) {
+  // seekable .zlp files are handled separately, since they can't be loaded by a single Compressor
+  char magic[sizeof(SeekHeader)] = {0};
+  std::ifstream probe(c.infile, std::ios::binary | std::ios::in);
+  probe.read(magic,sizeof(magic));
+  bool seekable = isSeekableReplay(magic,probe.gcount());
+  probe.close();
+  if (seekable || c.seekwindow || c.frames) {
+    std::string buf;
+    if (!readWholeFile(c.infile,buf)) {
+      FAIL("  File " << c.infile << " could not be opened or does not exist");
+      return 2;
+    }
+    return handleSeekable(c,debug,buf);
+  }
+
+  std::unique_ptr<slip::Compressor> own;
+  if (reuse == nullptr) {
+    own.reset(new slip::Compressor(debug));
+    reuse = own.get();
+  }
+  slip::Compressor &cmp = *reuse;
+  cmp.reset();
+  cmp.setLzmaOptions(c.lzma);
+  cmp.setColumnCoder(c.columncoder);
+  cmp.setPeekable(c.peekable);
 
   if (c.cfile) {
     if (!(cmp.setOutputFilename(c.cfile))) {
@@ -197,16 +483,29 @@ int handleCompression(const cmdoptions &c, const int debug) {
   } else {
     DOUT1("  Saving encoded / decoded replay");
     cmp.saveToFile(c.rawencode);
+    if (c.verify) {
+      DOUT1("  Verifying saved replay");
+      if (!cmp.verifySavedFile()) {
+        FAIL("  Verification of saved file failed; removing it");
+        remove(cmp.outputFilename());
+        return 5;
+      }
+    }
   }
 
   return 0;
 }
 
-int handleAnalysis(const cmdoptions &c, const int debug, slip::Parser &p) {
+int handleAnalysis(const cmdoptions &c, const int debug, slip::Parser &p, slip::Aggregate *agg) {
   DOUT1(" Analyzing");
   slip::Analysis *a  = p.analyze();
 
-  if (a->success) {
+  if (agg) {
+    DOUT1("  Adding analysis to aggregate");
+    agg->add(*a);
+  }
+
+  if (a->success && c.analysisfile) {
     if (c.analysisfile[0] == '-' && c.analysisfile[1] == '\0') {
       if (debug) {
         DOUT1("  Writing analysis to stdout");
@@ -240,12 +539,36 @@ int handleJson(const cmdoptions &c, const int debug, slip::Parser &p) {
   return 0;
 }
 
-int handleSingleFile(const cmdoptions &c, const int debug) {
+int handlePeek(const cmdoptions &c, const int debug) {
+  DOUT1(" Peeking");
+  slip::Parser p(debug);
+  if (not p.peek(c.infile)) {
+    FAIL("    Could not load input; exiting");
+    return 2;
+  }
+  if (c.outfile) {
+    return handleJson(c,debug,p);
+  }
+  std::cout << p.asJson(!c.nodelta) << std::endl;
+  return 0;
+}
+
+void saveAggregate(const cmdoptions &c, const slip::Aggregate &agg) {
+  if (c.aggregatefile[0] == '-' && c.aggregatefile[1] == '\0') {
+    std::cout << agg.asJson() << std::endl;
+  } else {
+    INFO("Writing aggregate of " << agg.games() << " games to " << c.aggregatefile);
+    agg.save(c.aggregatefile);
+  }
+}
+
+int handleSingleFile(const cmdoptions &c, const int debug, slip::Aggregate *agg = nullptr,
+  slip::Compressor* cmp = nullptr) {
   int retc = 0;  //return value from compression phase
   int reta = 0;  //return value from analysis phase
   int retj = 0;  //return value from jsonoutput phase
 
-  if (c.outfile || c.analysisfile) {
+  if (c.outfile || c.analysisfile || agg) {
     DOUT1(" Parsing");
     slip::Parser p(debug);
     if (not p.load(c.infile)) {
@@ -257,14 +580,14 @@ int handleSingleFile(const cmdoptions &c, const int debug) {
       retj = handleJson(c,debug,p);
     }
 
-    if (c.analysisfile) {
-      reta = handleAnalysis(c,debug,p);
+    if (c.analysisfile || agg) {
+      reta = handleAnalysis(c,debug,p,agg);
     }
   }
 
   if (c.cfile || c.encode || c.skipsave) {
     DOUT1(" Compressing ");
-    retc = handleCompression(c,debug);
+    retc = handleCompression(c,debug,cmp);
     if ((!c.skipsave) && c.dirmode && c.cfile && (!fileExists(c.cfile))) {
       FAIL("  Failed to compress file, logging error");
       ERRLOG(PATH(c.cfile).parent_path(),c.infile << " could not be compressed");
@@ -277,10 +600,70 @@ int handleSingleFile(const cmdoptions &c, const int debug) {
   return retc+reta+retj;
 }
 
+// replace a duplicate replay with a hard link to the original if the two files are byte-identical
+bool hardlinkDuplicate(const std::string &orig, const std::string &dupe) {
+  std::error_code ec;
+  if (std::filesystem::equivalent(orig,dupe,ec)) {
+    return false;  //already linked
+  }
+  if (!filesIdentical(orig,dupe)) {
+    DOUT1("  " << dupe << " is not byte-identical to " << orig << "; not linking");
+    return false;
+  }
+  // link to a temporary name first so the duplicate is never missing if linking fails
+  std::string tmp = dupe + ".tmp";
+  std::filesystem::create_hard_link(orig,tmp,ec);
+  if (ec) {
+    WARN("  Could not link " << dupe << " to " << orig << ": " << ec.message());
+    return false;
+  }
+  std::filesystem::rename(tmp,dupe,ec);
+  if (ec) {
+    WARN("  Could not replace " << dupe << " with a link: " << ec.message());
+    remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+// fingerprint all replays and flag every replay whose game was already seen earlier in the list
+std::vector<bool> findDuplicates(const cmdoptions &c, const std::vector<std::string> &files) {
+  std::vector<std::string> prints(files.size());
+  parallelFor(files.size(),c.jobs,[&](unsigned i, unsigned worker) {
+    prints[i] = slip::replayFingerprint(files[i].c_str());
+  });
+
+  std::vector<bool> dupe(files.size(),false);
+  std::unordered_map<std::string,unsigned> first;
+  unsigned ndupes  = 0;
+  unsigned nlinked = 0;
+  for (unsigned i = 0; i < files.size(); ++i) {
+    if (prints[i].empty()) {
+      WARN("Could not fingerprint " << files[i]);
+      continue;
+    }
+    auto it = first.find(prints[i]);
+    if (it == first.end()) {
+      first[prints[i]] = i;
+      continue;
+    }
+    dupe[i] = true;
+    ++ndupes;
+    INFO(CYN << files[i] << BLN << " is a duplicate of " << CYN << files[it->second] << BLN);
+    if (c.hardlink && hardlinkDuplicate(files[it->second],files[i])) {
+      ++nlinked;
+    }
+  }
+  INFO("Found " << ndupes << " duplicate replays among " << files.size() << " files"
+    << (c.hardlink ? (" (" + std::to_string(nlinked) + " replaced with hard links)") : ""));
+  return dupe;
+}
+
 int handleDirectory(const cmdoptions &c, const int debug) {
+  bool has_output = (c.cfile || c.outfile || c.analysisfile || c.aggregatefile);
   // verify all of our input and output directories are valid (not files + proper write permissions)
-  if (!(c.cfile || c.outfile || c.analysisfile)) {
-    FAIL("No output directories specified with -j, -a, or -X");
+  if (!(has_output || c.dedup)) {
+    FAIL("No output directories specified with -j, -a, or -X (and no --aggregate file)");
     return -2;
   }
   if (c.outfile && (!makeDirectoryIfNotExists(c.outfile))) {
@@ -296,36 +679,449 @@ int handleDirectory(const cmdoptions &c, const int debug) {
     return -2;
   }
 
-  // find all slippi files in a directory
-  for (const f_entry & entry : f_iter(std::string(c.infile))) {
-    std::string base  = entry.path().filename();
-    std::string noext = entry.path().stem();
-    if (getFileExt(base).compare("slp") == 0) {
-      cmdoptions c2;
-      copyCommandOptions(c,c2);
-      stringtoChars((entry.path()).string(),&(c2.infile));
-      if(c2.cfile) {
-        stringtoChars((PATH(c.cfile) / PATH(noext+".zlp")).string(),&(c2.cfile));
+  // find all slippi files (compressed or not) in a directory
+  PATH inroot(c.infile);
+  std::vector<std::string> files = listReplayFiles(c.infile,c.recursive);
+  if (files.size() == 0) {
+    WARN("No .slp or .zlp files found in " << c.infile);
+    return 0;
+  }
+
+  // find duplicate games up front so they are only processed once
+  std::vector<bool> skip(files.size(),false);
+  if (c.dedup) {
+    skip = findDuplicates(c,files);
+  }
+  if (!has_output) {
+    return 0;
+  }
+
+  // mirror the input directory layout in each output directory up front, so workers never race on mkdir
+  if (c.recursive) {
+    for (std::string &f : files) {
+      PATH rel = PATH(f).lexically_relative(inroot).parent_path();
+      if (rel.empty()) {
+        continue;
+      }
+      if (c.cfile)        { makeDirectoryIfNotExists((PATH(c.cfile)        / rel).string().c_str()); }
+      if (c.outfile)      { makeDirectoryIfNotExists((PATH(c.outfile)      / rel).string().c_str()); }
+      if (c.analysisfile) { makeDirectoryIfNotExists((PATH(c.analysisfile) / rel).string().c_str()); }
+    }
+  }
+
+  // each worker accumulates its own partial aggregate, merged once all files are done
+  std::vector<slip::Aggregate> partials(c.aggregatefile ? numWorkers(files.size(),c.jobs) : 0);
+  // likewise, each worker reuses one Compressor for all of its files
+  std::vector<std::unique_ptr<slip::Compressor>> cmps(numWorkers(files.size(),c.jobs));
+
+  std::atomic<unsigned> nerrors(0);
+  parallelFor(files.size(),c.jobs,[&](unsigned i, unsigned worker) {
+    if (skip[i]) {
+      return;
+    }
+    PATH inpath(files[i]);
+    PATH rel          = inpath.lexically_relative(inroot).parent_path();
+    std::string base  = inpath.filename().string();
+    std::string noext = inpath.stem().string();
+    // .slp files get compressed, .zlp files get decompressed
+    std::string cext  = (getFileExt(base).compare("slp") == 0) ? ".zlp" : ".slp";
+
+    cmdoptions c2;
+    copyCommandOptions(c,c2);
+    stringtoChars(inpath.string(),&(c2.infile));
+    if(c2.cfile) {
+      stringtoChars((PATH(c.cfile) / rel / PATH(noext+cext)).string(),&(c2.cfile));
+    }
+    if(c2.outfile) {
+      stringtoChars((PATH(c.outfile) / rel / PATH(base+".json")).string(),&(c2.outfile));
+    }
+    if(c2.analysisfile) {
+      stringtoChars((PATH(c.analysisfile) / rel / PATH(noext+"-analysis.json")).string(),&(c2.analysisfile));
+    }
+    INFO("Processing file " << CYN << c2.infile << BLN);
+    if (!cmps[worker]) {
+      cmps[worker].reset(new slip::Compressor(debug));
+    }
+    int ret = handleSingleFile(c2,debug,c.aggregatefile ? &partials[worker] : nullptr,cmps[worker].get());
+    if (ret != 0) {
+      WARN("  Encountered errors processing input file " << RED << c2.infile << BLN);
+      ++nerrors;
+    }
+    cleanupCommandOptions(c2);
+  });
+
+  if (nerrors > 0) {
+    WARN("Encountered errors processing " << nerrors << " of " << files.size() << " files");
+  }
+
+  if (c.aggregatefile) {
+    slip::Aggregate agg;
+    for (slip::Aggregate &part : partials) {
+      agg.merge(part);
+    }
+    saveAggregate(c,agg);
+  }
+  return 0;
+}
+
+int handleTrainDict(const cmdoptions &c, const int debug) {
+  if (fileExists(c.traindict)) {
+    FAIL("File " << c.traindict << " exists, refusing to overwrite");
+    return 2;
+  }
+  std::vector<std::string> files;
+  if (c.dirmode) {
+    files = listReplayFiles(c.infile,c.recursive);
+  } else {
+    files.push_back(c.infile);
+  }
+
+  std::string dict;
+  if (!slip::trainLzmaDict(files,c.jobs,debug,dict)) {
+    FAIL("Could not encode any replays in " << c.infile);
+    return 2;
+  }
+  std::ofstream f(c.traindict, std::ios::binary | std::ios::out);
+  f.write(dict.c_str(),dict.size());
+  f.close();
+  if (f.fail()) {
+    FAIL("Failed to write " << c.traindict);
+    return 2;
+  }
+  INFO("Trained " << dict.size() << "-byte preset dictionary " << slip::lzmaDictHash(dict)
+    << " from " << files.size() << " replays");
+  return 0;
+}
+
+int handleUpgrade(const cmdoptions &c, const int debug) {
+  std::vector<std::string> files;
+  if (c.dirmode) {
+    files = listReplayFiles(c.infile,c.recursive);
+  } else {
+    files.push_back(c.infile);
+  }
+
+  // each worker reuses one Compressor, set up with the compression options, for all of its files
+  std::vector<std::unique_ptr<slip::Compressor>> cmps(numWorkers(files.size(),c.jobs));
+  std::atomic<unsigned> nupgraded(0);
+  std::atomic<unsigned> nerrors(0);
+  parallelFor(files.size(),c.jobs,[&](unsigned i, unsigned worker) {
+    if (getFileExt(files[i]).compare("zlp") != 0) {
+      return;
+    }
+    if (!cmps[worker]) {
+      cmps[worker].reset(new slip::Compressor(debug));
+      cmps[worker]->setLzmaOptions(c.lzma);
+      cmps[worker]->setColumnCoder(c.columncoder);
+      cmps[worker]->setPeekable(c.peekable);
+    }
+    bool upgraded = false;
+    if (!slip::upgradeReplayFile(files[i],debug,upgraded,cmps[worker].get())) {
+      WARN("  Could not upgrade " << RED << files[i] << BLN);
+      ++nerrors;
+    } else if (upgraded) {
+      INFO("Upgraded " << CYN << files[i] << BLN);
+      ++nupgraded;
+    }
+  });
+
+  INFO("Upgraded " << nupgraded << " of " << files.size() << " replays to compressor version "
+    << +COMPRETZ_VERSION);
+  if (nerrors > 0) {
+    WARN("Encountered errors upgrading " << nerrors << " replays");
+    return 2;
+  }
+  return 0;
+}
+
+int handleIndex(const cmdoptions &c, const int debug) {
+  std::vector<std::string> files;
+  if (c.dirmode) {
+    files = listReplayFiles(c.infile,c.recursive);
+  } else {
+    files.push_back(c.infile);
+  }
+
+  slip::Catalog cat(debug);
+  if (fileExists(c.indexfile) && (!cat.load(c.indexfile))) {
+    cat = slip::Catalog(debug);
+  }
+  unsigned before  = cat.size();
+  unsigned indexed = cat.update(files,c.jobs);
+  if (!cat.save(c.indexfile)) {
+    return 2;
+  }
+  INFO("Indexed " << indexed << " new or changed replays; catalog " << c.indexfile
+    << " now has " << cat.size() << " replays (previously " << before << ")");
+  return 0;
+}
+
+int handleQuery(const cmdoptions &c, int argc, char** argv) {
+  slip::CatalogFilter filter;
+  char* chars = getCmdOption(argv, argv+argc, "--char");
+  char* stage = getCmdOption(argv, argv+argc, "--stage");
+  char* code  = getCmdOption(argv, argv+argc, "--code");
+  char* tag   = getCmdOption(argv, argv+argc, "--tag");
+  if (chars && (!filter.parseChars(chars))) {
+    return -1;
+  }
+  if (stage && (!filter.parseStage(stage))) {
+    return -1;
+  }
+  if (code) {
+    filter.code = code;
+  }
+  if (tag) {
+    filter.tag = tag;
+  }
+
+  std::vector<std::string> results;
+  if (!slip::Catalog::query(c.queryfile,filter,results)) {
+    return 2;
+  }
+  for (const std::string &r : results) {
+    std::cout << r << std::endl;
+  }
+  DOUT1(results.size() << " matching replays");
+  return 0;
+}
+
+int handleArchive(const cmdoptions &c, const int debug) {
+  std::vector<std::string> files, names;
+  if (c.dirmode) {
+    files = listReplayFiles(c.infile,c.recursive);
+  } else {
+    files.push_back(c.infile);
+  }
+  // entries are named after their path relative to the input, and always extract as .slp
+  for (const std::string &f : files) {
+    std::filesystem::path rel = c.dirmode
+      ? std::filesystem::relative(f,c.infile)
+      : std::filesystem::path(f).filename();
+    names.push_back(rel.replace_extension(".slp").generic_string());
+  }
+
+  LzmaOptions lzma = slip::archiveLzmaOptions();
+  lzma.threads     = c.lzma.threads;
+  lzma.block_size  = c.lzma.block_size;
+  if (c.level) {
+    lzma.preset    = c.lzma.preset;
+  }
+
+  slip::Archive arc(debug);
+  if (!arc.create(c.archivefile,files,names,c.blocksize,c.jobs,lzma)) {
+    return 2;
+  }
+  INFO("Archived " << arc.size() << " replays in " << arc.blocks() << " blocks to "
+    << c.archivefile << " (" << arc.fileSize() << " bytes)");
+  return (arc.size() == files.size()) ? 0 : 1;
+}
+
+int handleList(const cmdoptions &c) {
+  slip::Archive arc(c.debug);
+  if (!arc.open(c.listfile)) {
+    return 2;
+  }
+  uint64_t raw = 0;
+  for (unsigned i = 0; i < arc.size(); ++i) {
+    const slip::ArchiveEntry &e = arc.entry(i);
+    raw += e.size;
+    std::cout << std::setw(10) << e.size << "  " << std::setw(5) << e.block << "  " << arc.name(i) << std::endl;
+  }
+  std::cout << arc.size() << " replays in " << arc.blocks() << " blocks, " << raw << " bytes uncompressed, "
+    << arc.fileSize() << " bytes archived";
+  if (raw > 0) {
+    std::cout << " (" << std::fixed << std::setprecision(2) << 100.0*arc.fileSize()/raw << "%)";
+  }
+  std::cout << std::endl;
+  return 0;
+}
+
+int handleExtract(const cmdoptions &c) {
+  slip::Archive arc(c.debug);
+  if (!arc.open(c.extractfile)) {
+    return 2;
+  }
+  std::string outdir = c.cfile ? c.cfile : ".";
+  if (c.entry) {
+    int i = arc.find(c.entry);
+    if (i < 0) {
+      FAIL("No replay named " << c.entry << " in archive " << c.extractfile);
+      return 2;
+    }
+    std::string outfile = (std::filesystem::path(outdir) / std::filesystem::path(c.entry).filename()).string();
+    return arc.extract(i,outfile) ? 0 : 2;
+  }
+  unsigned errors = arc.extractAll(outdir,c.jobs);
+  if (errors > 0) {
+    FAIL("Failed to extract " << errors << " of " << arc.size() << " replays");
+    return 2;
+  }
+  return 0;
+}
+
+int handleBenchCompress(const cmdoptions &c) {
+  std::vector<std::string> files;
+  if (isDirectory(c.benchdir)) {
+    files = listReplayFiles(c.benchdir,c.recursive);
+  } else {
+    files.push_back(c.benchdir);
+  }
+  std::vector<uint32_t> presets;
+  if (c.level) {
+    presets.push_back(c.lzma.preset);
+  } else {
+    presets = slip::PresetBenchmark::allPresets();
+  }
+
+  // replays are benchmarked one at a time so the timings aren't skewed by other jobs
+  slip::PresetBenchmark bench(c.debug,presets,c.lzma);
+  bench.setSeekWindow(c.seekwindow);
+  bench.setTune(c.lzma.tune);
+  for (const std::string &f : files) {
+    bench.addFile(f);
+  }
+  std::cout << bench.report();
+  return 0;
+}
+
+#ifdef __linux__
+static volatile sig_atomic_t _stop_watching = 0;
+
+void stopWatching(int signum) {
+  _stop_watching = 1;
+}
+
+// watch a directory (and optionally all of its subdirectories) for finished replays
+void addWatch(int fd, const std::string &dir, bool recursive, std::map<int,std::string> &watches) {
+  int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | (recursive ? IN_CREATE : 0));
+  if (wd < 0) {
+    WARN("Could not watch directory " << dir);
+    return;
+  }
+  watches[wd] = dir;
+  DOUT1("  Watching " << dir);
+  if (recursive) {
+    std::error_code ec;
+    for (const auto & entry : std::filesystem::directory_iterator(dir,ec)) {
+      if (entry.is_directory()) {
+        addWatch(fd,entry.path().string(),recursive,watches);
       }
-      if(c2.outfile) {
-        stringtoChars((PATH(c.outfile) / PATH(base+".json")).string(),&(c2.outfile));
+    }
+  }
+}
+
+// compress / analyze a replay that was just written to the watched directory
+int handleWatchedFile(const cmdoptions &c, const std::string &path, const int debug) {
+  // Slippi only fills in the raw data length once a game ends, so skip replays still being recorded
+  char header[N_HEADER_BYTES];
+  std::ifstream f(path, std::ios::binary | std::ios::in);
+  f.read(header,N_HEADER_BYTES);
+  if (f.gcount() < N_HEADER_BYTES || (!same8(header,SLP_HEADER)) || readBE4U(&header[11]) == 0) {
+    DOUT1("  " << path << " is not a finished replay; skipping");
+    return 0;
+  }
+  f.close();
+
+  PATH inpath(path);
+  PATH rel          = inpath.lexically_relative(PATH(c.watchdir)).parent_path();
+  std::string noext = inpath.stem().string();
+  cmdoptions c2;
+  copyCommandOptions(c,c2);
+  c2.encode  = true;
+  c2.dirmode = true;
+  stringtoChars(path,&(c2.infile));
+  if (c.cfile) {
+    makeDirectoryIfNotExists((PATH(c.cfile) / rel).string().c_str());
+    stringtoChars((PATH(c.cfile) / rel / PATH(noext+".zlp")).string(),&(c2.cfile));
+  } else {
+    stringtoChars((inpath.parent_path() / PATH(noext+".zlp")).string(),&(c2.cfile));
+  }
+  if (c.analysisfile) {
+    makeDirectoryIfNotExists((PATH(c.analysisfile) / rel).string().c_str());
+    stringtoChars((PATH(c.analysisfile) / rel / PATH(noext+"-analysis.json")).string(),&(c2.analysisfile));
+  }
+  c2.outfile = nullptr;
+
+  INFO("Processing file " << CYN << c2.infile << BLN);
+  int ret = handleSingleFile(c2,debug);
+  if (ret != 0) {
+    WARN("  Encountered errors processing input file " << RED << c2.infile << BLN);
+  }
+  cleanupCommandOptions(c2);
+  return ret;
+}
+#endif
+
+int handleWatch(const cmdoptions &c, const int debug) {
+#ifndef __linux__
+  FAIL("--watch is currently only supported on Linux");
+  return -1;
+#else
+  if (!isDirectory(c.watchdir)) {
+    FAIL("Watch directory '" << c.watchdir << "' is not a valid directory");
+    return -2;
+  }
+  if (c.analysisfile && (!makeDirectoryIfNotExists(c.analysisfile))) {
+    FAIL("Analysis output directory '" << c.analysisfile << "' is not a valid directory");
+    return -2;
+  }
+  if (c.cfile && (!makeDirectoryIfNotExists(c.cfile))) {
+    FAIL("Compression output directory '" << c.cfile << "' is not a valid directory");
+    return -2;
+  }
+
+  // run at the lowest priority and one replay at a time so we never compete with Dolphin
+  if (setpriority(PRIO_PROCESS, 0, 19) != 0) {
+    WARN("Could not lower process priority");
+  }
+
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0) {
+    FAIL("Could not initialize inotify");
+    return -2;
+  }
+  std::map<int,std::string> watches;
+  addWatch(fd,c.watchdir,c.recursive,watches);
+  if (watches.empty()) {
+    close(fd);
+    return -2;
+  }
+
+  signal(SIGINT,  stopWatching);
+  signal(SIGTERM, stopWatching);
+  INFO("Watching " << CYN << c.watchdir << BLN << " for new replays (Ctrl+C to stop)");
+
+  alignas(struct inotify_event) char buf[16384];
+  while (!_stop_watching) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if (poll(&pfd,1,1000) <= 0) {
+      continue;  //timed out or interrupted; check whether we should stop
+    }
+    ssize_t len = read(fd,buf,sizeof(buf));
+    for (char* p = buf; len > 0 && p < buf + len; ) {
+      const struct inotify_event* ev = reinterpret_cast<const struct inotify_event*>(p);
+      p += sizeof(struct inotify_event) + ev->len;
+      if (ev->len == 0 || watches.count(ev->wd) == 0) {
+        continue;
       }
-      if(c2.analysisfile) {
-        stringtoChars((PATH(c.analysisfile) / PATH(noext+"-analysis.json")).string(),&(c2.analysisfile));
+      std::string path = (PATH(watches[ev->wd]) / PATH(ev->name)).string();
+      if (ev->mask & IN_ISDIR) {
+        if (c.recursive) {
+          addWatch(fd,path,c.recursive,watches);
+        }
+        continue;
       }
-      // std::cout << "  -i "   << c2.infile << std::endl;
-      // std::cout << "    -X " << c2.cfile << std::endl;
-      // std::cout << "    -j " << c2.outfile << std::endl;
-      // std::cout << "    -a " << c2.analysisfile << std::endl;
-      INFO("Processing file " << CYN << c2.infile << BLN);
-      int ret = handleSingleFile(c2,debug);
-      if (ret != 0) {
-        WARN("  Encountered errors processing input file " << RED << c2.infile << BLN);
+      if ((ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && getFileExt(path).compare("slp") == 0) {
+        handleWatchedFile(c,path,debug);
       }
-      cleanupCommandOptions(c2);
     }
   }
+
+  INFO("Stopped watching " << c.watchdir);
+  close(fd);
   return 0;
+#endif
 }
 
 int run(int argc, char** argv) {
@@ -335,6 +1131,26 @@ int run(int argc, char** argv) {
   }
 
   cmdoptions c = getCommandLineOptions(argc,argv);
+  if (c.dictfile && !c.lzma.dict) {
+    FAIL("Could not read preset dictionary " << c.dictfile);
+    return -1;
+  }
+
+  if (c.queryfile) {  //queries only need the catalog, not an input file
+    return handleQuery(c,argc,argv);
+  }
+  if (c.watchdir) {   //watch mode waits for its own input files
+    return handleWatch(c,c.debug);
+  }
+  if (c.benchdir) {
+    return handleBenchCompress(c);
+  }
+  if (c.listfile) {   //archives carry their own inputs
+    return handleList(c);
+  }
+  if (c.extractfile) {
+    return handleExtract(c);
+  }
 
   #if GUI_ENABLED == 1
     if (not c.infile) { //if we don't have an input file, open file selector
@@ -348,9 +1164,34 @@ int run(int argc, char** argv) {
     return -1;
   }
 
+  if (c.traindict) {
+    return handleTrainDict(c,c.debug);
+  }
+  if (c.upgrade) {
+    return handleUpgrade(c,c.debug);
+  }
+  if (c.indexfile) {
+    return handleIndex(c,c.debug);
+  }
+  if (c.archivefile) {
+    return handleArchive(c,c.debug);
+  }
+  if (c.peek) {
+    if (isDirectory(c.infile)) {
+      FAIL("--peek needs a single replay as input");
+      return -1;
+    }
+    return handlePeek(c,c.debug);
+  }
   if(isDirectory(c.infile)) {
     return handleDirectory(c,c.debug);
   }
+  if (c.aggregatefile) {
+    slip::Aggregate agg;
+    int ret = handleSingleFile(c,c.debug,&agg);
+    saveAggregate(c,agg);
+    return ret;
+  }
   return handleSingleFile(c,c.debug);
 }
 
@@ -8,9 +8,6 @@ namespace slip {
   }
 
   Parser::~Parser() {
-    if (_rb != nullptr) {
-      delete [] _rb;
-    }
     _cleanup();
   }
 
@@ -33,45 +30,84 @@ namespace slip {
     DOUT1("  File Size: " << +_file_size);
     myfile.seekg(0, myfile.beg);
 
-    _rb = new char[_file_size];
-    myfile.read(_rb,_file_size);
+    _rbuf.resize(_file_size);
+    myfile.read(&_rbuf[0],_file_size);
     myfile.close();
 
+    // Each step below replaces the read buffer with its output by moving it, never by copying it
+    // Check if we have a seekable .zlp file, which decodes straight to a raw replay
+    if (isSeekableReplay(_rbuf.c_str(),_rbuf.size())) {
+      DOUT1("  Decoding seekable file");
+      std::string decomp;
+      if (!decodeSeekableFile(replayfilename, decomp)) {
+        FAIL("  File " << replayfilename << " is not a valid seekable replay");
+        return false;
+      }
+      _rbuf.swap(decomp);
+    }
+
     // Check if we have a compressed .zlp file
-    bool is_compressed = same4(&_rb[0],LZMA_HEADER);
-    if (is_compressed) {
+    if (isCompressedReplay(_rbuf.c_str(),_rbuf.size())) {
       DOUT1("  Decompressing file");
-      // Decompress the read buffer
-      std::string decomp = decompressWithLzma(_rb, _file_size);
-      // Get the new file size
-      _file_size    = decomp.size();
-      // Delete the old read buffer
-      delete[] _rb;
-      // Reallocate it with more spce
-      _rb = new char[_file_size];
-      // Copy buffer from the decompressed string
-      memcpy(_rb,decomp.c_str(),_file_size);
-      DOUT1("  Decompressed File Size: " << +_file_size);
+      std::string decomp;
+      if (!decompressReplay(_rbuf.c_str(), _rbuf.size(), decomp)) {
+        FAIL("  File " << replayfilename << " is not a valid compressed replay");
+        return false;
+      }
+      _rbuf.swap(decomp);
+      DOUT1("  Decompressed File Size: " << +_rbuf.size());
     }
 
-    bool status = this->_parse();
-    // if we attempted to parse an encoded replay
-    if (_is_encoded) {
-      DOUT1("  File was encoded, decoding" << +_file_size);
-      // Create a Compressor object
-      Compressor *d  = new slip::Compressor(0);
-      // Decompress the buffer
-      d->loadFromBuff(&_rb,_file_size);
-      // Save it back to the original buffer
-      d->saveToBuff(&_rb);
-      // Unset encoded state
-      _is_encoded = false;
-      // restart the parsing process
-      status = this->_parse();
+    // Decode encoded replays before parsing so we only parse them once
+    if (isEncodedReplay(&_rbuf[0],_rbuf.size())) {
+      DOUT1("  File is encoded, decoding");
+      Compressor d(0);
+      if (!d.decodeBuff(_rbuf)) {
+        FAIL("  File " << replayfilename << " could not be decoded");
+        return false;
+      }
+    }
+
+    _file_size = _rbuf.size();
+    _rb        = &_rbuf[0];
+    return this->_parse();
+  }
+
+  bool Parser::peek(const char* replayfilename) {
+    std::string summary;
+    PeekHeader  header;
+    if (!readPeekHeader(replayfilename,summary,header)) {
+      DOUT1("  " << replayfilename << " has no peek header; loading the whole replay");
+      bool status = load(replayfilename);
+      _dropFrames();
+      return status;
     }
+
+    DOUT1("  Peeking at " << replayfilename);
+    _replay.original_file = std::string(replayfilename);
+    _rbuf.swap(summary);
+    _file_size            = _rbuf.size();
+    _rb                   = &_rbuf[0];
+    bool status = this->_parse();
+    _dropFrames();
+    // The summary only holds the last frame, so take the real frame count from the header
+    _replay.last_frame  = header.last_frame;
+    _replay.frame_count = header.last_frame - _replay.first_frame + 1;
     return status;
   }
 
+  void Parser::_dropFrames() {
+    _replay.cleanup();
+    for(unsigned p = 0; p < 8; ++p) {
+      _replay.player[p].frame = nullptr;
+    }
+    for(unsigned i = 0; i < MAX_ITEMS; ++i) {
+      _replay.item[i] = SlippiItem();
+    }
+    _replay.num_items = 0;
+    _peeked           = true;
+  }
+
   bool Parser::_parse() {
     _bp = 0; //Start reading from byte 0
     if (not this->_parseHeader()) {
@@ -86,9 +122,6 @@ namespace slip {
       WARN("  Failed to parse events proper");
       return false;
     }
-    if (_is_encoded) {
-      return true;  //back out and restart the parsing process
-    }
     if (not this->_parseMetadata()) {
       WARN("  Failed to parse metadata");
       //Non-fatal if we can't parse metadata, so don't need to return false
@@ -200,9 +233,6 @@ namespace slip {
       switch(ev_code) { //Determine the event code
         case Event::GAME_START:
           success = _parseGameStart();
-          if(_is_encoded) {
-            return true; //immediately restart if the file is encoded
-          }
           break;
         case Event::PRE_FRAME:   success = _parsePreFrame();   break;
         case Event::POST_FRAME:  success = _parsePostFrame();  break;
@@ -236,12 +266,11 @@ namespace slip {
   bool Parser::_parseGameStart() {
     DOUT1("  Parsing game start event at byte " << +_bp);
 
-    // if this is encoded, we need to decompress our entire read
-    //   buffer and retry parsing
+    // load() decodes encoded replays up front, so an encoded game start here means
+    //   it wasn't where the compressor always puts it
     if(_rb[_bp+O_SLP_ENC]) {
-      _is_encoded = true;
-      DOUT1("    File is encoded, decoding and retrying");
-      return true;
+      FAIL_CORRUPT("    Game start event is marked as encoded");
+      return false;
     }
 
     if (_slippi_maj > 0) {
@@ -757,6 +786,12 @@ namespace slip {
   }
 
   Analysis* Parser::analyze() {
+    if (_peeked) {
+      FAIL("  Cannot analyze a replay loaded with peek()");
+      Analysis *a = new Analysis(1);
+      a->success  = false;
+      return a;
+    }
     Analyzer a(_debug);
     return a.analyze(_replay);
   }
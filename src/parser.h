@@ -27,9 +27,10 @@ private:
   uint8_t         _slippi_rev     = 0;       //Revision number of replay being parsed
   int32_t         _max_frames     = 0;       //Maximum number of frames that there will be in the replay file
   bool            _game_end_found = false;   //Whether we've found the game end event
-  bool            _is_encoded     = false;   //Whether this file is encoded by the compressor
+  bool            _peeked         = false;   //Whether frame data was dropped (or never read) by peek()
 
-  char*           _rb = nullptr; //Read buffer
+  std::string     _rbuf; //Storage for the read buffer
+  char*           _rb = nullptr; //Read buffer (points into _rbuf)
   unsigned        _bp; //Current position in buffer
   uint32_t        _length_raw; //Remaining length of raw payload
   uint32_t        _length_raw_start; //Total length of raw payload
@@ -45,10 +46,14 @@ private:
   bool            _parseItemUpdate();
   bool            _parseMetadata();
   void            _cleanup(); //Cleanup replay data
+  void            _dropFrames(); //Free all player and item frame data, keeping everything else
 public:
   Parser(int debug_level);               //Instantiate the parser (possibly in debug mode)
   ~Parser();                             //Destroy the parser
   bool load(const char* replayfilename); //Load a replay file
+  //Load only a replay's settings, players, results, metadata, and frame count, from a .zlp's peek
+  //  header if it has one (or by loading the whole replay otherwise); frame data is not available
+  bool peek(const char* replayfilename);
   Analysis* analyze();                   //Analyze the loaded replay file
   std::string asJson(bool delta);        //Convert the parsed replay structure to a JSON
   void save(const char* outfilename,bool delta); //Save a replay file
@@ -0,0 +1,128 @@
+#include "peek.h"
+
+#include <fstream>
+
+#include "enums.h"
+#include "schema.h"
+
+namespace slip {
+
+//Check whether a header describes a compressed summary that fits in a file of len bytes
+static bool validHeader(const PeekHeader &h, size_t len) {
+  return h.magic == PEEK_MAGIC && h.version == PEEK_VERSION
+    && len >= sizeof(PeekHeader) && h.comp_size > 0 && h.comp_size <= len - sizeof(PeekHeader);
+}
+
+bool buildPeekHeader(const char* buf, size_t len, std::string &header) {
+  header.clear();
+  if (len < MIN_REPLAY_LENGTH || !same8(const_cast<char*>(buf),SLP_HEADER)
+    || uint8_t(buf[N_HEADER_BYTES]) != Event::EV_PAYLOADS) {
+    return false;
+  }
+  uint64_t raw_end  = N_HEADER_BYTES + uint64_t(readBE4U(const_cast<char*>(&buf[11])));
+  unsigned ev_end   = N_HEADER_BYTES + 1 + uint8_t(buf[N_HEADER_BYTES+1]);
+  if (raw_end > len || ev_end > raw_end) {
+    return false;
+  }
+  uint16_t sizes[256] = {0};
+  for (unsigned i = N_HEADER_BYTES + 2; i + 3 <= ev_end; i += 3) {
+    sizes[uint8_t(buf[i])] = readBE2U(const_cast<char*>(&buf[i+1])) + 1;
+  }
+
+  // find the game start and end events and each character's (including followers') latest frame events
+  unsigned game_start = 0, game_end = 0;
+  unsigned pre[8]     = {0}, post[8] = {0};
+  int32_t  last_frame = LOAD_FRAME - 1;
+  for (unsigned b = ev_end; b < raw_end; ) {
+    uint8_t  ev_code = buf[b];
+    unsigned shift   = sizes[ev_code];
+    if (shift == 0 || b + shift > raw_end) {
+      return false;
+    }
+    if (ev_code == Event::GAME_START && game_start == 0) {
+      game_start = b;
+    } else if (ev_code == Event::GAME_END && game_start > 0) {
+      game_end = b;
+      break;
+    } else if ((ev_code == Event::PRE_FRAME || ev_code == Event::POST_FRAME) && game_start > 0) {
+      unsigned p = uint8_t(buf[b+O_PLAYER]) + 4*uint8_t(buf[b+O_FOLLOWER]);
+      if (p > 7) {
+        return false;
+      }
+      if (ev_code == Event::PRE_FRAME) {
+        pre[p]     = b;
+        last_frame = readBE4S(const_cast<char*>(&buf[b+O_FRAME]));
+      } else {
+        post[p]    = b;
+      }
+    }
+    b += shift;
+  }
+  if (game_end == 0 || last_frame < LOAD_FRAME) {
+    return false;
+  }
+
+  std::string summary(buf,ev_end);
+  summary.append(buf + game_start,sizes[Event::GAME_START]);
+  for (unsigned p = 0; p < 8; ++p) {
+    for (unsigned ev : {pre[p],post[p]}) {
+      if (ev == 0 || readBE4S(const_cast<char*>(&buf[ev+O_FRAME])) != last_frame) {
+        continue;  //Characters missing from the last frame have no data for it in a full parse either
+      }
+      summary.append(buf + ev,sizes[uint8_t(buf[ev])]);
+      writeBE4S(LOAD_FRAME,&summary[summary.size() - sizes[uint8_t(buf[ev])] + O_FRAME]);
+    }
+  }
+  summary.append(buf + game_end,sizes[Event::GAME_END]);
+  writeBE4U(summary.size() - N_HEADER_BYTES,&summary[11]);
+  summary.append(buf + raw_end,len - raw_end);  //Metadata
+
+  // a dictionary no bigger than the summary keeps peeking from allocating the preset's full dictionary
+  LzmaOptions o;
+  o.preset    = 9;
+  o.dict_size = summary.size();
+  std::string comp = compressWithLzma(summary.c_str(),summary.size(),o);
+  PeekHeader h;
+  h.comp_size  = comp.size();
+  h.last_frame = last_frame;
+  header.assign(reinterpret_cast<const char*>(&h),sizeof(PeekHeader));
+  header.append(comp);
+  return true;
+}
+
+size_t peekHeaderSize(const char* buf, size_t len) {
+  if (len < sizeof(PeekHeader)) {
+    return 0;
+  }
+  PeekHeader h;
+  memcpy(&h,buf,sizeof(PeekHeader));
+  if (!validHeader(h,len)) {
+    return 0;
+  }
+  return sizeof(PeekHeader) + h.comp_size;
+}
+
+bool readPeekHeader(const char* fname, std::string &summary, PeekHeader &header) {
+  std::ifstream f(fname, std::ios::binary | std::ios::in | std::ios::ate);
+  if (f.fail()) {
+    return false;
+  }
+  size_t len = f.tellg();
+  if (len < sizeof(PeekHeader)) {
+    return false;
+  }
+  f.seekg(0, f.beg);
+  f.read(reinterpret_cast<char*>(&header),sizeof(PeekHeader));
+  if (f.fail() || !validHeader(header,len)) {
+    return false;
+  }
+  std::string comp(header.comp_size,'\0');
+  f.read(&comp[0],header.comp_size);
+  if (f.fail()) {
+    return false;
+  }
+  summary = decompressWithLzma(comp.c_str(),comp.size());
+  return summary.size() >= MIN_REPLAY_LENGTH && same8(&summary[0],SLP_HEADER);
+}
+
+}
@@ -0,0 +1,46 @@
+#ifndef PEEK_H_
+#define PEEK_H_
+
+#include <string>
+
+#include "util.h"
+
+// Peek header layout (integers little-endian, as written by the host), prepended to a .zlp
+//   compressed with --peekable, before its compressed stream:
+//   PeekHeader
+//   summary replay, compressed as its own .xz stream
+// The summary is a tiny standalone replay holding the event payloads, game start event, each
+//   character's final pre-frame and post-frame events (renumbered to the first frame), the game
+//   end event, and the metadata, so parsing it gives a replay's settings, players, and results
+//   without decompressing the replay itself. Decoders skip the header; versions of slippc that
+//   predate it see neither an .xz stream nor a replay and reject the file
+const uint64_t PEEK_MAGIC   = BYTE8(0x53,0x4c,0x50,0x50,0x45,0x45,0x4b,0x00); // SLPPEEK.
+const uint32_t PEEK_VERSION = 2;  //Bump whenever the summary or header layout changes
+
+namespace slip {
+
+struct PeekHeader {
+  uint64_t magic      = PEEK_MAGIC;
+  uint32_t version    = PEEK_VERSION;
+  uint32_t comp_size  = 0;  //Size of the compressed summary replay
+  int32_t  last_frame = 0;  //Frame number of the replay's last frame
+  uint32_t reserved   = 0;
+};
+static_assert(sizeof(PeekHeader) == 24, "PeekHeader layout changed");
+
+//Check whether a buffer starts with a peek header (of any version)
+inline bool isPeekable(const char* buf, size_t len) {
+  return len >= 8 && same8(const_cast<char*>(buf),PEEK_MAGIC);
+}
+
+//Build the peek header for the raw replay in buf; returns false (leaving header empty) if the
+//  replay has no game end event or no frames
+bool buildPeekHeader(const char* buf, size_t len, std::string &header);
+//Get the size of the peek header at the start of a buffer (0 if it doesn't have a valid one)
+size_t peekHeaderSize(const char* buf, size_t len);
+//Read only the summary replay and header from the start of a .zlp file; returns false if it has no peek header
+bool readPeekHeader(const char* fname, std::string &summary, PeekHeader &header);
+
+}
+
+#endif /* PEEK_H_ */
@@ -159,7 +159,7 @@ std::string SlippiReplay::replayAsJson(bool delta) {
     ss << JSTR(1,"disp_name"   ,escape_json(s.player[pp].disp_name))  << ",\n";
     ss << JSTR(1,"slippi_uid"  ,escape_json(s.player[pp].slippi_uid)) << ",\n";
 
-    if (s.player[p].player_type == 3) {
+    if (s.player[p].player_type == 3 || s.player[p].frame == nullptr) {
       ss << SPACE[ILEV] << "\"frames\" : []\n";
     } else {
       ss << SPACE[ILEV] << "\"frames\" : [\n";
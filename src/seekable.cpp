@@ -0,0 +1,323 @@
+#include "seekable.h"
+#include "compressor.h"
+
+namespace slip {
+
+//Where the parts of a raw replay begin and end
+struct ReplayLayout {
+  unsigned game_start = 0;  //First byte of the game start event
+  unsigned loop_start = 0;  //First byte after the game start event
+  unsigned loop_end   = 0;  //First byte of the game end event
+  unsigned raw_end    = 0;  //First byte after the raw replay data (i.e., where the metadata starts)
+  unsigned game_end   = 0;  //Size of the game end event
+  std::vector<std::pair<unsigned,int32_t>> frames;  //Position and frame number of the first event of each frame
+};
+
+//Walk the events of a raw replay to find its layout; frames are marked by frame start events,
+//  or by pre-frame events for replays old enough not to have frame start events
+static bool scanReplay(const char* buf, size_t len, ReplayLayout &l) {
+  if (len < MIN_REPLAY_LENGTH || !same8(const_cast<char*>(buf),SLP_HEADER)
+    || uint8_t(buf[N_HEADER_BYTES]) != Event::EV_PAYLOADS) {
+    return false;
+  }
+  uint64_t raw_end = N_HEADER_BYTES + uint64_t(readBE4U(const_cast<char*>(&buf[11])));
+  unsigned ev_bytes = uint8_t(buf[N_HEADER_BYTES+1]);
+  if (raw_end > len || N_HEADER_BYTES + 1 + ev_bytes > raw_end) {
+    return false;
+  }
+  uint16_t sizes[256] = {0};
+  for (unsigned i = N_HEADER_BYTES + 2; i + 3 <= N_HEADER_BYTES + 1 + ev_bytes; i += 3) {
+    sizes[uint8_t(buf[i])] = readBE2U(const_cast<char*>(&buf[i+1])) + 1;
+  }
+  uint8_t marker = sizes[Event::FRAME_START] ? Event::FRAME_START : Event::PRE_FRAME;
+
+  l = ReplayLayout();
+  l.raw_end  = raw_end;
+  l.game_end = sizes[Event::GAME_END];
+  int32_t last_pre = INT32_MIN;
+  for (unsigned b = N_HEADER_BYTES + 1 + ev_bytes; b < raw_end; ) {
+    uint8_t  ev_code = buf[b];
+    unsigned shift   = sizes[ev_code];
+    if (shift == 0 || b + shift > raw_end) {
+      return false;
+    }
+    if (ev_code == Event::GAME_START && l.loop_start == 0) {
+      l.game_start = b;
+      l.loop_start = b + shift;
+    } else if (ev_code == Event::GAME_END && l.loop_start > 0) {
+      l.loop_end = b;
+      return true;
+    } else if (ev_code == marker && l.loop_start > 0) {
+      if (shift < O_FRAME + 4) {  //Payload too short to hold a frame number
+        return false;
+      }
+      int32_t frame = readBE4S(const_cast<char*>(&buf[b+O_FRAME]));
+      if (marker == Event::FRAME_START || frame != last_pre) {  //Only the first pre-frame event of a frame
+        l.frames.push_back({b,frame});
+      }
+      last_pre = frame;
+    }
+    b += shift;
+  }
+  return false;  //No game end event
+}
+
+//Append a raw replay's header and the events up to the start of the game loop, leaving out
+//  everything between the event payloads and game start events if minimal is set
+static void appendPrefix(std::string &out, const char* buf, const ReplayLayout &l, bool minimal) {
+  if (!minimal) {
+    out.append(buf,l.loop_start);
+    return;
+  }
+  out.append(buf,N_HEADER_BYTES + 1 + uint8_t(buf[N_HEADER_BYTES+1]));
+  out.append(buf + l.game_start,l.loop_start - l.game_start);
+}
+
+//Set the raw data length in a replay's header to account for everything before the metadata
+static void setRawLength(std::string &slp, size_t metadata) {
+  writeBE4U(slp.size() - metadata - N_HEADER_BYTES,&slp[11]);
+}
+
+SeekableReplay::SeekableReplay(int debug) {
+  _debug = debug;
+}
+
+bool SeekableReplay::encode(const std::string &slp, std::string &out, unsigned window,
+  const LzmaOptions &lzma, int _debug) {
+  ReplayLayout l;
+  if (!scanReplay(slp.c_str(),slp.size(),l) || l.frames.empty()) {
+    FAIL("  Replay is corrupt or has no frames");
+    return false;
+  }
+  if (window == 0) {
+    window = SEEK_WINDOW;
+  }
+
+  // cut the game loop at the first frame at or after each multiple of the window size
+  //   (counting from the first frame), so rollbacks to earlier frames never start a new window
+  std::vector<unsigned> cuts = {l.loop_start};
+  std::vector<SeekWindow> windows(1);
+  int32_t first    = l.frames[0].second;
+  int64_t boundary = int64_t(first) + window;
+  windows[0].first_frame = windows[0].last_frame = first;
+  for (const auto &f : l.frames) {
+    if (f.second >= boundary) {
+      cuts.push_back(f.first);
+      windows.emplace_back();
+      windows.back().first_frame = windows.back().last_frame = f.second;
+      boundary = int64_t(first) + (int64_t(f.second - first) / window + 1) * window;
+    }
+    windows.back().first_frame = std::min(windows.back().first_frame,f.second);
+    windows.back().last_frame  = std::max(windows.back().last_frame,f.second);
+  }
+  cuts.push_back(l.loop_end);
+
+  SeekHeader h;
+  h.window = window;
+  out.assign(reinterpret_cast<const char*>(&h),sizeof(SeekHeader));
+
+  const char* buf = slp.c_str();
+  std::string blank_end(l.game_end,'\0');
+  blank_end[0] = char(Event::GAME_END);
+  for (unsigned w = 0; w < windows.size(); ++w) {
+    bool last = (w + 1 == windows.size());
+    std::string part;
+    appendPrefix(part,buf,l,w > 0);
+    part.append(buf + cuts[w],cuts[w+1] - cuts[w]);
+    if (last) {
+      part.append(buf + l.loop_end,slp.size() - l.loop_end);
+    } else {
+      part.append(blank_end);
+    }
+    setRawLength(part,last ? slp.size() - l.raw_end : 0);
+
+    // every window gets its own compressor, so no prediction state carries over between windows
+    Compressor c(_debug);
+    char* p   = &part[0];
+    char* enc = nullptr;
+    if (!(c.loadFromBuff(&p,part.size()) && c.validate())) {
+      FAIL("  Could not encode window " << w << " (frames " << windows[w].first_frame
+        << " to " << windows[w].last_frame << ")");
+      return false;
+    }
+    unsigned len     = c.saveToBuff(&enc);
+    std::string comp = compressWithLzma(enc,len,lzma);
+    delete[] enc;
+    windows[w].offset    = out.size();
+    windows[w].comp_size = comp.size();
+    out.append(comp);
+    DOUT1("  Window " << w << ": frames " << windows[w].first_frame << " to " << windows[w].last_frame
+      << ", " << comp.size() << " bytes");
+  }
+
+  SeekFooter foot;
+  foot.index_offset = out.size();
+  foot.num_windows  = windows.size();
+  out.append(reinterpret_cast<const char*>(windows.data()),windows.size()*sizeof(SeekWindow));
+  out.append(reinterpret_cast<const char*>(&foot),sizeof(SeekFooter));
+  return true;
+}
+
+bool SeekableReplay::create(const char* fname, const std::string &slp, unsigned window, const LzmaOptions &lzma) {
+  if (fileExists(fname)) {
+    FAIL("File " << fname << " exists, refusing to overwrite");
+    return false;
+  }
+  std::string out;
+  if (!encode(slp,out,window,lzma,_debug)) {
+    return false;
+  }
+
+  // write to a temporary file first so a failed or interrupted run never leaves a bad file behind
+  std::string tmpname = std::string(fname) + ".tmp";
+  std::ofstream f(tmpname, std::ios::binary | std::ios::out | std::ios::trunc);
+  f.write(out.c_str(),out.size());
+  f.close();
+  bool ok = !f.fail();
+  if (!ok) {
+    FAIL("Could not write " << tmpname);
+  }
+
+  // make sure the windows decode back to the original replay before giving the file its real name
+  std::string dec;
+  if (ok) {
+    ok = open(tmpname.c_str()) && decode(dec) && (dec == slp);
+    if (!ok) {
+      FAIL("  Windows did not decode back to the original replay");
+    }
+  }
+  if (!ok || std::rename(tmpname.c_str(),fname) != 0) {
+    remove(tmpname.c_str());
+    return false;
+  }
+  _fname = fname;
+  return true;
+}
+
+bool SeekableReplay::open(const char* fname) {
+  _fname = fname;
+  _windows.clear();
+  std::ifstream f(fname, std::ios::binary | std::ios::in);
+  if (f.fail()) {
+    FAIL("File " << fname << " could not be opened or does not exist");
+    return false;
+  }
+  f.seekg(0, f.end);
+  uint64_t file_size = f.tellg();
+  SeekHeader h;
+  SeekFooter foot;
+  f.seekg(0, f.beg);
+  f.read(reinterpret_cast<char*>(&h),sizeof(SeekHeader));
+  if (file_size < sizeof(SeekHeader) + sizeof(SeekFooter) || h.magic != SEEK_MAGIC) {
+    FAIL("File " << fname << " is not a seekable replay");
+    return false;
+  }
+  if (h.version != SEEK_VERSION) {
+    FAIL("Seekable replay " << fname << " has unsupported version " << h.version);
+    return false;
+  }
+  f.seekg(file_size - sizeof(SeekFooter), f.beg);
+  f.read(reinterpret_cast<char*>(&foot),sizeof(SeekFooter));
+  //Bound the index by the file size before adding to it, so a huge window count can't wrap the sum around
+  uint64_t index_size = uint64_t(foot.num_windows) * sizeof(SeekWindow);
+  if (f.fail() || foot.magic != SEEK_INDEX_MAGIC || foot.num_windows == 0
+    || index_size > file_size - sizeof(SeekHeader) - sizeof(SeekFooter)
+    || foot.index_offset != file_size - sizeof(SeekFooter) - index_size) {
+    FAIL("Seekable replay " << fname << " has a corrupt index");
+    return false;
+  }
+  _window = h.window;
+  _windows.resize(foot.num_windows);
+  f.seekg(foot.index_offset, f.beg);
+  f.read(reinterpret_cast<char*>(_windows.data()),index_size);
+  for (const SeekWindow &w : _windows) {
+    if (w.offset < sizeof(SeekHeader) || w.offset > foot.index_offset || w.comp_size > foot.index_offset - w.offset) {
+      FAIL("Seekable replay " << fname << " has a corrupt index");
+      _windows.clear();
+      return false;
+    }
+  }
+  return !f.fail();
+}
+
+bool SeekableReplay::_readWindow(unsigned w, std::string &slp) const {
+  std::ifstream f(_fname, std::ios::binary | std::ios::in);
+  std::string comp(_windows[w].comp_size,'\0');
+  f.seekg(_windows[w].offset, f.beg);
+  f.read(&comp[0],comp.size());
+  if (f.fail() || !same4(&comp[0],LZMA_HEADER)) {
+    FAIL("  Could not read window " << w << " of " << _fname);
+    return false;
+  }
+  std::string enc = decompressWithLzma(comp.c_str(),comp.size());
+  comp.clear();
+  Compressor d(_debug);
+  if (!d.decodeBuff(enc)) {
+    FAIL("  Could not decode window " << w << " of " << _fname);
+    return false;
+  }
+  slp.swap(enc);
+  return true;
+}
+
+bool SeekableReplay::decode(std::string &slp) const {
+  return decodeFrames(INT32_MIN,INT32_MAX,slp);
+}
+
+bool SeekableReplay::decodeFrames(int32_t first, int32_t last, std::string &slp) const {
+  // find the run of windows overlapping the requested frames
+  unsigned w0 = _windows.size(), w1 = 0;
+  for (unsigned w = 0; w < _windows.size(); ++w) {
+    if (_windows[w].first_frame <= last && _windows[w].last_frame >= first) {
+      w0 = std::min(w0,w);
+      w1 = w;
+    }
+  }
+  if (w0 == _windows.size()) {
+    FAIL("  No frames between " << first << " and " << last << " in " << _fname);
+    return false;
+  }
+
+  // stitch the game loops of the windows together between the first window's start and the last one's end
+  std::string  win;
+  ReplayLayout l;
+  bool         started = false;
+  size_t       metadata = 0;
+  slp.clear();
+  for (unsigned w = w0; w <= w1; ++w) {
+    if (!(_readWindow(w,win) && scanReplay(win.c_str(),win.size(),l))) {
+      FAIL("  Window " << w << " of " << _fname << " is corrupt");
+      return false;
+    }
+    if (w == w0) {
+      appendPrefix(slp,win.c_str(),l,false);
+    }
+    unsigned from = started ? l.loop_start : l.loop_end, to = l.loop_end;
+    for (unsigned i = 0; i < l.frames.size(); ++i) {
+      const auto &f = l.frames[i];
+      if (!started && f.second >= first) {  //Skip frames before the range
+        from    = (i == 0) ? l.loop_start : f.first;
+        started = true;
+      }
+      if (started && f.second > last) {     //Stop at the first frame after the range
+        to = std::max(from,f.first);
+        break;
+      }
+    }
+    slp.append(win,from,to - from);
+    if (to < l.loop_end || w == w1) {
+      slp.append(win,l.loop_end,win.size() - l.loop_end);
+      metadata = win.size() - l.raw_end;
+      break;
+    }
+  }
+  setRawLength(slp,metadata);
+  return true;
+}
+
+bool decodeSeekableFile(const char* fname, std::string &slp, int debug) {
+  SeekableReplay s(debug);
+  return s.open(fname) && s.decode(slp);
+}
+
+}
@@ -0,0 +1,103 @@
+#ifndef SEEKABLE_H_
+#define SEEKABLE_H_
+
+#include <string>
+#include <vector>
+#include <climits>
+
+#include "util.h"
+
+// Seekable .zlp file layout (all integers little-endian, as written by the host):
+//   SeekHeader
+//   block data (each block is an independent .xz stream of one encoded window)
+//   SeekWindow[num_windows]
+//   SeekFooter
+// A window is a standalone replay holding the game start event and every event from the first frame
+//   at or after a multiple of the window size (counting from the first frame) up to the next such
+//   frame, so each window is encoded and shuffled with fresh prediction state and decoding any
+//   frame range only requires decompressing and decoding the windows that overlap it. Only the
+//   first window keeps the events before the game start (e.g., gecko codes), and only the last
+//   keeps the real game end event and metadata; every other window ends with a blank game end event
+const uint64_t SEEK_MAGIC       = BYTE8(0x53,0x4c,0x50,0x53,0x45,0x45,0x4b,0x00); // SLPSEEK.
+const uint64_t SEEK_INDEX_MAGIC = BYTE8(0x53,0x4c,0x50,0x53,0x49,0x44,0x58,0x00); // SLPSIDX.
+const uint32_t SEEK_VERSION     = 1;    //Bump whenever the seekable layout changes
+const unsigned SEEK_WINDOW      = 600;  //Default number of frames per window (10 seconds)
+
+namespace slip {
+
+struct SeekHeader {
+  uint64_t magic   = SEEK_MAGIC;
+  uint32_t version = SEEK_VERSION;
+  uint32_t window  = SEEK_WINDOW;  //Number of frames per window
+};
+
+//Location and frame range of a single window
+struct SeekWindow {
+  int32_t  first_frame = 0;  //Lowest frame number of any event in the window
+  int32_t  last_frame  = 0;  //Highest frame number of any event in the window
+  uint64_t offset      = 0;  //Byte offset of the window's .xz stream from the start of the file
+  uint64_t comp_size   = 0;  //Size of the window's .xz stream
+};
+
+struct SeekFooter {
+  uint64_t index_offset = 0;  //Byte offset of the window table from the start of the file
+  uint32_t num_windows  = 0;  //Number of entries in the window table
+  uint32_t reserved     = 0;
+  uint64_t magic        = SEEK_INDEX_MAGIC;
+};
+static_assert(sizeof(SeekHeader) == 16, "SeekHeader layout changed");
+static_assert(sizeof(SeekWindow) == 24, "SeekWindow layout changed");
+static_assert(sizeof(SeekFooter) == 24, "SeekFooter layout changed");
+
+//Check whether a buffer starts like a seekable .zlp
+inline bool isSeekableReplay(const char* buf, size_t len) {
+  return len >= sizeof(SeekHeader) && same8(const_cast<char*>(buf),SEEK_MAGIC);
+}
+
+//Class for compressing a replay into independently decodable windows of frames and
+//  decoding either the whole replay or only the frames in a given range
+class SeekableReplay {
+private:
+  int                      _debug;
+  std::string              _fname;     //Name of the seekable .zlp on disk
+  uint32_t                 _window = SEEK_WINDOW;
+  std::vector<SeekWindow>  _windows;   //All windows in the file, in replay order
+
+  bool _readWindow(unsigned w, std::string &slp) const;  //Read, decompress, and decode a single window
+public:
+  SeekableReplay(int debug);
+
+  //Split the replay in buffer slp into windows of window frames each, encode and compress them
+  //  with lzma, and write them to fname; returns false (writing nothing) if any window fails to
+  //  encode or the windows don't decode back to the original replay
+  bool create(const char* fname, const std::string &slp, unsigned window = SEEK_WINDOW,
+    const LzmaOptions &lzma = LzmaOptions());
+  //Same as create(), but build the whole seekable .zlp in memory in out instead of writing it
+  static bool encode(const std::string &slp, std::string &out, unsigned window = SEEK_WINDOW,
+    const LzmaOptions &lzma = LzmaOptions(), int debug = 0);
+  bool open(const char* fname);  //Read a seekable .zlp's index without decompressing any windows
+
+  //Decode the whole replay into slp, byte for byte identical to the original
+  bool decode(std::string &slp) const;
+  //Decode only the windows overlapping frames [first,last] into slp, a valid replay holding the
+  //  game start event, every event from the first frame >= first up to the first frame > last,
+  //  and a game end event (the real one if the range reaches the end of the game)
+  bool decodeFrames(int32_t first, int32_t last, std::string &slp) const;
+
+  inline unsigned size() const {
+    return _windows.size();
+  }
+  inline uint32_t window() const {
+    return _window;
+  }
+  inline const SeekWindow& entry(unsigned w) const {
+    return _windows[w];
+  }
+};
+
+//Decode every window of the seekable .zlp fname into slp
+bool decodeSeekableFile(const char* fname, std::string &slp, int debug = 0);
+
+}
+
+#endif /* SEEKABLE_H_ */
@@ -7,7 +7,7 @@ static const std::string STANDARDDIR   = "standard";
 // replays that cannot compress
 static const std::string CORRUPTDIR    = "corrupt";
 // replays that were compressed with old versions of compressor
-static const std::string BACKCOMPATDIR = "zlp-compat-1";
+static const std::vector<std::string> BACKCOMPATDIRS = {"zlp-compat-1","zlp-compat-2"};  //One per older compressor version
 
 // known file 1
 static const std::string TSLPFILE      = "3-9-0-singles-irl-summit12.slp.xz";
@@ -17,15 +17,51 @@ static const std::string TCMPFILE      = "3-7-0-singles-net.slp.xz";
 static const std::string TZLPFILE      = "zlptest.zlp";
 // temporary zlp file
 static const std::string TUNZLPFILE    = "zlptest.slp";
+// temporary catalog file
+static const std::string TCATFILE      = "cattest.cat";
+// temporary archive file
+static const std::string TARCFILE      = "arctest.zla";
+// temporary seekable zlp file
+static const std::string TSEEKFILE     = "seektest.zlp";
+// temporary zlp file with a peek header
+static const std::string TPEEKFILE     = "peektest.zlp";
+// temporary zlp file compressed with a preset dictionary
+static const std::string TDICTFILE     = "dicttest.zlp";
+// temporary zlp file upgraded to the current compressor version
+static const std::string TUPGFILE      = "upgtest.zlp";
+// short game for testing preset dictionaries
+static const std::string TSHORTFILE    = "1-7-1-pal-fizzi.slp.xz";
+// replay from an older Slippi version than TCMPFILE, for testing Compressor reuse
+static const std::string TOLDFILE      = "3-6-0-singles-net.slp.xz";
+// replay with many items, for testing item shuffling
+static const std::string TITEMFILE     = "3-9-0-over-1024-items.slp.xz";
+// replays to train preset dictionaries on
+static const std::vector<std::string> TDICTTRAIN = {"1-7-0-singles-irl-phoenix-blue-2.slp.xz",
+  "1-7-1-singles-irl-gang.slp.xz",TCMPFILE};
 
 static const std::string tmpzlp        = (PATH(TESTDIR) / PATH(TZLPFILE)).string();
 static const std::string tmpunzlp      = (PATH(TESTDIR) / PATH(TUNZLPFILE)).string();
+static const std::string tmpcat        = (PATH(TESTDIR) / PATH(TCATFILE)).string();
+static const std::string tmparc        = (PATH(TESTDIR) / PATH(TARCFILE)).string();
+static const std::string tmpseek       = (PATH(TESTDIR) / PATH(TSEEKFILE)).string();
+static const std::string tmppeek       = (PATH(TESTDIR) / PATH(TPEEKFILE)).string();
+static const std::string tmpdict       = (PATH(TESTDIR) / PATH(TDICTFILE)).string();
+static const std::string tmpupg        = (PATH(TESTDIR) / PATH(TUPGFILE)).string();
 
 typedef std::filesystem::directory_iterator f_iter;
 typedef std::filesystem::directory_entry    f_entry;
 
 static int _debug = 0;
 
+static std::string readFile(const std::string &path) {
+  std::ifstream f(path, std::ios::binary | std::ios::in);
+  return std::string((std::istreambuf_iterator<char>(f)),std::istreambuf_iterator<char>());
+}
+
+static void writeFile(const std::string &path, const std::string &buf) {
+  std::ofstream(path, std::ios::binary | std::ios::out | std::ios::trunc).write(buf.c_str(),buf.size());
+}
+
 namespace slip {
 
 // https://stackoverflow.com/questions/865668/how-to-parse-command-line-arguments-in-c
@@ -227,6 +263,723 @@ int testConsistencySanity() {
 }
 
 
+int testAggregate() {
+  TSUITE("Aggregate Analysis");
+    slip::Aggregate all;
+    slip::Aggregate part[3];
+    unsigned nfiles = 0;
+    for (const f_entry & entry : f_iter(PATH(TESTDIR) / PATH(STANDARDDIR))) {
+      std::string path = entry.path().string();
+      slip::Parser *p = new slip::Parser(_debug);
+      if (p->load(path.c_str())) {
+        slip::Analysis *a = p->analyze();
+        all.add(*a);
+        part[nfiles % 3].add(*a);
+        ++nfiles;
+        delete a;
+      }
+      delete p;
+    }
+    ASSERT("Aggregated at least one game",all.games() > 0,
+      "Aggregated " << all.games() << " games");
+    BAILONFAIL(1);
+    ASSERT("Aggregated no more games than files",all.games() <= nfiles,
+      "Aggregated " << all.games() << " games from " << nfiles << " files");
+    slip::Aggregate merged;
+    for(unsigned i = 0; i < 3; ++i) {
+      merged.merge(part[i]);
+    }
+    ASSERT("Merged partial aggregates have the same game count",merged.games() == all.games(),
+      "Merged aggregate has " << merged.games() << " games instead of " << all.games());
+    ASSERT("Merged partial aggregates match sequential aggregate",merged.asJson().compare(all.asJson()) == 0,
+      "Merged aggregate differs from sequential aggregate");
+    std::string j      = all.asJson();
+    size_t      totals = j.find("\"totals\"");
+    size_t      pergame = j.find("\"per_game\"",totals);
+    std::string tblock = (totals == std::string::npos) ? "" : j.substr(totals,pergame-totals);
+    std::string pblock = (pergame == std::string::npos) ? "" : j.substr(pergame,j.find("}",pergame)-pergame);
+    ASSERT("Aggregate totals include additive counters",tblock.find("\"wavedashes\"") != std::string::npos,
+      "Totals block is missing wavedashes");
+    ASSERT("Aggregate totals exclude per-game rates and means",
+      tblock.find("\"actions_per_min\"") == std::string::npos && tblock.find("\"mean_kill_percent\"") == std::string::npos,
+      "Totals block contains non-additive stats");
+    ASSERT("Aggregate per-game block includes rates and means",pblock.find("\"actions_per_min\"") != std::string::npos,
+      "Per-game block is missing actions_per_min");
+
+    //Modded character IDs past the end of the name table must not be looked up
+    slip::Analysis modded(1);
+    modded.success = true;
+    for(unsigned p = 0; p < 2; ++p) {
+      modded.ap[p].port     = p;
+      modded.ap[p].tag_code = "MOD#" + std::to_string(p);
+      modded.ap[p].char_id  = CharExt::__LAST + 10 + p;
+    }
+    slip::Aggregate mods;
+    mods.add(modded);
+    std::string mj = mods.asJson();
+    ASSERT("Aggregate names out-of-range characters as unknown",
+      mj.find("\"unknown_" + std::to_string(CharExt::__LAST + 10) + "\"") != std::string::npos
+        && mj.find("\"opponent_char_name\" : \"unknown\"") != std::string::npos,
+      "Out-of-range character IDs are not reported as unknown");
+  return 0;
+}
+
+int testCatalog() {
+  TSUITE("Replay Catalog");
+    std::vector<std::string> files;
+    for (const f_entry & entry : f_iter(PATH(TESTDIR) / PATH(STANDARDDIR))) {
+      files.push_back(entry.path().string());
+    }
+    if (fileExists(tmpcat.c_str())) {
+      remove(tmpcat.c_str());
+    }
+
+    slip::Catalog *cat = new slip::Catalog(_debug);
+    unsigned indexed   = cat->update(files,0);
+    ASSERT("All standard replays are indexed",indexed == files.size(),
+      "Indexed " << indexed << " of " << files.size() << " replays");
+    ASSERT("Catalog saves",cat->save(tmpcat.c_str()),
+      "Catalog failed to save");
+    BAILONFAIL(1);
+    delete cat;
+
+    cat = new slip::Catalog(_debug);
+    ASSERT("Catalog loads",cat->load(tmpcat.c_str()),
+      "Catalog failed to load");
+    BAILONFAIL(1);
+    ASSERT("Loaded catalog has all replays",cat->size() == files.size(),
+      "Loaded catalog has " << cat->size() << " replays");
+    indexed = cat->update(files,0);
+    ASSERT("Unchanged replays are not reindexed",indexed == 0,
+      "Reindexed " << indexed << " unchanged replays");
+    delete cat;
+
+    slip::CatalogFilter filter;
+    filter.parseChars("FOX,MARTH");
+    filter.parseStage("OLD PPP");
+    std::vector<std::string> results;
+    ASSERT("Catalog queries",slip::Catalog::query(tmpcat.c_str(),filter,results),
+      "Catalog failed to query");
+    bool found = false;
+    for (std::string &r : results) {
+      found |= (r.find(TSLPFILE) != std::string::npos);
+    }
+    ASSERT("Query for Fox vs Marth on Dream Land finds "+TSLPFILE,found,
+      "Query found " << results.size() << " replays, but not " << TSLPFILE);
+
+    std::string catbuf = readFile(tmpcat);
+    std::string badcat = catbuf;
+    uint32_t    badoff = 0xfffffff0;
+    memcpy(&badcat[sizeof(slip::CatalogHeader)+offsetof(slip::CatalogRecord,path)],&badoff,sizeof(badoff));
+    writeFile(tmpcat,badcat);
+    results.clear();
+    ASSERT("Catalog queries reject out-of-range string offsets",!slip::Catalog::query(tmpcat.c_str(),filter,results),
+      "Catalog with a corrupt record was queried");
+    cat = new slip::Catalog(_debug);
+    ASSERT("Catalog loads reject out-of-range string offsets",!cat->load(tmpcat.c_str()),
+      "Catalog with a corrupt record was loaded");
+    delete cat;
+    badcat = catbuf;
+    badcat.back() = 'x';
+    writeFile(tmpcat,badcat);
+    ASSERT("Catalog queries reject unterminated string tables",!slip::Catalog::query(tmpcat.c_str(),filter,results),
+      "Catalog with an unterminated string table was queried");
+
+    remove(tmpcat.c_str());
+  return 0;
+}
+
+int testFingerprints() {
+  std::string known1 = (PATH(TESTDIR) / PATH(STANDARDDIR) / PATH(TSLPFILE)).string();
+  std::string known2 = (PATH(TESTDIR) / PATH(STANDARDDIR) / PATH(TCMPFILE)).string();
+  slip::Compressor *c;
+
+  TSUITE("Replay Fingerprints");
+    if (fileExists(tmpzlp.c_str())) {
+      remove(tmpzlp.c_str());
+    }
+    if (fileExists(tmpunzlp.c_str())) {
+      remove(tmpunzlp.c_str());
+    }
+    c = new slip::Compressor(_debug);
+    c->setOutputFilename(tmpzlp.c_str());
+    ASSERT("Compressor Loads "+TCMPFILE,c->loadFromFile(known2.c_str()),
+      "Compressor failed to load " << TCMPFILE);
+    BAILONFAIL(1);
+    c->saveToFile(false);
+    delete c;
+    c = new slip::Compressor(_debug);
+    c->setOutputFilename(tmpunzlp.c_str());
+    ASSERT("Compressor Loads "+TZLPFILE,c->loadFromFile(tmpzlp.c_str()),
+      "Compressor failed to load " << TZLPFILE);
+    BAILONFAIL(1);
+    c->saveToFile(false);
+    delete c;
+
+    std::string print_xz  = slip::replayFingerprint(known2.c_str());
+    std::string print_zlp = slip::replayFingerprint(tmpzlp.c_str());
+    std::string print_slp = slip::replayFingerprint(tmpunzlp.c_str());
+    std::string print_oth = slip::replayFingerprint(known1.c_str());
+    ASSERT("Fingerprint of "+TCMPFILE+" is computed",print_xz.length() == 32,
+      "Fingerprint of " << TCMPFILE << " is '" << print_xz << "'");
+    ASSERT("Fingerprints of .zlp and xz-compressed .slp match",print_zlp.compare(print_xz) == 0,
+      print_zlp << " != " << print_xz);
+    ASSERT("Fingerprints of .slp and xz-compressed .slp match",print_slp.compare(print_xz) == 0,
+      print_slp << " != " << print_xz);
+    ASSERT("Fingerprints of different games differ",print_oth.compare(print_xz) != 0,
+      print_oth << " == " << print_xz);
+  return 0;
+}
+
+int testLegacyRNG() {
+  TSUITE("Legacy RNG Jumps");
+    bool jumps_match = true, distances_match = true;
+    uint32_t seed = 0x12345678, rolled = seed;
+    for (uint32_t i = 0; i < 1000; ++i) {  //Compare against rolling one step at a time
+      jumps_match     &= (slip::LegacyRNG::jump(seed,i) == rolled);
+      distances_match &= (slip::LegacyRNG::distance(seed,rolled) == i);
+      rolled           = rolled * 214013 + 2531011;
+    }
+    ASSERT("Jumps match single rolls",jumps_match,
+      "Jumping the legacy RNG disagreed with rolling it");
+    ASSERT("Distances match single rolls",distances_match,
+      "Legacy RNG distance disagreed with rolling it");
+    uint32_t far = slip::LegacyRNG::jump(seed,0xFEDCBA98);
+    ASSERT("Distant seeds are found",slip::LegacyRNG::distance(seed,far) == 0xFEDCBA98,
+      "Legacy RNG distance returned " << slip::LegacyRNG::distance(seed,far));
+    uint32_t back = slip::LegacyRNG::distance(far,seed);
+    ASSERT("Every seed is reachable",slip::LegacyRNG::jump(far,back) == seed,
+      "Legacy RNG could not get back to the starting seed");
+  return 0;
+}
+
+int testBitColumns() {
+  TSUITE("Bit Column Transposes");
+    const unsigned STRIDE = 3;
+    bool matches = true, round_trips = true;
+    for (unsigned n = 0; n <= 37; ++n) {  //Plane boundaries both aligned and unaligned to bytes
+      std::vector<char> structs(n*STRIDE), planes(n,0), expected(n,0), restored(n*STRIDE,0);
+      for (unsigned e = 0; e < n*STRIDE; ++e) {
+        structs[e] = char(e*97 + n*13);
+      }
+      for (unsigned p = 0, k = 0; p < 8; ++p) {  //Reference: one bit at a time, most significant first
+        for (unsigned e = 0; e < n; ++e, ++k) {
+          if ((structs[e*STRIDE] >> (7-p)) & 1) {
+            expected[k/8] |= char(0x80 >> (k%8));
+          }
+        }
+      }
+      slip::transposeBitColumn(planes.data(),structs.data(),n,STRIDE,false);
+      matches &= (planes == expected);
+      slip::transposeBitColumn(planes.data(),restored.data(),n,STRIDE,true);
+      for (unsigned e = 0; e < n; ++e) {
+        round_trips &= (restored[e*STRIDE] == structs[e*STRIDE]);
+      }
+    }
+    ASSERT("Bit planes match bit-by-bit shuffling",matches,
+      "8x8 bit transpose produced different bit planes");
+    ASSERT("Bit planes unshuffle to the original column",round_trips,
+      "8x8 bit transpose did not round trip");
+  return 0;
+}
+
+int testArchive() {
+  std::string known1 = (PATH(TESTDIR) / PATH(STANDARDDIR) / PATH(TSLPFILE)).string();
+  std::string known2 = (PATH(TESTDIR) / PATH(STANDARDDIR) / PATH(TCMPFILE)).string();
+  std::vector<std::string> files = {known1, known2};
+  std::vector<std::string> names = {"a/first.slp", "second.slp"};
+  slip::Archive *a;
+
+  TSUITE("Solid Archives");
+    if (fileExists(tmparc.c_str())) {
+      remove(tmparc.c_str());
+    }
+    if (fileExists(tmpunzlp.c_str())) {
+      remove(tmpunzlp.c_str());
+    }
+    a = new slip::Archive(_debug);
+    ASSERT("Archive is created",a->create(tmparc.c_str(),files,names,1,0),
+      "Archive failed to create");
+    BAILONFAIL(1);
+    delete a;
+
+    a = new slip::Archive(_debug);
+    ASSERT("Archive opens",a->open(tmparc.c_str()),
+      "Archive failed to open");
+    BAILONFAIL(1);
+    ASSERT("Archive lists both replays in separate blocks",a->size() == 2 && a->blocks() == 2,
+      "Archive has " << a->size() << " replays in " << a->blocks() << " blocks");
+    ASSERT("Archive finds replays by name",a->find("second.slp") == 1 && a->find("missing.slp") == -1,
+      "Archive found second.slp at " << a->find("second.slp"));
+    ASSERT("Archive extracts "+TCMPFILE,a->extract(1,tmpunzlp),
+      "Archive failed to extract " << TCMPFILE);
+    ASSERT("Extracted replay matches original",md5file(tmpunzlp).compare(md5compressed(known2)) == 0,
+      "Extracted replay differs from " << TCMPFILE);
+    ASSERT("Archive refuses to overwrite an existing archive",!a->create(tmparc.c_str(),files,names,1,0),
+      "Archive overwrote " << tmparc);
+    delete a;
+
+    std::string arcbuf = readFile(tmparc);
+    bool        opened = false;
+    for (std::string hostile : {"../evil.slp", "/tmp/e.slp", "a/../../e"}) {
+      std::string bad = arcbuf;
+      size_t      pos = bad.rfind(names[1]);
+      hostile.resize(names[1].size(),'x');
+      bad.replace(pos,hostile.size(),hostile);
+      writeFile(tmparc,bad);
+      a       = new slip::Archive(_debug);
+      opened |= a->open(tmparc.c_str());
+      delete a;
+    }
+    ASSERT("Archive rejects entry names that escape the output directory",!opened,
+      "Archive opened with a hostile entry name");
+    remove(tmparc.c_str());
+    a = new slip::Archive(_debug);
+    ASSERT("Archive refuses to create entries with unsafe names",!a->create(tmparc.c_str(),files,{"a.slp","../b.slp"},1,0)
+      && !fileExists(tmparc.c_str()),
+      "Archive created an entry named ../b.slp");
+    delete a;
+
+    remove(tmparc.c_str());
+    remove(tmpunzlp.c_str());
+  return 0;
+}
+
+int testSeekable() {
+  std::string known1 = (PATH(TESTDIR) / PATH(STANDARDDIR) / PATH(TSLPFILE)).string();
+  std::string comp, orig, full, clip;
+  std::ifstream f(known1, std::ios::binary | std::ios::in);
+  comp.assign((std::istreambuf_iterator<char>(f)),std::istreambuf_iterator<char>());
+  slip::SeekableReplay *sr;
+  slip::Parser *p;
+
+  TSUITE("Seekable Replays");
+    ASSERT("Known file decompresses",decompressReplay(comp.c_str(),comp.size(),orig),
+      "Could not decompress " << TSLPFILE);
+    BAILONFAIL(1);
+    if (fileExists(tmpseek.c_str())) {
+      remove(tmpseek.c_str());
+    }
+    sr = new slip::SeekableReplay(_debug);
+    ASSERT("Seekable replay is created",sr->create(tmpseek.c_str(),orig),
+      "Seekable replay failed to create");
+    BAILONFAIL(1);
+    ASSERT("Seekable replay refuses to overwrite an existing file",!sr->create(tmpseek.c_str(),orig),
+      "Seekable replay overwrote " << tmpseek);
+    delete sr;
+
+    sr = new slip::SeekableReplay(_debug);
+    ASSERT("Seekable replay opens",sr->open(tmpseek.c_str()),
+      "Seekable replay failed to open");
+    BAILONFAIL(1);
+    ASSERT("13662 frames are split into 23 windows of 600",sr->size() == 23 && sr->window() == 600,
+      "Replay is split into " << sr->size() << " windows of " << sr->window());
+    ASSERT("Windows start at multiples of 600 frames from the first",
+      sr->entry(0).first_frame == -123 && sr->entry(1).first_frame == 477 && sr->entry(22).first_frame == 13077,
+      "Windows start at " << sr->entry(0).first_frame << ", " << sr->entry(1).first_frame << ", ..., "
+      << sr->entry(22).first_frame);
+    ASSERT("Whole seekable replay decodes to the original",sr->decode(full) && full == orig,
+      "Decoded replay differs from " << TSLPFILE);
+    ASSERT("Frames 1000 through 1999 decode",sr->decodeFrames(1000,1999,clip),
+      "Frames 1000 through 1999 failed to decode");
+    BAILONFAIL(1);
+    ASSERT("Decoded frames only come from the overlapping windows",clip.size() < orig.size() / 5,
+      "Clip is " << clip.size() << " bytes out of " << orig.size());
+    ASSERT("Decoded frames form a valid replay",
+      isEncodedReplay(&clip[0],clip.size()) == false && readBE4U(&clip[11]) == clip.size() - N_HEADER_BYTES,
+      "Clip has raw length " << readBE4U(&clip[11]) << " for " << clip.size() << " bytes");
+    slip::Compressor c(_debug);
+    char* cbuf = &clip[0];
+    ASSERT("Decoded frames encode and validate",c.loadFromBuff(&cbuf,clip.size()) && c.validate(),
+      "Decoded frames failed to encode");
+    ASSERT("Frames outside the replay don't decode",!sr->decodeFrames(20000,30000,clip),
+      "Decoded frames 20000 through 30000");
+    delete sr;
+
+    p = new slip::Parser(_debug);
+    ASSERT("Parser loads seekable replays",p->load(tmpseek.c_str()) && p->replay()->frame_count == 13662,
+      "Parser failed to load " << TSEEKFILE);
+    delete p;
+    ASSERT("Fingerprints of seekable replays match the original",
+      slip::replayFingerprint(tmpseek.c_str()).compare(slip::replayFingerprint(known1.c_str())) == 0,
+      "Fingerprint of " << TSEEKFILE << " differs from " << TSLPFILE);
+
+    {
+      //A window count big enough to wrap the index bounds check around must be rejected, not allocated
+      std::string seek = readFile(tmpseek);
+      slip::SeekFooter foot;
+      memcpy(&foot,&seek[seek.size()-sizeof(slip::SeekFooter)],sizeof(slip::SeekFooter));
+      foot.num_windows  = 0xFFFFFFFF;
+      foot.index_offset = seek.size() - sizeof(slip::SeekFooter) - uint64_t(foot.num_windows) * sizeof(slip::SeekWindow);
+      memcpy(&seek[seek.size()-sizeof(slip::SeekFooter)],&foot,sizeof(slip::SeekFooter));
+      writeFile(tmpseek,seek);
+      sr = new slip::SeekableReplay(_debug);
+      ASSERT("Seekable replay with a wrapping window count is rejected",!sr->open(tmpseek.c_str()),
+        "Opened a seekable replay claiming " << foot.num_windows << " windows");
+      delete sr;
+    }
+    remove(tmpseek.c_str());
+
+    {
+      //Frame start events too short to hold a frame number must be rejected before the frame is read
+      std::string bad = orig;
+      unsigned desc_len = uint8_t(bad[N_HEADER_BYTES+1]);
+      for (unsigned i = N_HEADER_BYTES + 2; i + 3 <= N_HEADER_BYTES + 1 + desc_len; i += 3) {
+        if (uint8_t(bad[i]) == Event::FRAME_START) {
+          writeBE2U(0,&bad[i+1]);
+        }
+      }
+      sr = new slip::SeekableReplay(_debug);
+      ASSERT("Seekable replay refuses a replay with truncated frame start payloads",!sr->create(tmpseek.c_str(),bad),
+        "Created a seekable replay from a replay whose frame start events are 1 byte long");
+      delete sr;
+      remove(tmpseek.c_str());
+    }
+  return 0;
+}
+
+int testPeek() {
+  std::string known1 = (PATH(TESTDIR) / PATH(STANDARDDIR) / PATH(TSLPFILE)).string();
+  std::string summary;
+  slip::PeekHeader header;
+  slip::Parser *full, *peek;
+
+  TSUITE("Replay Peeking");
+    if (fileExists(tmppeek.c_str())) {
+      remove(tmppeek.c_str());
+    }
+    slip::Compressor *c = new slip::Compressor(_debug);
+    c->setOutputFilename(tmppeek.c_str());
+    ASSERT("Compressor Loads File",c->loadFromFile(known1.c_str()) && c->validate(),
+      "Compressor failed to load " << TSLPFILE);
+    BAILONFAIL(1);
+    c->saveToFile(false);
+    std::string plain = readFile(tmppeek);
+    ASSERT("Compressed files have no peek header by default",
+      !slip::readPeekHeader(tmppeek.c_str(),summary,header) && !decompressWithLzma(plain.c_str(),plain.size()).empty(),
+      TPEEKFILE << " is not a plain .xz stream");
+    delete c;
+    remove(tmppeek.c_str());
+
+    c = new slip::Compressor(_debug);
+    c->setOutputFilename(tmppeek.c_str());
+    c->setPeekable(true);
+    ASSERT("Compressor Loads File for Peekable Compression",c->loadFromFile(known1.c_str()) && c->validate(),
+      "Compressor failed to load " << TSLPFILE);
+    BAILONFAIL(1);
+    c->saveToFile(false);
+    ASSERT("Compressed file with peek header verifies",c->verifySavedFile(),
+      "Contents of " << TPEEKFILE << " do not match " << TSLPFILE);
+    delete c;
+    ASSERT("Compressed file has a peek header",slip::readPeekHeader(tmppeek.c_str(),summary,header),
+      "No peek header found in " << TPEEKFILE);
+    BAILONFAIL(1);
+    ASSERT("Peek summary is small and stored compressed",
+      summary.size() < 4096 && header.comp_size < summary.size() && header.last_frame == 13538,
+      "Peek summary is " << summary.size() << " bytes (" << header.comp_size << " compressed) ending at frame "
+      << header.last_frame);
+    {
+      //Readers that predate the peek header must see neither an .xz stream nor a replay
+      std::string pk = readFile(tmppeek);
+      ASSERT("Files with peek headers are rejected by older readers",
+        !same4(&pk[0],LZMA_HEADER) && !same8(&pk[0],SLP_HEADER) && decompressWithLzma(pk.c_str(),pk.size()).empty(),
+        TPEEKFILE << " looks like a plain .xz stream or replay");
+      std::string enc = decompressWithLzma(plain.c_str(),plain.size());
+      ASSERT("MD5 of a peekable file's contents skips the peek header",
+        md5compressed(tmppeek) == md5data(reinterpret_cast<unsigned char*>(&enc[0]),enc.size()),
+        "MD5 of the contents of " << TPEEKFILE << " differs from the same replay without a peek header");
+      pk[8] = char(PEEK_VERSION + 1);
+      std::string decomp;
+      ASSERT("Peek headers of unknown versions are rejected",!slip::decompressReplay(pk.c_str(),pk.size(),decomp),
+        "Decompressed a file with an unknown peek header version");
+      writeFile(tmppeek,pk);
+      ASSERT("MD5 of an undecodable file's contents is empty",md5compressed(tmppeek).empty(),
+        "Got an MD5 for a file that can't be decompressed");
+      pk[8] = char(PEEK_VERSION);
+      writeFile(tmppeek,pk);
+    }
+    ASSERT("Fingerprints of files with peek headers match the original",
+      slip::replayFingerprint(tmppeek.c_str()).compare(slip::replayFingerprint(known1.c_str())) == 0,
+      "Fingerprint of " << TPEEKFILE << " differs from " << TSLPFILE);
+
+    full = new slip::Parser(_debug);
+    peek = new slip::Parser(_debug);
+    ASSERT("Parser loads file with peek header",full->load(tmppeek.c_str()),
+      "Parser failed to load " << TPEEKFILE);
+    ASSERT("Parser peeks at file with peek header",peek->peek(tmppeek.c_str()),
+      "Parser failed to peek at " << TPEEKFILE);
+    BAILONFAIL(2);
+    const SlippiReplay *fr = full->replay(), *pr = peek->replay();
+    ASSERT("Peeked frame count matches",pr->frame_count == fr->frame_count && pr->last_frame == fr->last_frame,
+      "Peeked " << pr->frame_count << " frames, but loaded " << fr->frame_count);
+    ASSERT("Peeked game settings match",pr->stage == fr->stage && pr->slippi_version == fr->slippi_version
+      && pr->seed == fr->seed && pr->game_start_raw == fr->game_start_raw,
+      "Peeked stage " << pr->stage << ", but loaded " << fr->stage);
+    ASSERT("Peeked results match",pr->winner_id == fr->winner_id && pr->end_type == fr->end_type
+      && pr->lras == fr->lras,
+      "Peeked winner " << +pr->winner_id << ", but loaded " << +fr->winner_id);
+    ASSERT("Peeked metadata matches",pr->start_time == fr->start_time && pr->played_on == fr->played_on
+      && !pr->start_time.empty(),
+      "Peeked start time " << pr->start_time << ", but loaded " << fr->start_time);
+    bool players_match = true;
+    for (unsigned q = 0; q < 4; ++q) {
+      players_match = players_match && pr->player[q].ext_char_id == fr->player[q].ext_char_id
+        && pr->player[q].end_stocks == fr->player[q].end_stocks && pr->player[q].tag == fr->player[q].tag;
+    }
+    ASSERT("Peeked players match",players_match,
+      "Peeked players differ from loaded players");
+    ASSERT("Peeking reads no frames",pr->player[0].frame == nullptr && pr->num_items == 0,
+      "Peeked replay has frame data");
+    slip::Analysis *a = peek->analyze();
+    ASSERT("Peeked replays refuse analysis",!a->success,
+      "Analyzed a peeked replay");
+    delete a;
+    delete peek;
+
+    peek = new slip::Parser(_debug);
+    ASSERT("Parser peeks at files without a peek header",peek->peek(known1.c_str())
+      && peek->replay()->frame_count == fr->frame_count && peek->replay()->winner_id == fr->winner_id,
+      "Parser failed to peek at " << TSLPFILE);
+    delete peek;
+    delete full;
+
+    remove(tmppeek.c_str());
+  return 0;
+}
+
+int testPresetDict() {
+  std::string shortgame = (PATH(TESTDIR) / PATH(STANDARDDIR) / PATH(TSHORTFILE)).string();
+  std::vector<std::string> files;
+  for (const std::string &f : TDICTTRAIN) {
+    files.push_back((PATH(TESTDIR) / PATH(STANDARDDIR) / PATH(f)).string());
+  }
+  std::string dict, enc, comp, dec;
+  LzmaOptions o;
+
+  TSUITE("Preset Dictionaries");
+    ASSERT("Dictionary trains on known files",slip::trainLzmaDict(files,0,_debug,dict),
+      "Failed to train a dictionary");
+    BAILONFAIL(1);
+    ASSERT("Dictionary takes the start of each replay",dict.size() == files.size() * DICT_SAMPLE,
+      "Dictionary is " << dict.size() << " bytes");
+    ASSERT("Dictionary refuses to train on missing files",!slip::trainLzmaDict({"missing.slp"},1,_debug,enc),
+      "Trained a dictionary from a missing file");
+    o.dict = slip::registerLzmaDict(dict);
+    ASSERT("Registered dictionary is hashed by content",slip::lzmaDictHash(*o.dict) == md5data(
+      reinterpret_cast<unsigned char*>(&dict[0]),dict.size()),
+      "Dictionary hash is " << slip::lzmaDictHash(*o.dict));
+
+    ASSERT("Short game encodes",slip::encodeReplayFile(shortgame,_debug,enc),
+      "Could not encode " << TSHORTFILE);
+    BAILONFAIL(1);
+    ASSERT("Short game compresses with dictionary",slip::compressWithDict(enc.c_str(),enc.size(),o,comp)
+      && slip::isDictCoded(comp.c_str(),comp.size()) && isCompressedReplay(comp.c_str(),comp.size()),
+      "Failed to compress " << TSHORTFILE << " with dictionary");
+    BAILONFAIL(1);
+    ASSERT("Short game decompresses with dictionary",slip::decompressWithDict(comp.c_str(),comp.size(),dec)
+      && dec == enc,
+      "Decompressed " << TSHORTFILE << " differs from its encoding");
+    size_t plain = compressWithLzma(enc.c_str(),enc.size()).size();
+    ASSERT("Dictionary shrinks short game by at least 5%",comp.size() * 20 < plain * 19,
+      "Compressed with dictionary to " << comp.size() << " bytes vs. " << plain << " without");
+    comp[20] ^= 0xff;
+    ASSERT("Unregistered dictionaries don't decompress",!slip::decompressWithDict(comp.c_str(),comp.size(),dec),
+      "Decompressed with an unregistered dictionary");
+
+    if (fileExists(tmpdict.c_str())) {
+      remove(tmpdict.c_str());
+    }
+    slip::Compressor *c = new slip::Compressor(_debug);
+    c->setOutputFilename(tmpdict.c_str());
+    c->setLzmaOptions(o);
+    ASSERT("Compressor Loads File",c->loadFromFile(shortgame.c_str()) && c->validate(),
+      "Compressor failed to load " << TSHORTFILE);
+    BAILONFAIL(1);
+    c->saveToFile(false);
+    ASSERT("Compressed file with dictionary verifies",c->verifySavedFile(),
+      "Contents of " << TDICTFILE << " do not match " << TSHORTFILE);
+    delete c;
+    slip::Parser *p = new slip::Parser(_debug);
+    ASSERT("Parser loads file compressed with dictionary",p->load(tmpdict.c_str()) && p->replay()->frame_count > 0,
+      "Parser failed to load " << TDICTFILE);
+    delete p;
+    ASSERT("Fingerprints of files compressed with dictionaries match the original",
+      slip::replayFingerprint(tmpdict.c_str()).compare(slip::replayFingerprint(shortgame.c_str())) == 0,
+      "Fingerprint of " << TDICTFILE << " differs from " << TSHORTFILE);
+
+    remove(tmpdict.c_str());
+  return 0;
+}
+
+int testTunedCompression() {
+  std::string known2 = (PATH(TESTDIR) / PATH(STANDARDDIR) / PATH(TCMPFILE)).string();
+  std::string enc, comp;
+  std::vector<size_t> sizes;
+  LzmaOptions o;
+  o.threads = 0;
+
+  TSUITE("Tuned Compression");
+    ASSERT("Known file encodes",slip::encodeReplayFile(known2,_debug,enc),
+      "Could not encode " << TCMPFILE);
+    BAILONFAIL(1);
+    int chain = slip::compressWithLzmaTuned(enc.c_str(),enc.size(),o,comp,&sizes);
+    ASSERT("Tuned compression tries every candidate",chain >= 0 && sizes.size() == slip::lzmaTuneChains().size(),
+      "Tuned compression returned " << chain << " with " << sizes.size() << " sizes");
+    BAILONFAIL(1);
+    ASSERT("Tuned compression keeps the smallest output",comp.size() == sizes[chain]
+      && comp.size() == *std::min_element(sizes.begin(),sizes.end()),
+      "Kept " << comp.size() << " bytes from " << slip::lzmaTuneChains()[chain].name);
+    ASSERT("First candidate matches untuned compression",sizes[0] == compressWithLzma(enc.c_str(),enc.size()).size(),
+      "First candidate compressed to " << sizes[0] << " bytes");
+    ASSERT("Tuned output decompresses as a normal .xz stream",decompressWithLzma(comp.c_str(),comp.size()) == enc,
+      "Tuned output of " << TCMPFILE << " does not round trip");
+
+    if (fileExists(tmpzlp.c_str())) {
+      remove(tmpzlp.c_str());
+    }
+    o.tune = true;
+    slip::Compressor *c = new slip::Compressor(_debug);
+    c->setOutputFilename(tmpzlp.c_str());
+    c->setLzmaOptions(o);
+    ASSERT("Compressor Loads File",c->loadFromFile(known2.c_str()) && c->validate(),
+      "Compressor failed to load " << TCMPFILE);
+    BAILONFAIL(1);
+    c->saveToFile(false);
+    ASSERT("Tuned compressed file verifies",c->verifySavedFile(),
+      "Contents of " << TZLPFILE << " do not match " << TCMPFILE);
+    delete c;
+    std::ifstream f(tmpzlp, std::ios::binary | std::ios::in);
+    std::string saved((std::istreambuf_iterator<char>(f)),std::istreambuf_iterator<char>());
+    ASSERT("Tuned compressed file holds the smallest stream",saved.compare(0,comp.size(),comp) == 0,
+      TZLPFILE << " differs from the tuned stream");
+
+    remove(tmpzlp.c_str());
+  return 0;
+}
+
+int testCompressorReuse() {
+  std::string known2    = (PATH(TESTDIR) / PATH(STANDARDDIR) / PATH(TCMPFILE)).string();
+  std::string older     = (PATH(TESTDIR) / PATH(STANDARDDIR) / PATH(TOLDFILE)).string();
+  std::string compat    = (*f_iter(PATH(TESTDIR) / PATH(BACKCOMPATDIRS[0]))).path().string();
+  std::string fresh_known, fresh_old, fresh_compat, enc;
+  slip::Compressor r(_debug);
+
+  TSUITE("Compressor Reuse");
+    ASSERT("Compressor stays small",sizeof(slip::Compressor) < 4096,
+      "Compressor is " << sizeof(slip::Compressor) << " bytes");
+    ASSERT("Known files encode with fresh compressors",slip::encodeReplayFile(known2,_debug,fresh_known)
+      && slip::encodeReplayFile(older,_debug,fresh_old) && slip::encodeReplayFile(compat,_debug,fresh_compat),
+      "Could not encode known files");
+    BAILONFAIL(1);
+    ASSERT("Reused compressor encodes first replay identically",
+      slip::encodeReplayFile(known2,_debug,enc,nullptr,nullptr,&r) && enc == fresh_known,
+      "Reused compressor's encoding of " << TCMPFILE << " differs");
+    ASSERT("Reused compressor decodes and re-encodes old .zlp identically",
+      slip::encodeReplayFile(compat,_debug,enc,nullptr,nullptr,&r) && enc == fresh_compat,
+      "Reused compressor's encoding of " << compat << " differs");
+    ASSERT("Reused compressor encodes an older replay identically",
+      slip::encodeReplayFile(older,_debug,enc,nullptr,nullptr,&r) && enc == fresh_old,
+      "Reused compressor's encoding of " << TOLDFILE << " differs");
+    ASSERT("Reused compressor encodes a newer replay after an older one identically",
+      slip::encodeReplayFile(known2,_debug,enc,nullptr,nullptr,&r) && enc == fresh_known,
+      "Reused compressor's encoding of " << TCMPFILE << " differs the second time");
+
+    r.reset();
+    ASSERT("Reset compressor loads and validates a file",r.loadFromFile(older.c_str()) && r.validate(),
+      "Reset compressor failed to validate " << TOLDFILE);
+    r.reset();
+    ASSERT("Reset compressor validates after a different file",r.loadFromFile(known2.c_str()) && r.validate(),
+      "Reset compressor failed to validate " << TCMPFILE << " after " << TOLDFILE);
+  return 0;
+}
+
+int testItemIdJumps() {
+  std::string items = (PATH(TESTDIR) / PATH(STANDARDDIR) / PATH(TITEMFILE)).string();
+  std::string enc, raw;
+
+  TSUITE("Item Id Jumps");
+    ASSERT("Item replay encodes",slip::encodeReplayFile(items,_debug,enc,nullptr,&raw),
+      "Could not encode " << TITEMFILE);
+    BAILONFAIL(1);
+
+    // Find every item update event and the largest item id in the raw replay
+    unsigned sizes[256] = {0};
+    unsigned desc_len   = uint8_t(raw[N_HEADER_BYTES+1]);
+    for (unsigned i = 1; i < desc_len; i += 3) {
+      sizes[uint8_t(raw[N_HEADER_BYTES+1+i])] = readBE2U(&raw[N_HEADER_BYTES+2+i]) + 1;
+    }
+    std::vector<unsigned> item_events;
+    uint32_t max_id = 0;
+    unsigned raw_end = N_HEADER_BYTES + readBE4U(&raw[11]);
+    for (unsigned b = N_HEADER_BYTES + 1 + desc_len; b < raw_end && sizes[uint8_t(raw[b])] > 0; b += sizes[uint8_t(raw[b])]) {
+      if (uint8_t(raw[b]) == Event::ITEM_UPDATE) {
+        item_events.push_back(b);
+        max_id = std::max(max_id,readBE4U(&raw[b+slip::O_ITEM_ID]));
+      }
+    }
+    ASSERT("Item replay has items",max_id > 0,
+      TITEMFILE << " has no item update events");
+    BAILONFAIL(1);
+
+    // Push the ids of the later half of the items up so one new item's id delta no longer fits in a byte
+    for (unsigned b : item_events) {
+      uint32_t id = readBE4U(&raw[b+slip::O_ITEM_ID]);
+      if (id > max_id / 2) {
+        writeBE4U(id + 1000,&raw[b+slip::O_ITEM_ID]);
+      }
+    }
+    slip::Compressor *c = new slip::Compressor(_debug);
+    char* p = &raw[0];
+    ASSERT("Replay with an item id jump over 255 fails to encode",!c->loadFromBuff(&p,raw.size()),
+      "Encoded a replay whose item ids jump by more than 255");
+    delete c;
+  return 0;
+}
+
+int testUpgrade() {
+  PATH compat      = (*f_iter(PATH(TESTDIR) / PATH(BACKCOMPATDIRS[0]))).path();
+  std::string md5  = compat.stem().string().substr(0,32);
+  std::string known2 = (PATH(TESTDIR) / PATH(STANDARDDIR) / PATH(TCMPFILE)).string();
+  std::string enc, decomp;
+  uint8_t digest[PICOHASH_MD5_DIGEST_LENGTH];
+  bool upgraded = false;
+
+  TSUITE("Compressed Replay Upgrades");
+    std::filesystem::copy_file(compat,tmpupg,std::filesystem::copy_options::overwrite_existing);
+    std::string old = readFile(tmpupg);
+    decompressReplay(old.c_str(),old.size(),decomp);
+    ASSERT("Old .zlp is encoded with an older version",encodedVersion(&decomp[0],decomp.size()) < COMPRETZ_VERSION,
+      compat << " is encoded with version " << +encodedVersion(&decomp[0],decomp.size()));
+    BAILONFAIL(1);
+    ASSERT("Old .zlp upgrades",slip::upgradeReplayFile(tmpupg,_debug,upgraded) && upgraded,
+      "Failed to upgrade " << compat);
+    BAILONFAIL(1);
+    std::string upg = readFile(tmpupg);
+    ASSERT("Upgraded .zlp is encoded with the current version",decompressReplay(upg.c_str(),upg.size(),decomp)
+      && encodedVersion(&decomp[0],decomp.size()) == COMPRETZ_VERSION,
+      TUPGFILE << " is encoded with version " << +encodedVersion(&decomp[0],decomp.size()));
+    ASSERT("Upgraded .zlp decodes to the original replay",slip::encodeReplayFile(tmpupg,_debug,enc,digest)
+      && md5tostring(digest) == md5,
+      TUPGFILE << " decodes to a replay with MD5 " << md5tostring(digest));
+    ASSERT("Upgrade leaves no temporary file",!fileExists(tmpupg+".tmp"),
+      "Upgrade left " << TUPGFILE << ".tmp behind");
+    ASSERT("Current .zlp is left alone",slip::upgradeReplayFile(tmpupg,_debug,upgraded) && !upgraded
+      && readFile(tmpupg) == upg,
+      "Upgraded " << TUPGFILE << " twice");
+    ASSERT("Uncompressed replays are left alone",slip::upgradeReplayFile(known2,_debug,upgraded) && !upgraded,
+      "Upgraded " << TCMPFILE);
+
+    old.resize(old.size() / 2);
+    writeFile(tmpupg,old);
+    ASSERT("Truncated .zlp does not upgrade",!slip::upgradeReplayFile(tmpupg,_debug,upgraded) && !upgraded,
+      "Upgraded a truncated copy of " << compat);
+    ASSERT("Truncated .zlp is left in place",readFile(tmpupg) == old && !fileExists(tmpupg+".tmp"),
+      "Failed upgrade changed " << TUPGFILE);
+
+    remove(tmpupg.c_str());
+  return 0;
+}
+
 int testKnownFiles() {
   std::string known1 = (PATH(TESTDIR) / PATH(STANDARDDIR) / PATH(TSLPFILE)).string();
   std::string known2 = (PATH(TESTDIR) / PATH(STANDARDDIR) / PATH(TCMPFILE)).string();
@@ -340,7 +1093,7 @@ int testKnownFiles() {
     delete c;
 
     std::string test_md5_z = md5file(tmpzlp.c_str());
-    SUGGEST("MD5 of compressed file is 8af440882c30c4ac29b935ae3d588e03",test_md5_z.compare("8af440882c30c4ac29b935ae3d588e03") == 0,
+    SUGGEST("MD5 of compressed file is 2f974abc06941aabb601907e5bb48aca",test_md5_z.compare("2f974abc06941aabb601907e5bb48aca") == 0,
       "MD5 of file is " << test_md5_z << ", compression algorithm may have changed");
 
     c = new slip::Compressor(_debug);
@@ -360,12 +1113,190 @@ int testKnownFiles() {
     ASSERT("MD5 of restored file is 7ea1aa5b49f87ab77a66bd8541810d50",test_md5_3.compare("7ea1aa5b49f87ab77a66bd8541810d50") == 0,
       "MD5 of restored file is " << test_md5_3);
 
+    {
+      //Decoding in memory moves buffers instead of copying them, and must give the same replay
+      std::ifstream zf(tmpzlp, std::ios::binary | std::ios::in);
+      std::string comp((std::istreambuf_iterator<char>(zf)),std::istreambuf_iterator<char>());
+      std::string buf, restored;
+      ASSERT("Compressed File Decompresses In Memory",slip::decompressReplay(comp.c_str(),comp.size(),buf),
+        "Could not decompress " << TZLPFILE);
+      BAILONFAIL(1);
+      ASSERT("LZMA Index Gives Decompressed Size",
+        lzmaDecodedSize(reinterpret_cast<const uint8_t*>(comp.c_str()),comp.size()) == buf.size(),
+        "Decompressed size differs from the size in the LZMA index");
+      slip::Compressor d(_debug);
+      ASSERT("Compressor Decodes Buffer In Place",d.decodeBuff(buf),
+        "Compressor failed to decode " << TZLPFILE << " in memory");
+      std::ifstream uf(tmpunzlp, std::ios::binary | std::ios::in);
+      restored.assign((std::istreambuf_iterator<char>(uf)),std::istreambuf_iterator<char>());
+      ASSERT("Buffer Decoded In Place Matches Restored File",buf == restored,
+        "Buffer decoded in place differs from " << TUNZLPFILE);
+      slip::Compressor r(_debug);
+      ASSERT("Compressor Refuses To Decode Unencoded Buffer",!r.decodeBuff(restored) && !restored.empty(),
+        "Compressor decoded an unencoded replay");
+    }
+
+    {
+      //A tiny .xz whose index claims a huge block must not size the output from that claim
+      std::string xz(LZMA_STREAM_HEADER_SIZE + 64, '\0');
+      lzma_stream_flags flags;
+      flags.version = 0;
+      flags.check   = LZMA_CHECK_NONE;
+      ASSERT("Crafted LZMA Stream Header Encodes",
+        lzma_stream_header_encode(&flags, reinterpret_cast<uint8_t*>(&xz[0])) == LZMA_OK,
+        "Could not encode the crafted stream header");
+      BAILONFAIL(1);
+      lzma_index* index = lzma_index_init(nullptr);
+      std::string ibuf;
+      size_t ipos = 0;
+      bool indexed = index != nullptr && lzma_index_append(index, nullptr, 64, uint64_t(900) << 20) == LZMA_OK;
+      if (indexed) {
+        ibuf.assign(lzma_index_size(index), '\0');
+        indexed = lzma_index_buffer_encode(index, reinterpret_cast<uint8_t*>(&ibuf[0]), &ipos, ibuf.size()) == LZMA_OK;
+      }
+      lzma_index_end(index, nullptr);
+      ASSERT("Crafted LZMA Index Encodes",indexed,
+        "Could not encode the crafted index");
+      BAILONFAIL(1);
+      flags.backward_size = ibuf.size();
+      std::string footer(LZMA_STREAM_HEADER_SIZE, '\0');
+      ASSERT("Crafted LZMA Stream Footer Encodes",
+        lzma_stream_footer_encode(&flags, reinterpret_cast<uint8_t*>(&footer[0])) == LZMA_OK,
+        "Could not encode the crafted stream footer");
+      BAILONFAIL(1);
+      xz += ibuf + footer;
+      const uint8_t* x = reinterpret_cast<const uint8_t*>(xz.c_str());
+      ASSERT("Crafted LZMA Index Claims A Huge Size",lzmaDecodedSize(x,xz.size()) == (uint64_t(900) << 20),
+        "Could not read back the crafted LZMA index");
+      ASSERT("Output Hint Is Bounded By Input Size",lzmaOutputHint(x,xz.size()) <= 256*xz.size()+1,
+        "Output hint of " << lzmaOutputHint(x,xz.size()) << " bytes for a " << xz.size() << " byte input");
+      ASSERT("Crafted LZMA Stream Fails To Decompress",decompressWithLzma(x,xz.size()).empty(),
+        "Decompressed a stream with no valid blocks");
+    }
+
+    //Multithreaded LZMA output must still be readable by the regular decompressor
+    remove(tmpzlp.c_str());
+    remove(tmpunzlp.c_str());
+    LzmaOptions lzma;
+    lzma.threads    = 2;
+    lzma.block_size = 1 << 20;
+    c = new slip::Compressor(_debug);
+    c->setOutputFilename(tmpzlp.c_str());
+    c->setLzmaOptions(lzma);
+    ASSERT("Compressor Loads File for Threaded Compression",c->loadFromFile(known2.c_str()),
+      "Compressor failed to load known file");
+    BAILONFAIL(1);
+    c->saveToFile(false);
+    ASSERT("Saved Threaded Compressed File Verifies",c->verifySavedFile(),
+      "Saved file does not match the validated replay");
+    {
+      //Flip a byte in the middle of the saved file, make sure verification catches it, then restore it
+      std::fstream f(tmpzlp, std::ios::binary | std::ios::in | std::ios::out);
+      f.seekg(0, f.end);
+      std::streamoff mid = f.tellg() / 2;
+      char orig;
+      f.seekg(mid);
+      f.get(orig);
+      f.seekp(mid);
+      f.put(char(orig ^ 0x55));
+      f.flush();
+      ASSERT("Corrupted Saved File Fails Verification",!c->verifySavedFile(),
+        "Verification did not catch a corrupted byte");
+      f.seekp(mid);
+      f.put(orig);
+    }
+    delete c;
+    c = new slip::Compressor(_debug);
+    c->setOutputFilename(tmpunzlp.c_str());
+    ASSERT("Compressor Loads Threaded Compressed File",c->loadFromFile(tmpzlp.c_str()),
+      "Compressor failed to load threaded compressed file");
+    BAILONFAIL(1);
+    c->saveToFile(false);
+    delete c;
+    std::string test_md5_4 = md5file(tmpunzlp.c_str());
+    ASSERT("MD5 of file restored from threaded compression is 7ea1aa5b49f87ab77a66bd8541810d50",test_md5_4.compare("7ea1aa5b49f87ab77a66bd8541810d50") == 0,
+      "MD5 of restored file is " << test_md5_4);
+
+    //Presets other than the default must round trip too
+    uint32_t preset = 0;
+    ASSERT("Compression level 9e parses",parseLzmaLevel("9e",preset) && preset == (9 | LZMA_PRESET_EXTREME),
+      "Compression level 9e parsed as " << preset);
+    ASSERT("Compression level 10 is rejected",!parseLzmaLevel("10",preset),
+      "Compression level 10 parsed as " << preset);
+    remove(tmpzlp.c_str());
+    remove(tmpunzlp.c_str());
+    lzma = LzmaOptions();
+    parseLzmaLevel("0",lzma.preset);
+    c = new slip::Compressor(_debug);
+    c->setOutputFilename(tmpzlp.c_str());
+    c->setLzmaOptions(lzma);
+    ASSERT("Compressor Loads File for Level 0 Compression",c->loadFromFile(known2.c_str()),
+      "Compressor failed to load known file");
+    BAILONFAIL(1);
+    c->saveToFile(false);
+    delete c;
+    c = new slip::Compressor(_debug);
+    c->setOutputFilename(tmpunzlp.c_str());
+    ASSERT("Compressor Loads Level 0 Compressed File",c->loadFromFile(tmpzlp.c_str()),
+      "Compressor failed to load level 0 compressed file");
+    BAILONFAIL(1);
+    c->saveToFile(false);
+    delete c;
+    std::string test_md5_5 = md5file(tmpunzlp.c_str());
+    ASSERT("MD5 of file restored from level 0 compression is 7ea1aa5b49f87ab77a66bd8541810d50",test_md5_5.compare("7ea1aa5b49f87ab77a66bd8541810d50") == 0,
+      "MD5 of restored file is " << test_md5_5);
+
+    //The column model coder must round trip, and readers must recognize its header
+    remove(tmpzlp.c_str());
+    remove(tmpunzlp.c_str());
+    c = new slip::Compressor(_debug);
+    c->setOutputFilename(tmpzlp.c_str());
+    c->setColumnCoder(true);
+    ASSERT("Compressor Loads File for Column Model Compression",c->loadFromFile(known2.c_str()),
+      "Compressor failed to load known file");
+    BAILONFAIL(1);
+    c->saveToFile(false);
+    ASSERT("Saved Column Model Compressed File Verifies",c->verifySavedFile(),
+      "Saved file does not match the validated replay");
+    delete c;
+    {
+      std::ifstream f(tmpzlp, std::ios::binary | std::ios::in);
+      std::string comp((std::istreambuf_iterator<char>(f)),std::istreambuf_iterator<char>());
+      std::string decomp;
+      ASSERT("Column Model Compressed File Has Column Model Header",slip::isColumnCoded(comp.c_str(),comp.size()),
+        "File does not start with the column model header");
+      ASSERT("Truncated Column Model Header Is Rejected",!slip::decompressWithColumns(comp.c_str(),CM_HEADER_SIZE-1,decomp),
+        "Decompressor accepted a truncated header");
+      comp[4] = char(CM_VERSION+1);
+      ASSERT("Unknown Column Model Version Is Rejected",!slip::decompressWithColumns(comp.c_str(),comp.size(),decomp),
+        "Decompressor accepted an unknown version");
+      comp[4] = char(CM_VERSION);
+      comp[8] ^= 0x01;  //Segment sizes no longer add up to the replay size
+      ASSERT("Inconsistent Column Model Segment Table Is Rejected",!slip::decompressWithColumns(comp.c_str(),comp.size(),decomp),
+        "Decompressor accepted a segment table that does not cover the replay");
+    }
+    c = new slip::Compressor(_debug);
+    c->setOutputFilename(tmpunzlp.c_str());
+    ASSERT("Compressor Loads Column Model Compressed File",c->loadFromFile(tmpzlp.c_str()),
+      "Compressor failed to load column model compressed file");
+    BAILONFAIL(1);
+    c->saveToFile(false);
+    delete c;
+    std::string test_md5_6 = md5file(tmpunzlp.c_str());
+    ASSERT("MD5 of file restored from column model compression is 7ea1aa5b49f87ab77a66bd8541810d50",test_md5_6.compare("7ea1aa5b49f87ab77a66bd8541810d50") == 0,
+      "MD5 of restored file is " << test_md5_6);
+    std::string print_cm = slip::replayFingerprint(tmpzlp.c_str());
+    std::string print_un = slip::replayFingerprint(tmpunzlp.c_str());
+    ASSERT("Column Model Compressed File Has Original Fingerprint",print_cm == print_un && !print_cm.empty(),
+      "Fingerprints " << print_cm << " and " << print_un << " differ");
+
   return 0;
 }
 
 int testCompressionBackcompat() {
   TSUITE("Backwards Compatible Decompression");
-    for (const f_entry & entry : f_iter(PATH(TESTDIR) / PATH(BACKCOMPATDIR))) {
+  for (const std::string & dir : BACKCOMPATDIRS) {
+    for (const f_entry & entry : f_iter(PATH(TESTDIR) / PATH(dir))) {
       std::string path        = entry.path().string();
       std::string name        = entry.path().stem().string();
       // md5 checksum is first 32 characters of filename
@@ -400,7 +1331,13 @@ int testCompressionBackcompat() {
       std::string test_md5_r = md5file(tmpunzlp.c_str());
       ASSERT("MD5 of restored file for "+name+" is "+test_md5_o,test_md5_r.compare(test_md5_o) == 0,
         "MD5 of restored file for " << name << " is " << test_md5_r);
+
+      slip::Parser *p = new slip::Parser(_debug);
+      ASSERT("Parser Loads Compressed "+name,p->load(path.c_str()),
+        "Parser failed to load compressed " << name);
+      delete p;
     }
+  }
     return 0;
 }
 
@@ -486,6 +1423,19 @@ int runtests(int argc, char** argv) {
   testCorruptFiles();
   testCompressionBackcompat();
   testConsistencySanity();
+  testAggregate();
+  testCatalog();
+  testFingerprints();
+  testLegacyRNG();
+  testBitColumns();
+  testArchive();
+  testSeekable();
+  testPeek();
+  testPresetDict();
+  testTunedCompression();
+  testCompressorReuse();
+  testItemIdJumps();
+  testUpgrade();
   if(testlevel >= 1) {
     testCompressionVersions();
   }
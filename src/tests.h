@@ -7,7 +7,12 @@
 #include "util.h"
 #include "parser.h"
 #include "analyzer.h"
+#include "aggregate.h"
+#include "catalog.h"
+#include "archive.h"
 #include "compressor.h"
+#include "lzmadict.h"
+#include "lzmatune.h"
 
 #ifdef _WIN32
 #include <Windows.h> //sleep()
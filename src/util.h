@@ -19,6 +19,11 @@
 #include <algorithm> //std::find
 #include <sys/stat.h> //std::find
 #include <filesystem>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <vector>
 
 #include "lzma.h"
 #include "picohash.h"
@@ -47,6 +52,8 @@ const unsigned MIN_REPLAY_LENGTH   = N_HEADER_BYTES + MIN_EV_PAYLOAD_SIZE + MIN_
 
 // Variable checking whether error log has been initialized
 static bool errlog_init = false;
+// Mutex guarding the error log when processing files in parallel
+static std::mutex errlog_mutex;
 
 //Debug output convenience macros
 #define DOUT1(s) if (_debug >= 1) { std::cerr << "  " << BLU << "DEBUG 1: " << BLN << s << std::endl; }
@@ -65,14 +72,15 @@ static bool errlog_init = false;
   std::ofstream log(f, std::ios_base::app | std::ios_base::out); \
   log << "  [" << timestamp() << "] " << e << std::endl; \
   log.close(); };
-#define ERRLOG(path,e) \
+#define ERRLOG(path,e) { \
+  std::lock_guard<std::mutex> errlog_lock(errlog_mutex); \
   PATH errorpath = (path / "_errors.txt"); \
   if (!errlog_init) { \
     errlog_init = true; \
     _LOG("Logging errors to " << MGN << errorpath << BLN); \
     LOG("Log opened",errorpath); \
   } \
-  LOG(e,errorpath);
+  LOG(e,errorpath); };
 
 // ANSI color codes don't work on Windows (I think?)
 #ifdef _WIN32
@@ -447,25 +455,173 @@ inline std::string floatToBinary(float f) {
   return temp;
 }
 
-// http://ptspts.blogspot.com/2011/11/how-to-simply-compress-c-string-with.html
-inline std::string compressWithLzma(const char* in, const size_t inlen, int level = 6) {
+//Settings for compressing a buffer into an .xz stream
+struct LzmaOptions {
+  uint32_t preset     = 6;  //LZMA preset level (optionally OR'd with LZMA_PRESET_EXTREME)
+  uint32_t dict_size  = 0;  //LZMA2 dictionary size in bytes (0 = preset default)
+  unsigned threads    = 1;  //Number of encoder threads (0 = one per CPU core)
+  uint64_t block_size = 0;  //Bytes of input per independently compressed .xz block when threaded (0 = split evenly among threads)
+  const std::string* dict = nullptr;  //Preset dictionary to prime a raw LZMA2 stream with (see lzmadict.h)
+  int      lc         = -1; //LZMA2 literal context bits (-1 = preset default)
+  int      lp         = -1; //LZMA2 literal position bits (-1 = preset default)
+  int      pb         = -1; //LZMA2 position bits (-1 = preset default)
+  bool     tune       = false;  //Try several lc / lp / pb settings and keep the smallest output (see lzmatune.h)
+};
+
+//Parse an xz-style compression level ("0" through "9", optionally followed by "e" for extreme)
+inline bool parseLzmaLevel(const char* level, uint32_t &preset) {
+  if (!level || level[0] < '0' || level[0] > '9') {
+    return false;
+  }
+  if (level[1] == '\0') {
+    preset = level[0] - '0';
+    return true;
+  }
+  if ((level[1] == 'e' || level[1] == 'E') && level[2] == '\0') {
+    preset = (level[0] - '0') | LZMA_PRESET_EXTREME;
+    return true;
+  }
+  return false;
+}
+
+//Inverse of parseLzmaLevel()
+inline std::string lzmaLevelName(uint32_t preset) {
+  std::string name = std::to_string(preset & LZMA_PRESET_LEVEL_MASK);
+  if (preset & LZMA_PRESET_EXTREME) {
+    name += "e";
+  }
+  return name;
+}
+
+//Compress a buffer into an .xz stream, handing the output to sink in fixed-size chunks as it is produced
+//  (so the compressed stream never has to be held in memory), using an explicit preset / dictionary
+//  and (optionally) multithreaded encoding
+//  Threaded output is split into independent .xz blocks, so it compresses slightly worse,
+//  but is still a single .xz stream that decompressWithLzma() reads as usual
+//  Returns false if encoding fails or sink returns false
+inline bool compressWithLzmaStream(const char* in, const size_t inlen, const LzmaOptions &o,
+  const std::function<bool(const char*,size_t)> &sink) {
+  const size_t CHUNK = 65536;
+  unsigned threads = (o.threads == 0) ? std::max(1u,std::thread::hardware_concurrency()) : o.threads;
+
+  lzma_options_lzma opt;
+  if (lzma_lzma_preset(&opt, o.preset)) {
+    return false;
+  }
+  if (o.dict_size > 0) {
+    opt.dict_size = std::max(uint32_t(LZMA_DICT_SIZE_MIN),o.dict_size);
+  }
+  // lc / lp / pb are stored in the LZMA2 chunk headers, so the decoder needs no extra settings
+  if (o.lc >= 0) {
+    opt.lc = o.lc;
+  }
+  if (o.lp >= 0) {
+    opt.lp = o.lp;
+  }
+  if (o.pb >= 0) {
+    opt.pb = o.pb;
+  }
+  lzma_filter filters[] = {
+    { LZMA_FILTER_LZMA2, &opt },
+    { LZMA_VLI_UNKNOWN,  NULL },
+  };
+
+  lzma_stream strm = LZMA_STREAM_INIT;
+  lzma_ret ret;
+  if (threads == 1) {
+    ret = lzma_stream_encoder(&strm, filters, LZMA_CHECK_CRC32);
+  } else {
+    // without an explicit block size, give every thread one block's worth of the input
+    //   (liblzma's default of 3x the dictionary size would leave a whole replay in one block)
+    lzma_mt mt;
+    memset(&mt, 0, sizeof(lzma_mt));
+    mt.threads    = threads;
+    mt.block_size = (o.block_size > 0) ? o.block_size
+      : std::max(uint64_t(1) << 20, uint64_t((inlen + threads - 1) / threads));
+    mt.filters    = filters;
+    mt.check      = LZMA_CHECK_CRC32;
+    ret = lzma_stream_encoder_mt(&strm, &mt);
+  }
+  if (ret != LZMA_OK) {
+    return false;
+  }
+
+  uint8_t out[CHUNK];
+  strm.next_in  = reinterpret_cast<const uint8_t*>(in);
+  strm.avail_in = inlen;
+  do {
+    strm.next_out  = out;
+    strm.avail_out = CHUNK;
+    ret = lzma_code(&strm, LZMA_FINISH);
+    if ((ret != LZMA_OK && ret != LZMA_STREAM_END)
+      || !sink(reinterpret_cast<const char*>(out), CHUNK - strm.avail_out)) {
+      lzma_end(&strm);
+      return false;
+    }
+  } while (ret != LZMA_STREAM_END);
+  lzma_end(&strm);
+  return true;
+}
+
+//Compress a buffer into an in-memory .xz stream (see compressWithLzmaStream())
+inline std::string compressWithLzma(const char* in, const size_t inlen, const LzmaOptions &o) {
   std::string result;
-  result.resize(inlen + (inlen >> 2) + 128);
-  size_t out_pos = 0;
-  if (LZMA_OK != lzma_easy_buffer_encode(
-      level, LZMA_CHECK_CRC32, NULL,
-      reinterpret_cast<const uint8_t*>(in), inlen,
-      reinterpret_cast<uint8_t*>(&result[0]), &out_pos, result.size()))
+  bool ok = compressWithLzmaStream(in, inlen, o, [&result](const char* chunk, size_t len) {
+    result.append(chunk, len);
+    return true;
+  });
+  if (!ok)
     abort();
-  result.resize(out_pos);
   return result;
 }
 
+inline std::string compressWithLzma(const char* in, const size_t inlen, uint32_t level = 6) {
+  LzmaOptions o;
+  o.preset = level;
+  return compressWithLzma(in, inlen, o);
+}
+
+//Read the uncompressed size of the last .xz stream in a buffer from the stream's index, without
+//  decompressing anything; returns 0 if the buffer doesn't end with a readable index
+inline uint64_t lzmaDecodedSize(const uint8_t* in, const size_t inlen) {
+  lzma_stream_flags flags;
+  if (inlen < 2*LZMA_STREAM_HEADER_SIZE
+    || lzma_stream_footer_decode(&flags, in + inlen - LZMA_STREAM_HEADER_SIZE) != LZMA_OK
+    || flags.backward_size > inlen - 2*LZMA_STREAM_HEADER_SIZE) {
+    return 0;
+  }
+  lzma_index* index    = nullptr;
+  uint64_t    memlimit = 1 << 20;  //Plenty for the handful of blocks in one of our streams
+  size_t      pos      = 0;
+  const uint8_t* start = in + inlen - LZMA_STREAM_HEADER_SIZE - flags.backward_size;
+  if (lzma_index_buffer_decode(&index, &memlimit, nullptr, start, &pos, flags.backward_size) != LZMA_OK) {
+    return 0;
+  }
+  uint64_t size = lzma_index_uncompressed_size(index);
+  lzma_index_end(index, nullptr);
+  return size;
+}
+
+//Initial output buffer size for decompressing a .xz buffer: the size from the stream's index (plus a byte
+//  so the decoder never runs out of room just before the end of the stream), so single-stream inputs are
+//  decompressed without regrowing. The index is untrusted, so the hint is capped at a compression ratio
+//  no real replay reaches; anything bigger is left to the decoder's regular growth
+inline size_t lzmaOutputHint(const uint8_t* in, const size_t inlen) {
+  static const uint64_t kMaxRatio = 256;
+  uint64_t hint = lzmaDecodedSize(in, inlen);
+  if (hint == 0) {
+    return 8192;
+  }
+  return std::min(hint, uint64_t(inlen) * kMaxRatio) + 1;
+}
+
+// http://ptspts.blogspot.com/2011/11/how-to-simply-compress-c-string-with.html
+//  Returns an empty string if the stream is corrupt or truncated
 inline std::string decompressWithLzma(const uint8_t* in, const size_t inlen) {
   static const size_t kMemLimit = 1 << 30;  // 1 GB.
   lzma_stream strm = LZMA_STREAM_INIT;
   std::string result;
-  result.resize(8192);
+  result.resize(lzmaOutputHint(in, inlen));
   size_t result_used = 0;
   lzma_ret ret;
   ret = lzma_stream_decoder(&strm, kMemLimit, LZMA_CONCATENATED);
@@ -486,8 +642,10 @@ inline std::string decompressWithLzma(const uint8_t* in, const size_t inlen) {
       lzma_end(&strm);
       return result;
     }
-    if (ret != LZMA_OK)
-      abort();
+    if (ret != LZMA_OK) {  //Bad input shouldn't take down a whole batch of replays
+      lzma_end(&strm);
+      return "";
+    }
     if (strm.avail_out == 0) {
       result_used += avail0 - strm.avail_out;
       result.resize(result.size() << 1);
@@ -586,36 +744,39 @@ inline std::string md5data(unsigned char* buffer, size_t length) {
   return md5tostring(digest);
 }
 
-inline std::string md5file(std::string fname, bool compressed = false) {
-  FILE* f = fopen(fname.c_str(),"r");
-  fseek(f, 0, SEEK_END);
-  size_t length = ftell(f);
-  fseek(f, 0, SEEK_SET);
-  unsigned char* b = (unsigned char*)malloc(length);
-  fread(b,1,length,f);
-  fclose(f);
-
-  if (compressed) {
-    std::string decomp = decompressWithLzma(b, length);
-    // Get the new file size
-    length = decomp.size();
-    // Delete the old read buffer
-    free(b);
-    // Reallocate it with more spce
-    b = (unsigned char*)malloc(length);
-    // Copy buffer from the decompressed string
-    memcpy(b,decomp.c_str(),length);
+//Get the MD5 of a file's contents as stored (see md5compressed() for compressed replays)
+inline std::string md5file(std::string fname) {
+  // stream files through the hash in chunks rather than reading them whole
+  std::ifstream f(fname, std::ios::binary | std::ios::in);
+  picohash_ctx_t ctx;
+  unsigned char digest[PICOHASH_MD5_DIGEST_LENGTH];
+  char buf[65536];
+  picohash_init_md5(&ctx);
+  while (f.good()) {
+    f.read(buf,sizeof(buf));
+    picohash_update(&ctx, buf, f.gcount());
   }
-
-  std::string m = md5data(b, length);
-
-  free(b);
-
-  return m;
+  picohash_final(&ctx, digest);
+  return md5tostring(digest);
 }
 
-inline std::string md5compressed(std::string fname) {
-  return md5file(fname,true);
+//Check whether two files have exactly the same contents
+inline bool filesIdentical(std::string fname1, std::string fname2) {
+  std::error_code ec1, ec2;
+  if (std::filesystem::file_size(fname1,ec1) != std::filesystem::file_size(fname2,ec2) || ec1 || ec2) {
+    return false;
+  }
+  std::ifstream f1(fname1, std::ios::binary | std::ios::in);
+  std::ifstream f2(fname2, std::ios::binary | std::ios::in);
+  char buf1[65536], buf2[65536];
+  while (f1.good() && f2.good()) {
+    f1.read(buf1,sizeof(buf1));
+    f2.read(buf2,sizeof(buf2));
+    if (f1.gcount() != f2.gcount() || memcmp(buf1,buf2,f1.gcount()) != 0) {
+      return false;
+    }
+  }
+  return f1.eof() && f2.eof();
 }
 
 inline bool isDirectory(const char* path) {
@@ -649,6 +810,66 @@ inline bool ensureExt(const char* ext, const char* fname) {
   return (fs.substr(fs.length()-4,4).compare(ext) == 0);
 }
 
+//Check whether a file name has a Slippi replay extension (.slp or .zlp)
+inline bool isReplayFile(std::string fname) {
+  std::string ext = getFileExt(fname);
+  return (ext.compare("slp") == 0) || (ext.compare("zlp") == 0);
+}
+
+//Get a sorted list of all replay files in a directory, optionally recursing into subdirectories
+inline std::vector<std::string> listReplayFiles(const char* path, bool recursive = false) {
+  std::vector<std::string> files;
+  std::error_code ec;
+  if (recursive) {
+    for (const auto & entry : std::filesystem::recursive_directory_iterator(path,
+        std::filesystem::directory_options::skip_permission_denied,ec)) {
+      if (entry.is_regular_file() && isReplayFile(entry.path().filename().string())) {
+        files.push_back(entry.path().string());
+      }
+    }
+  } else {
+    for (const auto & entry : std::filesystem::directory_iterator(path,ec)) {
+      if (entry.is_regular_file() && isReplayFile(entry.path().filename().string())) {
+        files.push_back(entry.path().string());
+      }
+    }
+  }
+  std::sort(files.begin(),files.end());
+  return files;
+}
+
+//Get the number of worker threads to use for n jobs (0 threads requested = one per core)
+inline unsigned numWorkers(unsigned njobs, unsigned nthreads) {
+  if (nthreads == 0) {
+    nthreads = std::max(1u,std::thread::hardware_concurrency());
+  }
+  return std::max(1u,std::min(nthreads,njobs));
+}
+
+//Run fn(job,worker) for every job in [0,njobs), spread over numWorkers(njobs,nthreads) threads
+//  Jobs are handed out in order; worker is in [0,numWorkers()) so callers can keep per-thread state
+inline void parallelFor(unsigned njobs, unsigned nthreads, const std::function<void(unsigned,unsigned)> &fn) {
+  unsigned nworkers = numWorkers(njobs,nthreads);
+  if (nworkers == 1) {
+    for (unsigned i = 0; i < njobs; ++i) {
+      fn(i,0);
+    }
+    return;
+  }
+  std::atomic<unsigned> next(0);
+  std::vector<std::thread> workers;
+  for (unsigned w = 0; w < nworkers; ++w) {
+    workers.emplace_back([&next,&fn,njobs,w]() {
+      for (unsigned i = next++; i < njobs; i = next++) {
+        fn(i,w);
+      }
+    });
+  }
+  for (std::thread &t : workers) {
+    t.join();
+  }
+}
+
 }
 
 #endif /* UTIL_H_ */